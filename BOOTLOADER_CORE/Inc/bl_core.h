@@ -0,0 +1,179 @@
+/*
+ * bl_core.h
+ *
+ * Bootloader core shared by every board: the frame receiver, the frame CRC
+ * check, command dispatch and the commands that behave the same everywhere.
+ * It is specialised at compile time by the board's bl_board.h (flash
+ * geometry, program width, RAM budget, UARTs, features); the flash, boot
+ * record and UART pieces that differ per family live in the board's
+ * bootloader.c, the port.
+ */
+
+#ifndef INC_BL_CORE_H_
+#define INC_BL_CORE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "bl_board.h"
+#include "bl_stats.h"
+#if BL_BOARD_SIGNATURE || BL_BOARD_CIPHER
+#include "bl_crypto.h"
+#endif
+
+#define BL_RX_LEN              BL_BOARD_RX_LEN
+
+/* Placement of the command loop, the replies and the erase poll, SRAM where
+ * the board keeps serving frames while its flash is busy */
+#define BL_RAM_FUNC            BL_BOARD_RAM_FUNC
+/* HAL millisecond tick, read directly: HAL_GetTick() runs from flash */
+#define BL_TICK()              (uwTick)
+/* CRC unit, fed one byte per word. A host build of the core brings its own. */
+#ifndef BL_CRC_RESET
+#define BL_CRC_RESET()         __HAL_CRC_DR_RESET(&hcrc)
+#define BL_CRC_FEED(value)     (hcrc.Instance->DR = (value))
+#define BL_CRC_VALUE()         (hcrc.Instance->DR)
+#endif
+
+#define UART_TIMEOUT_MS        3000
+#define TOTAL_TIMEOUT_MS       3000
+#define POLL_INTERVAL_MS       10
+#define BOOT_CMD               0x50
+#ifndef BL_RX_BYTE_TIMEOUT_MS
+#define BL_RX_BYTE_TIMEOUT_MS  50       // Quiet line inside a frame, drops the frame and resyncs
+#endif
+#ifndef BL_SESSION_TIMEOUT_MS
+#define BL_SESSION_TIMEOUT_MS  30000    // No valid frame for this long starts a valid application, 0 waits forever
+#endif
+#define BL_READY               0x5A     // Answer to BOOT_CMD once the command loop listens
+
+#define BL_GET_CID				0x51
+#define BL_GO_TO_RESET			0x52
+#define BL_FLASH_ERASE          0x53     // Frame depends on the board, see BL_CAP_PAGE_ERASE
+#define BL_MEM_WRITE			0x54
+#define BL_VERIFY				0x55
+#define BL_GET_CAPS				0x56
+#define BL_ERASE_RANGE			0x57
+#define BL_ERASE_STATUS			0x58
+#define BL_BATCH				0x59
+#define BL_SET_BOOT_FLAG		0x5B     // Only valid as a BL_BATCH operation
+#define BL_CIPHER_START			0x5C
+#define BL_GET_STATS			0x5D
+
+/* ACK and NACK bytes*/
+#define BL_ACK   0XA5
+#define BL_NACK  0X7F
+
+/* BL_GET_CAPS reply */
+#define BL_PROTOCOL_VERSION    1
+#define BL_CAP_VERIFY          0x01     // BL_VERIFY range CRC
+#define BL_CAP_WORD_PROGRAM    0x02     // Writes are programmed a word at a time
+#define BL_CAP_PAGE_ERASE      0x04     // Erase frame is first page(1) | page count(2)
+#define BL_CAP_COMPRESSION     0x08
+#define BL_CAP_WINDOWING       0x10
+#define BL_CAP_ERASE_RANGE     0x20     // BL_ERASE_RANGE by address and length
+#define BL_CAP_HALF_PAGE       0x40     // Aligned blocks are programmed a half page at a time
+#define BL_CAP_ASYNC_ERASE     0x80     // Erase is acknowledged at once, BL_ERASE_STATUS reports progress
+#define BL_MAX_PAYLOAD         (BL_RX_LEN - 11)    // len, cmd, addr(4), size(1) and crc(4) framing
+#define BL_CAP2_BATCH          0x01     // Second flags byte: BL_BATCH and BL_SET_BOOT_FLAG
+#define BL_CAP2_SIGNATURE      0x02     // BL_SET_BOOT_FLAG checks an Ed25519 signature when given one
+#define BL_CAP2_SIGNED_ONLY    0x04     // Only signed images are recorded and started
+#define BL_CAP2_ENCRYPTION     0x08     // BL_CIPHER_START, writes are decrypted with ChaCha20
+#define BL_CAP2_STATS          0x10     // BL_GET_STATS
+#define BL_CAPS_MAX_LEN        41
+
+/*CRC*/
+#define VERIFY_CRC_FAIL    1
+#define VERIFY_CRC_SUCCESS 0
+
+#define ADDR_VALID     0x00
+#define ADDR_INVALID   0x01
+
+#define INVALID_SECTOR 0x04
+
+#define BL_BATCH_BAD_OP   0x05     //malformed or unknown batch operation
+#define BL_BATCH_NOT_RUN  0xFF     //operations after the first failure
+#define BL_BATCH_MAX_OPS  BL_BOARD_BATCH_MAX_OPS
+
+#define BL_BAD_SIGNATURE   0x06
+
+#define BL_VERDICT_UNSIGNED 0x00000000U
+#define BL_VERDICT_SIGNED   0x5167600DU
+
+/* Encrypted transport. After BL_CIPHER_START with BL_CIPHER_CHACHA20, write
+ * payloads for the application area are decrypted before programming, with
+ * the key stream position given by the offset from the application base. */
+#define BL_CIPHER_NONE        0x00
+#define BL_CIPHER_CHACHA20    0x01
+#define BL_CIPHER_UNSUPPORTED 0x07
+
+#ifndef BL_SIGNED_BOOT
+#define BL_SIGNED_BOOT     0
+#endif
+#if BL_BOARD_SIGNATURE && !defined(BL_SIGNING_PUBKEY)
+#error "BL_BOARD_SIGNATURE needs the release public key, define BL_SIGNING_PUBKEY in bl_keys.h"
+#endif
+#if BL_BOARD_CIPHER && !defined(BL_IMAGE_KEY)
+#error "BL_BOARD_CIPHER needs the image key, define BL_IMAGE_KEY in bl_keys.h"
+#endif
+#if BL_SIGNED_BOOT && !BL_BOARD_SIGNATURE
+#error "BL_SIGNED_BOOT refuses every image without BL_SIGNING_PUBKEY, provision the key in bl_keys.h"
+#endif
+
+//One run of equally sized erase units, as reported by BL_GET_CAPS
+typedef struct
+{
+	uint16_t count;
+	uint8_t log2_size;
+} bl_flash_region_t;
+
+//A memory range [start, end) the host may read back with BL_VERIFY
+typedef struct
+{
+	uint32_t start;
+	uint32_t end;
+} bl_memory_range_t;
+
+extern uint8_t bl_rx_buffer[BL_RX_LEN];
+extern CRC_HandleTypeDef hcrc;
+
+/* Core */
+void  bootloader_uart_read_data(void);
+
+void bootloader_send_ack(uint8_t command_code, uint8_t follow_len);
+void bootloader_send_nack(void);
+void bootloader_send_ready(void);
+void bootloader_uart_write_data(uint8_t *pBuffer,uint32_t len);
+
+uint8_t bootloader_verify_crc (uint8_t *pData, uint32_t len,uint32_t crc_host);
+uint16_t get_mcu_chip_id(void);
+uint8_t verify_address_range(uint32_t address, uint32_t len);
+uint16_t bl_flash_unit(uint32_t address);
+uint32_t bl_flash_unit_address(uint16_t unit, uint32_t *size);
+uint8_t bl_flash_is_blank(uint32_t address, uint32_t len);
+uint8_t get_bootloader_caps(uint8_t *pBuffer);
+uint8_t execute_set_boot_flag(uint32_t app_size, uint32_t app_crc, const uint8_t *signature);
+uint32_t execute_range_crc(uint32_t mem_address, uint32_t len);
+uint32_t execute_transport_crc(uint32_t mem_address, uint32_t len);
+
+/* Port, one per board in its bootloader.c. The UART calls block until done. */
+void bootloader_uart_start(void);
+uint8_t bootloader_uart_available(void);
+void bootloader_uart_read(uint8_t *pBuffer, uint32_t len);
+void bootloader_uart_write(const uint8_t *pBuffer, uint32_t len);
+
+uint8_t execute_mem_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len);
+uint8_t bl_port_write_boot_record(uint32_t app_size, uint32_t app_crc, uint32_t verdict);
+uint8_t bl_port_handle_cmd(uint8_t *pBuffer);
+uint8_t bl_port_batch_op(uint8_t op, uint8_t *pArgs, uint8_t args_len);
+uint8_t bootloader_app_is_valid(void);
+void bootloader_jump_to_user_app(void);
+
+#if BL_BOARD_ASYNC_ERASE
+void bootloader_erase_poll(uint8_t start_next);
+void bootloader_erase_wait(uint16_t last_unit);
+#endif
+
+#endif /* INC_BL_CORE_H_ */
@@ -0,0 +1,33 @@
+/*
+ * bl_crypto.h
+ *
+ * Image hash and signature check for signed boot, ChaCha20 for encrypted
+ * image transport.
+ */
+
+#ifndef INC_BL_CRYPTO_H_
+#define INC_BL_CRYPTO_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define BL_SIGNATURE_VALID     0x00
+#define BL_SIGNATURE_INVALID   0x01
+
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+    uint32_t fill;
+} bl_sha256_ctx_t;
+
+void bl_sha256_init(bl_sha256_ctx_t *ctx);
+void bl_sha256_update(bl_sha256_ctx_t *ctx, const uint8_t *pData, uint32_t len);
+void bl_sha256_final(bl_sha256_ctx_t *ctx, uint8_t digest[32]);
+
+uint8_t bl_ed25519_verify(const uint8_t sig[64], const uint8_t *msg, uint32_t len, const uint8_t pubkey[32]);
+
+void bl_chacha20_xor(const uint8_t key[32], const uint8_t nonce[12], uint32_t offset, uint8_t *pData, uint32_t len);
+
+#endif /* INC_BL_CRYPTO_H_ */
@@ -0,0 +1,55 @@
+/*
+ * bl_stats.h
+ *
+ * Cycle counts per frame stage and per command, read back with BL_GET_STATS.
+ */
+
+#ifndef INC_BL_STATS_H_
+#define INC_BL_STATS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "bl_board.h"
+
+/* Frame stages, reported under these ids by BL_GET_STATS */
+#define BL_STAGE_RX             0x00     //rest of the frame after its length byte
+#define BL_STAGE_CRC            0x01     //frame CRC check
+#define BL_STAGE_PROGRAM        0x02     //flash busy programming a write
+#define BL_STAGE_ERASE          0x03     //flash busy erasing, per sector or page actually erased
+#define BL_STAGE_REPLY          0x04     //ACK, NACK and reply data on the wire
+#define BL_STAGE_BLANK_CHECK    0x05     //reading a sector or page back before its erase
+#define BL_STAGE_COUNT          6
+
+#define BL_STATS_FIRST_CMD      0x50
+#define BL_STATS_CMD_COUNT      14       //0x50 .. 0x5D
+
+/* BL_GET_STATS selector */
+#define BL_STATS_STAGES         0x00
+#define BL_STATS_COMMANDS       0x01
+#define BL_STATS_ERASED         0x02     //sectors or pages the last erase really erased
+#define BL_STATS_CLEAR          0x80     //or'ed in: clear the counters once reported
+
+#define BL_STATS_ENTRY_LEN      17       //id | count(4) | min(4) | max(4) | avg(4)
+#define BL_STATS_ERASED_LEN     (4 + (BL_BOARD_ERASE_UNITS + 7) / 8)
+
+#if BL_STATS_ERASED_LEN > 5 + BL_STATS_CMD_COUNT * BL_STATS_ENTRY_LEN
+#error "BL_BOARD_ERASE_UNITS does not fit in a BL_GET_STATS reply"
+#endif
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+} bl_stat_t;
+
+void bl_stats_init(void);
+uint32_t bl_stats_cycles(void);
+void bl_stats_stage(uint8_t stage, uint32_t start);
+void bl_stats_command(uint8_t command_code, uint32_t start);
+void bl_stats_erase_begin(uint16_t first_unit, uint16_t count);
+void bl_stats_erase_unit(uint16_t unit);
+uint8_t bl_stats_report(uint8_t selector, uint8_t *pBuffer);
+
+#endif /* INC_BL_STATS_H_ */
@@ -0,0 +1,835 @@
+/*
+ * bl_core.c
+ *
+ * Frame handling shared by every board. A frame is len | cmd | payload | crc(4),
+ * its CRC is checked once here before dispatch, so no handler repeats it.
+ * Commands whose frames differ per family (the erase frames, the erase
+ * progress poll) are passed on to the port.
+ */
+
+#include "bl_core.h"
+
+uint8_t bl_rx_buffer[BL_RX_LEN];
+
+static const bl_flash_region_t bl_flash_regions[] = BL_BOARD_FLASH_REGIONS;
+static const bl_memory_range_t bl_memory_map[] = BL_BOARD_MEMORY_MAP;
+static const uint8_t bl_uid_offsets[3] = BL_BOARD_UID_OFFSETS;
+
+#if BL_BOARD_SIGNATURE
+static const uint8_t bl_signing_pubkey[32] = BL_SIGNING_PUBKEY;
+#endif
+
+#if BL_BOARD_CIPHER
+//Cipher of the image being received, set by BL_CIPHER_START and kept until reset
+typedef struct
+{
+    uint8_t mode;           //BL_CIPHER_NONE or BL_CIPHER_CHACHA20
+    uint8_t nonce[12];
+} bl_cipher_t;
+
+static bl_cipher_t bl_cipher;
+static const uint8_t bl_image_key[32] = BL_IMAGE_KEY;
+#endif
+
+static uint8_t bl_range_within(uint32_t address, uint32_t len, uint32_t start, uint32_t end);
+static void bootloader_handle_getcid_cmd(uint8_t *pBuffer);
+static void bootloader_go_reset_cmd(uint8_t *pBuffer);
+static void bootloader_handle_mem_write_cmd(uint8_t *pBuffer);
+static void bootloader_handle_verify_cmd(uint8_t *pBuffer);
+static void bootloader_handle_getcaps_cmd(uint8_t *pBuffer);
+static void bootloader_handle_batch_cmd(uint8_t *pBuffer);
+static void bootloader_handle_get_stats_cmd(uint8_t *pBuffer);
+#if BL_BOARD_CIPHER
+static void bootloader_handle_cipher_start_cmd(uint8_t *pBuffer);
+static uint8_t bootloader_cipher_apply(uint8_t *pBuffer, uint32_t mem_address, uint32_t len);
+#endif
+
+/* Reads len bytes of a frame, giving up once the line has been quiet for
+ * BL_RX_BYTE_TIMEOUT_MS. A lost byte then costs one timeout instead of a
+ * link that stays out of step until reset. */
+BL_RAM_FUNC static uint8_t bootloader_read_frame(uint8_t *pBuffer, uint32_t len, uint32_t *received)
+{
+    uint32_t last = BL_TICK();
+
+    *received = 0;
+    while( *received < len )
+    {
+        if( bootloader_uart_available() )
+        {
+            bootloader_uart_read(&pBuffer[(*received)++], 1);
+            last = BL_TICK();
+        }
+        else if( BL_TICK() - last >= BL_RX_BYTE_TIMEOUT_MS )
+        {
+            return HAL_TIMEOUT;
+        }
+#if BL_BOARD_ASYNC_ERASE
+        else
+        {
+            bootloader_erase_poll(1);
+        }
+#endif
+    }
+    return HAL_OK;
+}
+
+/* Drops the rest of a broken frame: everything up to a quiet gap of
+ * BL_RX_BYTE_TIMEOUT_MS. The host sends nothing new before our reply, so
+ * its next frame starts on a clean line. */
+BL_RAM_FUNC static void bootloader_rx_resync(void)
+{
+    uint32_t last = BL_TICK();
+    uint8_t byte;
+
+    while( BL_TICK() - last < BL_RX_BYTE_TIMEOUT_MS )
+    {
+        if( bootloader_uart_available() )
+        {
+            bootloader_uart_read(&byte, 1);
+            last = BL_TICK();
+        }
+    }
+}
+
+BL_RAM_FUNC static uint8_t bootloader_is_sync_run(const uint8_t *pBuffer, uint32_t len)
+{
+    for( uint32_t i = 0 ; i < len ; i++ )
+    {
+        if( pBuffer[i] != BOOT_CMD )
+            return 0;
+    }
+    return 1;
+}
+
+#if BL_SESSION_TIMEOUT_MS
+/* A host that died mid session must not leave the device dark. Once no valid
+ * frame has come for BL_SESSION_TIMEOUT_MS the committed image is started;
+ * without one there is nothing better to do than keep listening. An erase
+ * withdraws the boot record, so an image the host was still writing is
+ * refused by bootloader_app_is_valid() until BL_SET_BOOT_FLAG commits it. */
+BL_RAM_FUNC static void bootloader_session_idle(uint32_t *last_frame)
+{
+    uint32_t msp_value;
+
+    if( BL_TICK() - *last_frame < BL_SESSION_TIMEOUT_MS )
+        return;
+
+#if BL_BOARD_ASYNC_ERASE
+    bootloader_erase_wait(0xffff);
+#endif
+    //erased flash reads 0xff on the F4 and 0x00 on the L0, neither is a stack
+    msp_value = *(volatile uint32_t *)BL_BOARD_APP_BASE;
+    if( msp_value != 0xFFFFFFFFU && msp_value != 0U && bootloader_app_is_valid() )
+    {
+        BL_LOG("host idle, starting the application");
+        bootloader_jump_to_user_app();
+    }
+    *last_frame = BL_TICK();
+}
+#endif
+
+/* Zeroes the receive buffer a byte at a time, memset() would run from flash */
+BL_RAM_FUNC static void bootloader_rx_clear(void)
+{
+    volatile uint8_t *p = bl_rx_buffer;
+
+    for( uint32_t i = 0 ; i < BL_RX_LEN ; i++ )
+        p[i] = 0;
+}
+
+/* The loop, the frame CRC check, the replies and the erase status poll run
+ * from SRAM on boards with a background erase, so a status poll is answered
+ * while a sector erases. Other commands first wait for the erase, they and
+ * the error logs may run from flash. */
+BL_RAM_FUNC void bootloader_uart_read_data(void)
+{
+    uint8_t rcv_len=0;
+    uint8_t synced=0;
+    uint32_t started;
+    uint32_t host_crc;
+    uint32_t received;
+    uint8_t status;
+#if BL_SESSION_TIMEOUT_MS
+    uint32_t last_frame;
+#endif
+
+    bootloader_uart_start();
+    bl_stats_init();
+#if BL_SESSION_TIMEOUT_MS
+    last_frame = BL_TICK();
+#endif
+
+    while(1)
+    {
+        bootloader_rx_clear();
+        while(!bootloader_uart_available())
+        {
+#if BL_BOARD_ASYNC_ERASE
+            //keep erasing in the background until the host sends something
+            bootloader_erase_poll(1);
+#endif
+#if BL_SESSION_TIMEOUT_MS
+            bootloader_session_idle(&last_frame);
+#endif
+        }
+        bootloader_uart_read(bl_rx_buffer,1);
+        /* Until the first frame arrives, repeated sync probes are answered instead of
+         * being taken as a length byte (0x50 is also the length of a 70 byte write) */
+        if(!synced && bl_rx_buffer[0] == BOOT_CMD)
+        {
+            bootloader_send_ready();
+            continue;
+        }
+        synced = 1;
+        rcv_len= bl_rx_buffer[0];
+
+        //every frame holds at least cmd and crc(4), the crc covers everything before it
+        if( rcv_len < 5 || rcv_len >= BL_RX_LEN )
+        {
+            bootloader_rx_resync();
+            bootloader_send_nack();
+            continue;
+        }
+
+        started = bl_stats_cycles();
+        status = bootloader_read_frame(&bl_rx_buffer[1], rcv_len, &received);
+        bl_stats_stage(BL_STAGE_RX, started);
+        if( status != HAL_OK )
+        {
+            /* Sync probes from a host that restarted its session look like a
+             * frame of 0x50 bytes that never completes, they get their answer */
+            if( bootloader_is_sync_run(bl_rx_buffer, received + 1) )
+            {
+                bootloader_send_ready();
+            }
+            else
+            {
+                BL_LOG("frame timed out after %" PRIu32 " of %d bytes", received, rcv_len);
+                bootloader_send_nack();
+            }
+            continue;
+        }
+        started = bl_stats_cycles();
+
+        host_crc = (uint32_t)bl_rx_buffer[rcv_len - 3] | ((uint32_t)bl_rx_buffer[rcv_len - 2] << 8) |
+                   ((uint32_t)bl_rx_buffer[rcv_len - 1] << 16) | ((uint32_t)bl_rx_buffer[rcv_len] << 24);
+        if( bootloader_verify_crc(bl_rx_buffer, rcv_len + 1 - 4, host_crc) != VERIFY_CRC_SUCCESS )
+        {
+            //a length byte that was hit on the line leaves the rest of the frame behind
+            BL_LOG("checksum fail !!");
+            bootloader_rx_resync();
+            bootloader_send_nack();
+            bl_stats_command(bl_rx_buffer[1], started);
+            continue;
+        }
+#if BL_SESSION_TIMEOUT_MS
+        last_frame = BL_TICK();
+#endif
+
+#if BL_BOARD_ASYNC_ERASE
+        /* Writes wait only for the sectors they touch and status polls not at all,
+         * any other command lets a background erase finish first */
+        if(bl_rx_buffer[1] != BL_MEM_WRITE && bl_rx_buffer[1] != BL_ERASE_STATUS)
+        {
+            bootloader_erase_wait(0xffff);
+        }
+#endif
+        switch(bl_rx_buffer[1])
+        {
+            case BL_GET_CID:
+                bootloader_handle_getcid_cmd(bl_rx_buffer);
+                break;
+            case BL_GO_TO_RESET:
+                bootloader_go_reset_cmd(bl_rx_buffer);
+                break;
+            case BL_MEM_WRITE:
+                bootloader_handle_mem_write_cmd(bl_rx_buffer);
+                break;
+            case BL_VERIFY:
+                bootloader_handle_verify_cmd(bl_rx_buffer);
+                break;
+            case BL_GET_CAPS:
+                bootloader_handle_getcaps_cmd(bl_rx_buffer);
+                break;
+            case BL_BATCH:
+                bootloader_handle_batch_cmd(bl_rx_buffer);
+                break;
+#if BL_BOARD_CIPHER
+            case BL_CIPHER_START:
+                bootloader_handle_cipher_start_cmd(bl_rx_buffer);
+                break;
+#endif
+            case BL_GET_STATS:
+                bootloader_handle_get_stats_cmd(bl_rx_buffer);
+                break;
+            default:
+                //erase frames and anything else only this board knows
+                if( !bl_port_handle_cmd(bl_rx_buffer) )
+                {
+                    //answered at once, the host would otherwise sit out its reply timeout
+                    BL_LOG("Invalid command code received from host");
+                    bootloader_send_nack();
+                }
+                break;
+        }
+        bl_stats_command(bl_rx_buffer[1], started);
+    }
+}
+
+
+static void bootloader_go_reset_cmd(uint8_t *pBuffer)
+{
+    uint8_t status = ADDR_VALID;
+
+    BL_LOG("bootloader_go_reset_cmd");
+    bootloader_send_ack(pBuffer[0],0);
+    bootloader_uart_write_data(&status,1);
+    BL_LOG("Going to reset... !!");
+    HAL_Delay(1000);
+    NVIC_SystemReset();
+}
+
+
+static void bootloader_handle_getcid_cmd(uint8_t *pBuffer)
+{
+    uint16_t bl_cid_num = get_mcu_chip_id();
+
+    BL_LOG("MCU id : %#x", bl_cid_num);
+    bootloader_send_ack(pBuffer[0],2);
+    bootloader_uart_write_data((uint8_t *)&bl_cid_num,2);
+}
+
+
+/* Validates, waits for and decrypts a write as needed, then hands it to the
+ * port. Shared by BL_MEM_WRITE and its batch form. */
+static uint8_t bootloader_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len)
+{
+    uint8_t status;
+
+    //the application area only, the bootloader and its boot records are written by the bootloader alone
+    if( !bl_range_within(mem_address, len, BL_BOARD_APP_BASE, BL_BOARD_APP_END) )
+        return ADDR_INVALID;
+
+#if BL_BOARD_ASYNC_ERASE
+    //sectors this write lands in must be out of the background erase first
+    bootloader_erase_wait(bl_flash_unit(mem_address + len - 1));
+#endif
+#if BL_BOARD_CIPHER
+    //decrypt in place
+    status = bootloader_cipher_apply(pBuffer, mem_address, len);
+    if( status != HAL_OK )
+        return status;
+#endif
+
+    BL_BOARD_ACTIVITY(1);
+    status = execute_mem_write(pBuffer, mem_address, len);
+    BL_BOARD_ACTIVITY(0);
+
+    return status;
+}
+
+
+/* Frame: len | cmd | addr(4) | size | payload | crc(4)
+ * Reply: ACK, 1 | status */
+static void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
+{
+    uint8_t write_status = ADDR_INVALID;
+    uint8_t payload_len = pBuffer[6];
+    uint32_t mem_address;
+
+    memcpy(&mem_address, &pBuffer[2], 4);
+    BL_LOG("mem write addr:%#" PRIx32 " len:%d", mem_address, payload_len);
+
+    bootloader_send_ack(pBuffer[0],1);
+
+    if( pBuffer[0] == 10 + payload_len )
+    {
+        write_status = bootloader_write(&pBuffer[7], mem_address, payload_len);
+    }
+
+    bootloader_uart_write_data(&write_status,1);
+}
+
+
+/* Replies with the CRC of a range of the application area so the host can confirm
+ * what is already programmed (e.g. before resuming an interrupted update).
+ * Frame: len | cmd | addr(4) | length(4) | crc(4)
+ * Reply: ACK, 5 | status | crc32(4) */
+static void bootloader_handle_verify_cmd(uint8_t *pBuffer)
+{
+    uint8_t reply[5] = {ADDR_INVALID, 0, 0, 0, 0};
+    uint32_t range_crc;
+    uint32_t mem_address, length;
+
+    memcpy(&mem_address, &pBuffer[2], 4);
+    memcpy(&length, &pBuffer[6], 4);
+    BL_LOG("verify addr:%#" PRIx32 " len:%" PRIu32, mem_address, length);
+
+    bootloader_send_ack(pBuffer[0],5);
+
+    if( verify_address_range(mem_address, length) == ADDR_VALID )
+    {
+        range_crc = execute_transport_crc(mem_address, length);
+        reply[0] = ADDR_VALID;
+        memcpy(&reply[1], &range_crc, 4);
+    }
+
+    bootloader_uart_write_data(reply,5);
+}
+
+
+/* Describes this target so the host can size erases and frames at runtime.
+ * Reply: ACK, n | caps, see get_bootloader_caps() */
+static void bootloader_handle_getcaps_cmd(uint8_t *pBuffer)
+{
+    uint8_t caps[BL_CAPS_MAX_LEN];
+    uint8_t caps_len = get_bootloader_caps(caps);
+
+    BL_LOG("bootloader_handle_getcaps_cmd");
+    bootloader_send_ack(pBuffer[0],caps_len);
+    bootloader_uart_write_data(caps,caps_len);
+}
+
+
+//One BL_BATCH operation, arguments are the payload of the matching command frame
+static uint8_t execute_batch_op(uint8_t op, uint8_t *pArgs, uint8_t args_len, uint8_t *reset)
+{
+    uint32_t mem_address, length, crc;
+
+    switch(op)
+    {
+        case BL_MEM_WRITE:
+            if( args_len < 5 || args_len != 5 + pArgs[4] )
+                return BL_BATCH_BAD_OP;
+            memcpy(&mem_address, &pArgs[0], 4);
+            return bootloader_write(&pArgs[5], mem_address, pArgs[4]);
+
+        case BL_VERIFY:
+            if( args_len != 12 )
+                return BL_BATCH_BAD_OP;
+            memcpy(&mem_address, &pArgs[0], 4);
+            memcpy(&length, &pArgs[4], 4);
+            memcpy(&crc, &pArgs[8], 4);
+            if( verify_address_range(mem_address, length) != ADDR_VALID )
+                return ADDR_INVALID;
+#if BL_BOARD_ASYNC_ERASE
+            bootloader_erase_wait(0xffff);
+#endif
+            return (execute_transport_crc(mem_address, length) == crc) ? VERIFY_CRC_SUCCESS : VERIFY_CRC_FAIL;
+
+        case BL_SET_BOOT_FLAG:
+            //size(4) | crc(4) [| ed25519 signature(64)]
+            if( args_len != 8 && !(BL_BOARD_SIGNATURE && args_len == 72) )
+                return BL_BATCH_BAD_OP;
+            memcpy(&length, &pArgs[0], 4);
+            memcpy(&crc, &pArgs[4], 4);
+#if BL_BOARD_ASYNC_ERASE
+            bootloader_erase_wait(0xffff);
+#endif
+            return execute_set_boot_flag(length, crc, (args_len == 72) ? &pArgs[8] : NULL);
+
+        case BL_GO_TO_RESET:
+            if( args_len != 0 )
+                return BL_BATCH_BAD_OP;
+            *reset = 1;
+            return HAL_OK;
+
+        default:
+            //the erase operations
+            return bl_port_batch_op(op, pArgs, args_len);
+    }
+}
+
+
+/* Runs a list of operations from one frame, in order, stopping at the first
+ * failure. Operations reuse the command codes and frame payloads.
+ * Frame: len | cmd | count | {op | args len | args}... | crc(4)
+ * Reply: ACK, 2 + count | first failed index (0xFF none) | executed | status per op */
+static void bootloader_handle_batch_cmd(uint8_t *pBuffer)
+{
+    uint8_t reply[2 + BL_BATCH_MAX_OPS];
+    uint8_t count = pBuffer[2];
+    uint8_t reset = 0;
+    uint32_t pos = 3;
+    uint32_t end = (uint32_t)pBuffer[0] + 1U - 4U;
+
+    BL_LOG("bootloader_handle_batch_cmd");
+
+    if( pBuffer[0] < 6 || count > BL_BATCH_MAX_OPS )
+    {
+        bootloader_send_nack();
+        return;
+    }
+    bootloader_send_ack(pBuffer[0],2 + count);
+
+    reply[0] = BL_BATCH_NOT_RUN;
+    reply[1] = 0;
+    memset(&reply[2], BL_BATCH_NOT_RUN, count);
+
+    for(uint8_t i = 0 ; i < count ; i++)
+    {
+        uint8_t status = BL_BATCH_BAD_OP;
+
+        if( pos + 2 <= end && pos + 2 + pBuffer[pos + 1] <= end )
+        {
+            status = execute_batch_op(pBuffer[pos], &pBuffer[pos + 2], pBuffer[pos + 1], &reset);
+            pos += 2 + pBuffer[pos + 1];
+        }
+        reply[2 + i] = status;
+        reply[1]++;
+
+        if( status != HAL_OK )
+        {
+            BL_LOG("batch op %d failed: %#x", i, status);
+            reply[0] = i;
+            break;
+        }
+    }
+
+    bootloader_uart_write_data(reply,2 + count);
+
+    //a reset operation takes effect once the whole batch has been answered
+    if( reset && reply[0] == BL_BATCH_NOT_RUN )
+    {
+#if BL_BOARD_ASYNC_ERASE
+        bootloader_erase_wait(0xffff);
+#endif
+        NVIC_SystemReset();
+    }
+}
+
+
+#if BL_BOARD_CIPHER
+/* Selects how the following write payloads are encrypted. The nonce is the
+ * image's own, the key never leaves the bootloader.
+ * Frame: len | cmd | cipher | nonce(12) | crc(4)
+ * Reply: ACK, 1 | status */
+static void bootloader_handle_cipher_start_cmd(uint8_t *pBuffer)
+{
+    uint8_t status = BL_CIPHER_UNSUPPORTED;
+
+    BL_LOG("bootloader_handle_cipher_start_cmd");
+    bootloader_send_ack(pBuffer[0],1);
+
+    if( pBuffer[0] == 18 && (pBuffer[2] == BL_CIPHER_NONE || pBuffer[2] == BL_CIPHER_CHACHA20) )
+    {
+        bl_cipher.mode = pBuffer[2];
+        memcpy(bl_cipher.nonce, &pBuffer[3], sizeof(bl_cipher.nonce));
+        status = HAL_OK;
+        BL_LOG("cipher %d selected", bl_cipher.mode);
+    }
+
+    bootloader_uart_write_data(&status,1);
+}
+
+
+/* Decrypts a write payload in place when a cipher is selected. Only the
+ * application area is encrypted, anything else is refused meanwhile. */
+static uint8_t bootloader_cipher_apply(uint8_t *pBuffer, uint32_t mem_address, uint32_t len)
+{
+    if( bl_cipher.mode == BL_CIPHER_NONE )
+        return HAL_OK;
+    if( mem_address < BL_BOARD_APP_BASE || mem_address + len > BL_BOARD_APP_END )
+        return ADDR_INVALID;
+
+    bl_chacha20_xor(bl_image_key, bl_cipher.nonce, mem_address - BL_BOARD_APP_BASE, pBuffer, len);
+    return HAL_OK;
+}
+#endif
+
+
+/* Reports cycle counts, per frame stage or per command, or what the last erase erased.
+ * Frame: len | cmd | selector | crc(4)
+ * Reply: ACK, n | core clock(4) | entries | {id | count(4) | min(4) | max(4) | avg(4)}...
+ *        ACK, n | first unit(2) | units(2) | mask                 for BL_STATS_ERASED */
+static void bootloader_handle_get_stats_cmd(uint8_t *pBuffer)
+{
+    uint8_t stats[5 + BL_STATS_CMD_COUNT * BL_STATS_ENTRY_LEN];
+    uint8_t stats_len;
+
+    BL_LOG("bootloader_handle_get_stats_cmd");
+
+    if( pBuffer[0] != 6 )
+    {
+        bootloader_send_nack();
+        return;
+    }
+    stats_len = bl_stats_report(pBuffer[2], stats);
+    bootloader_send_ack(pBuffer[0],stats_len);
+    bootloader_uart_write_data(stats,stats_len);
+}
+
+
+BL_RAM_FUNC void bootloader_send_ack(uint8_t command_code, uint8_t follow_len)
+{
+    uint32_t started = bl_stats_cycles();
+    //here we send 2 byte.. first byte is ack and the second byte is len value
+    uint8_t ack_buf[2] = { BL_ACK, follow_len };
+
+    bootloader_uart_write(ack_buf,2);
+    bl_stats_stage(BL_STAGE_REPLY, started);
+}
+
+/*This function sends NACK */
+BL_RAM_FUNC void bootloader_send_nack(void)
+{
+    uint32_t started = bl_stats_cycles();
+    uint8_t nack = BL_NACK;
+
+    bootloader_uart_write(&nack,1);
+    bl_stats_stage(BL_STAGE_REPLY, started);
+}
+
+/*This function tells the host the command loop is ready */
+BL_RAM_FUNC void bootloader_send_ready(void)
+{
+    uint8_t ready = BL_READY;
+
+    bootloader_uart_write(&ready,1);
+}
+
+BL_RAM_FUNC void bootloader_uart_write_data(uint8_t *pBuffer,uint32_t len)
+{
+    uint32_t started = bl_stats_cycles();
+
+    bootloader_uart_write(pBuffer,len);
+    bl_stats_stage(BL_STAGE_REPLY, started);
+}
+
+
+//This verifies the CRC of the given buffer in pData
+BL_RAM_FUNC uint8_t bootloader_verify_crc (uint8_t *pData, uint32_t len, uint32_t crc_host)
+{
+    uint32_t started = bl_stats_cycles();
+    uint32_t uwCRCValue = execute_range_crc((uint32_t)(uintptr_t)pData, len);
+
+    bl_stats_stage(BL_STAGE_CRC, started);
+
+    return (uwCRCValue == crc_host) ? VERIFY_CRC_SUCCESS : VERIFY_CRC_FAIL;
+}
+
+
+uint16_t get_mcu_chip_id(void)
+{
+    return (uint16_t)(DBGMCU->IDCODE) & 0x0FFF;
+}
+
+
+//Whether [address, address + len) is not empty and lies inside [start, end), without overflow
+static uint8_t bl_range_within(uint32_t address, uint32_t len, uint32_t start, uint32_t end)
+{
+    return len > 0 && address >= start && address < end && len <= end - address;
+}
+
+/* Whether [address, address + len) is not empty and lies inside one of the
+ * board's ranges. Checking the first and last byte alone passes a length that
+ * wraps, or a range that spans the unmapped gap between two of them. */
+uint8_t verify_address_range(uint32_t address, uint32_t len)
+{
+    for( uint32_t i = 0 ; i < sizeof(bl_memory_map) / sizeof(bl_memory_map[0]) ; i++ )
+    {
+        if( bl_range_within(address, len, bl_memory_map[i].start, bl_memory_map[i].end) )
+            return ADDR_VALID;
+    }
+    return ADDR_INVALID;
+}
+
+
+/* Erase unit (sector or page) holding a flash address, counted through the
+ * geometry table. Units past the table, like a boot record sector kept from
+ * the host, follow on from its last one. */
+uint16_t bl_flash_unit(uint32_t address)
+{
+    uint32_t offset = address - FLASH_BASE;
+    uint16_t unit = 0;
+
+    for( uint32_t i = 0 ; i < sizeof(bl_flash_regions) / sizeof(bl_flash_regions[0]) ; i++ )
+    {
+        uint32_t region_size = (uint32_t)bl_flash_regions[i].count << bl_flash_regions[i].log2_size;
+
+        if( offset < region_size )
+            return unit + (uint16_t)(offset >> bl_flash_regions[i].log2_size);
+        offset -= region_size;
+        unit += bl_flash_regions[i].count;
+    }
+    return unit;
+}
+
+/* Start address and size of an erase unit, the inverse of bl_flash_unit().
+ * Units past the table have the size of its last region. */
+uint32_t bl_flash_unit_address(uint16_t unit, uint32_t *size)
+{
+    uint32_t address = FLASH_BASE;
+    uint32_t i;
+
+    for( i = 0 ; i < sizeof(bl_flash_regions) / sizeof(bl_flash_regions[0]) ; i++ )
+    {
+        if( unit < bl_flash_regions[i].count )
+            break;
+        address += (uint32_t)bl_flash_regions[i].count << bl_flash_regions[i].log2_size;
+        unit -= bl_flash_regions[i].count;
+    }
+    if( i == sizeof(bl_flash_regions) / sizeof(bl_flash_regions[0]) )
+        i--;
+    *size = 1UL << bl_flash_regions[i].log2_size;
+    return address + (uint32_t)unit * *size;
+}
+
+/* Whether [address, address + len) already reads as erased, checked a word at
+ * a time through the memory mapped flash and given up at the first word that
+ * is not. Reading back a sector is far cheaper than erasing it again. */
+uint8_t bl_flash_is_blank(uint32_t address, uint32_t len)
+{
+    const volatile uint32_t *word = (const volatile uint32_t *)(uintptr_t)address;
+    uint32_t started = bl_stats_cycles();
+    uint8_t blank = 1;
+
+    for( len /= 4 ; len > 0 ; len-- )
+    {
+        if( *word++ != BL_BOARD_ERASED_WORD )
+        {
+            blank = 0;
+            break;
+        }
+    }
+    bl_stats_stage(BL_STAGE_BLANK_CHECK, started);
+    return blank;
+}
+
+
+/* Fills in the BL_GET_CAPS reply, returns its length.
+ * version | flags | max payload | write align | app base(4) | flash base(4) |
+ * flash size(4) | uid(12) | regions | {count(2), log2 size}... | flags2 */
+uint8_t get_bootloader_caps(uint8_t *pBuffer)
+{
+    uint32_t app_base = BL_BOARD_APP_BASE;
+    uint32_t flash_base = FLASH_BASE;
+    uint32_t flash_size = BL_BOARD_FLASH_SIZE;
+    uint8_t len = 29;
+
+    pBuffer[0] = BL_PROTOCOL_VERSION;
+    pBuffer[1] = BL_BOARD_CAPS;
+    //whole program units per frame keep every block on the fast path
+    pBuffer[2] = BL_MAX_PAYLOAD & ~(BL_BOARD_WRITE_ALIGN - 1U);
+    pBuffer[3] = BL_BOARD_WRITE_ALIGN;
+    memcpy(&pBuffer[4], &app_base, 4);
+    memcpy(&pBuffer[8], &flash_base, 4);
+    memcpy(&pBuffer[12], &flash_size, 4);
+    for( uint8_t i = 0 ; i < 3 ; i++ )
+    {
+        memcpy(&pBuffer[16 + i * 4], (const void *)(UID_BASE + bl_uid_offsets[i]), 4);
+    }
+
+    pBuffer[28] = sizeof(bl_flash_regions) / sizeof(bl_flash_regions[0]);
+    for( uint8_t i = 0 ; i < pBuffer[28] ; i++ )
+    {
+        pBuffer[len++] = (uint8_t)bl_flash_regions[i].count;
+        pBuffer[len++] = (uint8_t)(bl_flash_regions[i].count >> 8);
+        pBuffer[len++] = bl_flash_regions[i].log2_size;
+    }
+
+    pBuffer[len++] = BL_CAP2_BATCH | BL_CAP2_STATS
+                   | (BL_BOARD_SIGNATURE ? BL_CAP2_SIGNATURE : 0)
+                   | (BL_BOARD_CIPHER ? BL_CAP2_ENCRYPTION : 0)
+                   | (BL_SIGNED_BOOT ? BL_CAP2_SIGNED_ONLY : 0);
+    return len;
+}
+
+
+/* Records the image only if the flash really holds it. A signature is checked
+ * here, once, and its verdict kept in the record. */
+uint8_t execute_set_boot_flag(uint32_t app_size, uint32_t app_crc, const uint8_t *signature)
+{
+    uint32_t verdict = BL_VERDICT_UNSIGNED;
+
+    if( app_size == 0 || app_size > BL_BOARD_APP_END - BL_BOARD_APP_BASE )
+        return ADDR_INVALID;
+    if( execute_range_crc(BL_BOARD_APP_BASE, app_size) != app_crc )
+        return VERIFY_CRC_FAIL;
+
+#if BL_BOARD_SIGNATURE
+    if( signature )
+    {
+        bl_sha256_ctx_t sha;
+        uint8_t digest[32];
+        uint32_t start = HAL_GetTick();
+
+        bl_sha256_init(&sha);
+        bl_sha256_update(&sha, (const uint8_t *)BL_BOARD_APP_BASE, app_size);
+        bl_sha256_final(&sha, digest);
+        if( bl_ed25519_verify(signature, digest, sizeof(digest), bl_signing_pubkey) != BL_SIGNATURE_VALID )
+        {
+            BL_LOG("image signature invalid");
+            return BL_BAD_SIGNATURE;
+        }
+        verdict = BL_VERDICT_SIGNED;
+        BL_LOG("image signature valid, checked in %" PRIu32 " ms", HAL_GetTick() - start);
+    }
+#else
+    (void)signature;
+#endif
+    if( BL_SIGNED_BOOT && verdict != BL_VERDICT_SIGNED )
+        return BL_BAD_SIGNATURE;
+
+    BL_LOG("boot flag set for %" PRIu32 " bytes", app_size);
+    return bl_port_write_boot_record(app_size, app_crc, verdict);
+}
+
+
+/* CRC of a range as the host holds it: the flash contents encrypted again
+ * while a cipher is selected, so resume and verify work on the ciphertext */
+uint32_t execute_transport_crc(uint32_t mem_address, uint32_t len)
+{
+#if BL_BOARD_CIPHER
+    uint8_t block[64];
+    uint32_t uwCRCValue;
+
+    if( bl_cipher.mode == BL_CIPHER_NONE || mem_address < BL_BOARD_APP_BASE
+            || mem_address + len > BL_BOARD_APP_END )
+        return execute_range_crc(mem_address, len);
+
+    BL_CRC_RESET();
+
+    while (len > 0)
+    {
+        uint32_t n = (len < sizeof(block)) ? len : sizeof(block);
+
+        memcpy(block, (const void *)mem_address, n);
+        bl_chacha20_xor(bl_image_key, bl_cipher.nonce, mem_address - BL_BOARD_APP_BASE, block, n);
+        for (uint32_t i = 0 ; i < n ; i++)
+        {
+            BL_CRC_FEED(block[i]);
+        }
+        mem_address += n;
+        len -= n;
+    }
+    uwCRCValue = BL_CRC_VALUE();
+
+    BL_CRC_RESET();
+
+    return uwCRCValue;
+#else
+    return execute_range_crc(mem_address, len);
+#endif
+}
+
+
+/* Computes the CRC of a memory range the same way the host does, each byte fed
+ * as a full 32-bit word. Frames in SRAM go through here too. */
+BL_RAM_FUNC uint32_t execute_range_crc(uint32_t mem_address, uint32_t len)
+{
+    uint32_t uwCRCValue;
+
+    BL_CRC_RESET();
+
+    //fed straight into DR, the HAL call per byte dominated a whole image verify
+    for (uint32_t i = 0 ; i < len ; i++)
+    {
+        BL_CRC_FEED(*((volatile uint8_t *)(uintptr_t)(mem_address + i)));
+    }
+    uwCRCValue = BL_CRC_VALUE();
+
+    BL_CRC_RESET();
+
+    return uwCRCValue;
+}
@@ -0,0 +1,708 @@
+/*
+ * bl_crypto.c
+ *
+ * Streaming SHA-256 over the image and Ed25519 signature verification, after
+ * the public domain TweetNaCl. Only verification is needed, so nothing here
+ * has to run in constant time, it runs once per update rather than per boot.
+ *
+ * ChaCha20 (RFC 8439) decrypts encrypted images as the frames arrive. It needs
+ * no tables, only 32-bit adds, xors and rotates, which the M4 does in a cycle.
+ */
+
+#include "bl_crypto.h"
+
+/* ---- SHA-256 ---- */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+    0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+    0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+    0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+    0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+    0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+    0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+    0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U
+};
+
+static const uint32_t sha256_h0[8] = {
+    0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU, 0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U
+};
+
+#define ROR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(bl_sha256_ctx_t *ctx, const uint8_t *block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    for (i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+void bl_sha256_init(bl_sha256_ctx_t *ctx)
+{
+    memcpy(ctx->state, sha256_h0, sizeof(ctx->state));
+    ctx->length = 0;
+    ctx->fill = 0;
+}
+
+void bl_sha256_update(bl_sha256_ctx_t *ctx, const uint8_t *pData, uint32_t len)
+{
+    ctx->length += len;
+    while (len > 0)
+    {
+        /* whole blocks straight from flash, the rest through the buffer */
+        if (ctx->fill == 0 && len >= 64)
+        {
+            sha256_block(ctx, pData);
+            pData += 64;
+            len -= 64;
+            continue;
+        }
+        uint32_t n = 64 - ctx->fill;
+        if (n > len)
+            n = len;
+        memcpy(&ctx->buffer[ctx->fill], pData, n);
+        ctx->fill += n;
+        pData += n;
+        len -= n;
+        if (ctx->fill == 64)
+        {
+            sha256_block(ctx, ctx->buffer);
+            ctx->fill = 0;
+        }
+    }
+}
+
+void bl_sha256_final(bl_sha256_ctx_t *ctx, uint8_t digest[32])
+{
+    uint64_t bits = ctx->length * 8;
+    int i;
+
+    ctx->buffer[ctx->fill++] = 0x80;
+    if (ctx->fill > 56)
+    {
+        memset(&ctx->buffer[ctx->fill], 0, 64 - ctx->fill);
+        sha256_block(ctx, ctx->buffer);
+        ctx->fill = 0;
+    }
+    memset(&ctx->buffer[ctx->fill], 0, 56 - ctx->fill);
+    for (i = 0; i < 8; i++)
+        ctx->buffer[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_block(ctx, ctx->buffer);
+
+    for (i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+/* ---- SHA-512, only for the Ed25519 challenge ---- */
+
+typedef struct
+{
+    uint64_t state[8];
+    uint8_t buffer[128];
+    uint32_t fill;
+    uint32_t length;
+} sha512_ctx_t;
+
+static const uint64_t sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const uint64_t sha512_h0[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+#define ROR64(x, n)  (((x) >> (n)) | ((x) << (64 - (n))))
+
+static void sha512_block(sha512_ctx_t *ctx, const uint8_t *block)
+{
+    uint64_t w[80];
+    uint64_t a, b, c, d, e, f, g, h;
+    int i, j;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = 0;
+        for (j = 0; j < 8; j++)
+            w[i] = (w[i] << 8) | block[8 * i + j];
+    }
+    for (i = 16; i < 80; i++)
+    {
+        uint64_t s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    for (i = 0; i < 80; i++)
+    {
+        uint64_t t1 = h + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+        uint64_t t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+static void sha512_init(sha512_ctx_t *ctx)
+{
+    memcpy(ctx->state, sha512_h0, sizeof(ctx->state));
+    ctx->fill = 0;
+    ctx->length = 0;
+}
+
+static void sha512_update(sha512_ctx_t *ctx, const uint8_t *pData, uint32_t len)
+{
+    ctx->length += len;
+    while (len--)
+    {
+        ctx->buffer[ctx->fill++] = *pData++;
+        if (ctx->fill == 128)
+        {
+            sha512_block(ctx, ctx->buffer);
+            ctx->fill = 0;
+        }
+    }
+}
+
+static void sha512_final(sha512_ctx_t *ctx, uint8_t digest[64])
+{
+    uint64_t bits = (uint64_t)ctx->length * 8;
+    int i;
+
+    ctx->buffer[ctx->fill++] = 0x80;
+    if (ctx->fill > 112)
+    {
+        memset(&ctx->buffer[ctx->fill], 0, 128 - ctx->fill);
+        sha512_block(ctx, ctx->buffer);
+        ctx->fill = 0;
+    }
+    memset(&ctx->buffer[ctx->fill], 0, 120 - ctx->fill);
+    for (i = 0; i < 8; i++)
+        ctx->buffer[120 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha512_block(ctx, ctx->buffer);
+
+    for (i = 0; i < 64; i++)
+        digest[i] = (uint8_t)(ctx->state[i / 8] >> (56 - 8 * (i % 8)));
+}
+
+/* ---- Ed25519 verification ---- */
+
+/* Field elements mod 2^255 - 19 as sixteen 16 bit limbs */
+typedef int64_t gf[16];
+
+static const gf gf0;
+static const gf gf1 = { 1 };
+static const gf ed_d = { 0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070,
+                         0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203 };
+static const gf ed_d2 = { 0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0,
+                          0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406 };
+static const gf ed_x = { 0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c,
+                         0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169 };
+static const gf ed_y = { 0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666,
+                         0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666 };
+static const gf sqrt_m1 = { 0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43,
+                            0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83 };
+
+/* Group order L, little endian */
+static const int64_t ed_l[32] = { 0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+                                  0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+                                  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10 };
+
+static void gf_copy(gf r, const gf a)
+{
+    memcpy(r, a, sizeof(gf));
+}
+
+static void gf_carry(gf o)
+{
+    int64_t c;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        o[i] += (1LL << 16);
+        c = o[i] >> 16;
+        if (i < 15)
+            o[i + 1] += c - 1;
+        else
+            o[0] += 38 * (c - 1);
+        o[i] -= c * 65536;
+    }
+}
+
+static void gf_select(gf p, gf q, int b)
+{
+    int64_t t, c = ~(b - 1);
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        t = c & (p[i] ^ q[i]);
+        p[i] ^= t;
+        q[i] ^= t;
+    }
+}
+
+static void gf_pack(uint8_t *o, const gf n)
+{
+    gf m, t;
+    int i, j, b;
+
+    gf_copy(t, n);
+    gf_carry(t);
+    gf_carry(t);
+    gf_carry(t);
+    for (j = 0; j < 2; j++)
+    {
+        m[0] = t[0] - 0xffed;
+        for (i = 1; i < 15; i++)
+        {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        b = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        gf_select(t, m, 1 - b);
+    }
+    for (i = 0; i < 16; i++)
+    {
+        o[2 * i] = (uint8_t)t[i];
+        o[2 * i + 1] = (uint8_t)(t[i] >> 8);
+    }
+}
+
+static int gf_differ(const gf a, const gf b)
+{
+    uint8_t c[32], d[32];
+
+    gf_pack(c, a);
+    gf_pack(d, b);
+    return memcmp(c, d, 32) != 0;
+}
+
+static uint8_t gf_parity(const gf a)
+{
+    uint8_t d[32];
+
+    gf_pack(d, a);
+    return d[0] & 1;
+}
+
+static void gf_unpack(gf o, const uint8_t *n)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+    o[15] &= 0x7fff;
+}
+
+static void gf_add(gf o, const gf a, const gf b)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        o[i] = a[i] + b[i];
+}
+
+static void gf_sub(gf o, const gf a, const gf b)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        o[i] = a[i] - b[i];
+}
+
+static void gf_mul(gf o, const gf a, const gf b)
+{
+    int64_t t[31];
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 16; i++)
+        for (j = 0; j < 16; j++)
+            t[i + j] += a[i] * b[j];
+    for (i = 0; i < 15; i++)
+        t[i] += 38 * t[i + 16];
+    for (i = 0; i < 16; i++)
+        o[i] = t[i];
+    gf_carry(o);
+    gf_carry(o);
+}
+
+static void gf_square(gf o, const gf a)
+{
+    gf_mul(o, a, a);
+}
+
+static void gf_invert(gf o, const gf in)
+{
+    gf c;
+    int a;
+
+    gf_copy(c, in);
+    for (a = 253; a >= 0; a--)
+    {
+        gf_square(c, c);
+        if (a != 2 && a != 4)
+            gf_mul(c, c, in);
+    }
+    gf_copy(o, c);
+}
+
+static void gf_pow2523(gf o, const gf in)
+{
+    gf c;
+    int a;
+
+    gf_copy(c, in);
+    for (a = 250; a >= 0; a--)
+    {
+        gf_square(c, c);
+        if (a != 1)
+            gf_mul(c, c, in);
+    }
+    gf_copy(o, c);
+}
+
+/* Points in extended coordinates X, Y, Z, T */
+static void point_add(gf p[4], gf q[4])
+{
+    gf a, b, c, d, t, e, f, g, h;
+
+    gf_sub(a, p[1], p[0]);
+    gf_sub(t, q[1], q[0]);
+    gf_mul(a, a, t);
+    gf_add(b, p[0], p[1]);
+    gf_add(t, q[0], q[1]);
+    gf_mul(b, b, t);
+    gf_mul(c, p[3], q[3]);
+    gf_mul(c, c, ed_d2);
+    gf_mul(d, p[2], q[2]);
+    gf_add(d, d, d);
+    gf_sub(e, b, a);
+    gf_sub(f, d, c);
+    gf_add(g, d, c);
+    gf_add(h, b, a);
+
+    gf_mul(p[0], e, f);
+    gf_mul(p[1], h, g);
+    gf_mul(p[2], g, f);
+    gf_mul(p[3], e, h);
+}
+
+static void point_swap(gf p[4], gf q[4], uint8_t b)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        gf_select(p[i], q[i], b);
+}
+
+static void point_pack(uint8_t *r, gf p[4])
+{
+    gf tx, ty, zi;
+
+    gf_invert(zi, p[2]);
+    gf_mul(tx, p[0], zi);
+    gf_mul(ty, p[1], zi);
+    gf_pack(r, ty);
+    r[31] ^= gf_parity(tx) << 7;
+}
+
+static void scalar_mult(gf p[4], gf q[4], const uint8_t *s)
+{
+    int i;
+
+    gf_copy(p[0], gf0);
+    gf_copy(p[1], gf1);
+    gf_copy(p[2], gf1);
+    gf_copy(p[3], gf0);
+    for (i = 255; i >= 0; i--)
+    {
+        uint8_t b = (s[i / 8] >> (i & 7)) & 1;
+        point_swap(p, q, b);
+        point_add(q, p);
+        point_add(p, p);
+        point_swap(p, q, b);
+    }
+}
+
+static void scalar_base(gf p[4], const uint8_t *s)
+{
+    gf q[4];
+
+    gf_copy(q[0], ed_x);
+    gf_copy(q[1], ed_y);
+    gf_copy(q[2], gf1);
+    gf_mul(q[3], ed_x, ed_y);
+    scalar_mult(p, q, s);
+}
+
+static void mod_l(uint8_t *r, int64_t x[64])
+{
+    int64_t carry;
+    int i, j;
+
+    for (i = 63; i >= 32; i--)
+    {
+        carry = 0;
+        for (j = i - 32; j < i - 12; j++)
+        {
+            x[j] += carry - 16 * x[i] * ed_l[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+        x[j] += carry;
+        x[i] = 0;
+    }
+    carry = 0;
+    for (j = 0; j < 32; j++)
+    {
+        x[j] += carry - (x[31] >> 4) * ed_l[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+    for (j = 0; j < 32; j++)
+        x[j] -= carry * ed_l[j];
+    for (i = 0; i < 32; i++)
+    {
+        x[i + 1] += x[i] >> 8;
+        r[i] = (uint8_t)(x[i] & 255);
+    }
+}
+
+static void reduce(uint8_t *r)
+{
+    int64_t x[64];
+    int i;
+
+    for (i = 0; i < 64; i++)
+        x[i] = r[i];
+    memset(r, 0, 64);
+    mod_l(r, x);
+}
+
+/* Decodes the public key as the negated point -A, fails on an invalid encoding */
+static int unpack_neg(gf r[4], const uint8_t p[32])
+{
+    gf t, chk, num, den, den2, den4, den6;
+
+    gf_copy(r[2], gf1);
+    gf_unpack(r[1], p);
+    gf_square(num, r[1]);
+    gf_mul(den, num, ed_d);
+    gf_sub(num, num, r[2]);
+    gf_add(den, r[2], den);
+
+    gf_square(den2, den);
+    gf_square(den4, den2);
+    gf_mul(den6, den4, den2);
+    gf_mul(t, den6, num);
+    gf_mul(t, t, den);
+
+    gf_pow2523(t, t);
+    gf_mul(t, t, num);
+    gf_mul(t, t, den);
+    gf_mul(t, t, den);
+    gf_mul(r[0], t, den);
+
+    gf_square(chk, r[0]);
+    gf_mul(chk, chk, den);
+    if (gf_differ(chk, num))
+        gf_mul(r[0], r[0], sqrt_m1);
+
+    gf_square(chk, r[0]);
+    gf_mul(chk, chk, den);
+    if (gf_differ(chk, num))
+        return -1;
+
+    if (gf_parity(r[0]) == (p[31] >> 7))
+        gf_sub(r[0], gf0, r[0]);
+
+    gf_mul(r[3], r[0], r[1]);
+    return 0;
+}
+
+/* A public key of small order, the identity among them, is refused: [8]A is
+ * then the identity and signatures made from the torsion alone verify */
+static int point_small_order(gf p[4])
+{
+    gf q[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        gf_copy(q[i], p[i]);
+    for (i = 0; i < 3; i++)
+        point_add(q, q);
+    return !gf_differ(q[0], gf0) && !gf_differ(q[1], q[2]);
+}
+
+static int scalar_below_l(const uint8_t *s)
+{
+    int i;
+
+    for (i = 31; i >= 0; i--)
+    {
+        if (s[i] != ed_l[i])
+            return s[i] < ed_l[i];
+    }
+    return 0;
+}
+
+/* Checks sig (R | S) over msg: encode([S]B - [k]A) must equal R, k = SHA-512(R | A | msg) mod L */
+uint8_t bl_ed25519_verify(const uint8_t sig[64], const uint8_t *msg, uint32_t len, const uint8_t pubkey[32])
+{
+    sha512_ctx_t hash;
+    uint8_t h[64];
+    uint8_t t[32];
+    gf p[4], q[4];
+
+    /* S must be below L, anything else is a malleated signature */
+    if (!scalar_below_l(sig + 32))
+        return BL_SIGNATURE_INVALID;
+    if (unpack_neg(q, pubkey) || point_small_order(q))
+        return BL_SIGNATURE_INVALID;
+
+    sha512_init(&hash);
+    sha512_update(&hash, sig, 32);
+    sha512_update(&hash, pubkey, 32);
+    sha512_update(&hash, msg, len);
+    sha512_final(&hash, h);
+    reduce(h);
+
+    scalar_mult(p, q, h);
+    scalar_base(q, sig + 32);
+    point_add(p, q);
+    point_pack(t, p);
+
+    return memcmp(sig, t, 32) == 0 ? BL_SIGNATURE_VALID : BL_SIGNATURE_INVALID;
+}
+
+
+/* ---- ChaCha20 ---- */
+
+#define CHACHA_QR(a, b, c, d)                              \
+    a += b; d ^= a; d = ROR32(d, 16);                      \
+    c += d; b ^= c; b = ROR32(b, 20);                      \
+    a += b; d ^= a; d = ROR32(d, 24);                      \
+    c += d; b ^= c; b = ROR32(b, 25)
+
+static uint32_t load32_le(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void chacha20_block(const uint32_t in[16], uint8_t out[64])
+{
+    uint32_t x[16];
+    int i;
+
+    memcpy(x, in, sizeof(x));
+    for (i = 0; i < 10; i++)
+    {
+        CHACHA_QR(x[0], x[4], x[8],  x[12]);
+        CHACHA_QR(x[1], x[5], x[9],  x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8],  x[13]);
+        CHACHA_QR(x[3], x[4], x[9],  x[14]);
+    }
+    for (i = 0; i < 16; i++)
+    {
+        uint32_t v = x[i] + in[i];
+        out[4 * i]     = (uint8_t)v;
+        out[4 * i + 1] = (uint8_t)(v >> 8);
+        out[4 * i + 2] = (uint8_t)(v >> 16);
+        out[4 * i + 3] = (uint8_t)(v >> 24);
+    }
+}
+
+/* XORs the key stream into pData, starting offset bytes into the stream. Frames
+ * can arrive for any address, so the block counter is derived from the offset
+ * rather than carried from call to call. */
+void bl_chacha20_xor(const uint8_t key[32], const uint8_t nonce[12], uint32_t offset, uint8_t *pData, uint32_t len)
+{
+    uint32_t in[16];
+    uint8_t stream[64];
+    uint32_t skip = offset & 63U;
+    int i;
+
+    in[0] = 0x61707865U; in[1] = 0x3320646eU; in[2] = 0x79622d32U; in[3] = 0x6b206574U;
+    for (i = 0; i < 8; i++)
+        in[4 + i] = load32_le(&key[4 * i]);
+    in[12] = offset >> 6;
+    in[13] = load32_le(&nonce[0]);
+    in[14] = load32_le(&nonce[4]);
+    in[15] = load32_le(&nonce[8]);
+
+    while (len > 0)
+    {
+        uint32_t n = 64U - skip;
+        if (n > len)
+            n = len;
+
+        chacha20_block(in, stream);
+        for (i = 0; i < (int)n; i++)
+            pData[i] ^= stream[skip + i];
+
+        pData += n;
+        len -= n;
+        skip = 0;
+        in[12]++;
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * bl_stats.c
+ *
+ * Counts core clock cycles. On the M4 boards this is the DWT cycle counter,
+ * it keeps running while the flash is busy and costs one register read per
+ * sample, so the counters can stay in the release build. Even at 180 MHz it
+ * wraps only after 23 s, longer than anything measured here.
+ *
+ * The M0+ has no DWT cycle counter, cycles are read from SysTick instead: the
+ * HAL millisecond tick times the reload plus the current down count. A page
+ * erase stalls the flash long enough to hold off the tick interrupt, so erase
+ * times can read low by the whole milliseconds missed.
+ */
+
+#include "bl_stats.h"
+
+static bl_stat_t bl_stage_stats[BL_STAGE_COUNT];
+static bl_stat_t bl_command_stats[BL_STATS_CMD_COUNT];
+
+/* Which units of the last erase request were really erased, blank ones are
+ * passed over by the ports and stay clear here */
+static struct
+{
+	uint16_t first_unit;
+	uint16_t count;
+	uint8_t mask[(BL_BOARD_ERASE_UNITS + 7) / 8];
+} bl_erase_record;
+
+void bl_stats_init(void)
+{
+#if BL_BOARD_CYCLES_DWT
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    memset(bl_stage_stats, 0, sizeof(bl_stage_stats));
+    memset(bl_command_stats, 0, sizeof(bl_command_stats));
+    memset(&bl_erase_record, 0, sizeof(bl_erase_record));
+}
+
+//Wraps modulo 2^32 like a hardware counter, so differences stay right
+BL_BOARD_RAM_FUNC uint32_t bl_stats_cycles(void)
+{
+#if BL_BOARD_CYCLES_DWT
+    return DWT->CYCCNT;
+#else
+    uint32_t load = SysTick->LOAD + 1U;
+    uint32_t tick, val;
+
+    //sample again if the tick moved in between
+    do
+    {
+        tick = HAL_GetTick();
+        val = SysTick->VAL;
+    } while( tick != HAL_GetTick() );
+
+    return tick * load + (load - 1U - val);
+#endif
+}
+
+BL_BOARD_RAM_FUNC static void bl_stat_add(bl_stat_t *stat, uint32_t cycles)
+{
+    if( stat->count == 0 || cycles < stat->min )
+    	stat->min = cycles;
+    if( cycles > stat->max )
+    	stat->max = cycles;
+    stat->count++;
+    stat->total += cycles;
+}
+
+//Records the cycles since start against a frame stage
+BL_BOARD_RAM_FUNC void bl_stats_stage(uint8_t stage, uint32_t start)
+{
+    if( stage < BL_STAGE_COUNT )
+    	bl_stat_add(&bl_stage_stats[stage], bl_stats_cycles() - start);
+}
+
+//Records the cycles since start against a command, from its dispatch to its last reply byte
+BL_BOARD_RAM_FUNC void bl_stats_command(uint8_t command_code, uint32_t start)
+{
+    if( command_code >= BL_STATS_FIRST_CMD && command_code < BL_STATS_FIRST_CMD + BL_STATS_CMD_COUNT )
+    	bl_stat_add(&bl_command_stats[command_code - BL_STATS_FIRST_CMD], bl_stats_cycles() - start);
+}
+
+//Starts the record of an erase request over count units from first_unit
+void bl_stats_erase_begin(uint16_t first_unit, uint16_t count)
+{
+    memset(&bl_erase_record, 0, sizeof(bl_erase_record));
+    bl_erase_record.first_unit = first_unit;
+    bl_erase_record.count = (count > BL_BOARD_ERASE_UNITS) ? BL_BOARD_ERASE_UNITS : count;
+}
+
+//Marks a unit of the current request as erased
+BL_BOARD_RAM_FUNC void bl_stats_erase_unit(uint16_t unit)
+{
+    uint16_t bit = unit - bl_erase_record.first_unit;
+
+    if( unit >= bl_erase_record.first_unit && bit < bl_erase_record.count )
+    	bl_erase_record.mask[bit / 8] |= 1U << (bit % 8);
+}
+
+/* Fills in the BL_GET_STATS reply, returns its length.
+ * core clock(4) | entries | {id | count(4) | min(4) | max(4) | avg(4)}...
+ * Only entries that were hit are listed, ids are BL_STAGE_* or command codes.
+ * BL_STATS_ERASED replies first unit(2) | units(2) | mask, bit i is unit first + i */
+uint8_t bl_stats_report(uint8_t selector, uint8_t *pBuffer)
+{
+    if( (selector & ~BL_STATS_CLEAR) == BL_STATS_ERASED )
+    {
+        uint8_t mask_len = (bl_erase_record.count + 7) / 8;
+
+        memcpy(&pBuffer[0], &bl_erase_record.first_unit, 2);
+        memcpy(&pBuffer[2], &bl_erase_record.count, 2);
+        memcpy(&pBuffer[4], bl_erase_record.mask, mask_len);
+        if( selector & BL_STATS_CLEAR )
+        	memset(&bl_erase_record, 0, sizeof(bl_erase_record));
+        return 4 + mask_len;
+    }
+
+    bl_stat_t *stats = (selector & BL_STATS_COMMANDS) ? bl_command_stats : bl_stage_stats;
+    uint8_t count = (selector & BL_STATS_COMMANDS) ? BL_STATS_CMD_COUNT : BL_STAGE_COUNT;
+    uint8_t first_id = (selector & BL_STATS_COMMANDS) ? BL_STATS_FIRST_CMD : 0;
+    uint8_t len = 5;
+
+    memcpy(&pBuffer[0], &SystemCoreClock, 4);
+    pBuffer[4] = 0;
+    for( uint8_t i = 0 ; i < count ; i++ )
+    {
+        uint32_t avg;
+
+        if( stats[i].count == 0 )
+        	continue;
+        avg = (uint32_t)(stats[i].total / stats[i].count);
+        pBuffer[len] = first_id + i;
+        memcpy(&pBuffer[len + 1], &stats[i].count, 4);
+        memcpy(&pBuffer[len + 5], &stats[i].min, 4);
+        memcpy(&pBuffer[len + 9], &stats[i].max, 4);
+        memcpy(&pBuffer[len + 13], &avg, 4);
+        len += BL_STATS_ENTRY_LEN;
+        pBuffer[4]++;
+    }
+
+    if( selector & BL_STATS_CLEAR )
+    	memset(stats, 0, count * sizeof(bl_stat_t));
+
+    return len;
+}
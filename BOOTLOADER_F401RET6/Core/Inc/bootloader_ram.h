@@ -0,0 +1,25 @@
+/*
+ * bootloader_ram.h
+ *
+ * Flash driver and command UART service that run from SRAM, so the
+ * bootloader keeps receiving while the single flash bank is busy.
+ */
+
+#ifndef INC_BOOTLOADER_RAM_H_
+#define INC_BOOTLOADER_RAM_H_
+
+#include <stdint.h>
+#include "main.h"
+
+#define BL_RX_RING_SIZE        512      //power of two, holds a couple of full frames
+#define BL_RAM_VECTOR_COUNT    128      //16 core + 112 IRQ vectors, covers F401 and F446
+
+/* The command UART service is the port's bootloader_uart_*() set, declared
+ * in bl_core.h */
+
+void bootloader_flash_erase_start(uint32_t sector);
+uint8_t bootloader_flash_busy(void);
+uint8_t bootloader_flash_erase_end(void);
+uint8_t bootloader_flash_program(uint32_t mem_address, const uint8_t *pBuffer, uint32_t len);
+
+#endif /* INC_BOOTLOADER_RAM_H_ */
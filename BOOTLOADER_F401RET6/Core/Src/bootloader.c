@@ -3,42 +3,112 @@
  *
  *  Created on: May 21, 2025
  *      Author: kjeyabalan
+ *
+ * STM32F4 port of the bootloader core: background sector erase, boot records
+ * appended to the last sector, word programming from SRAM and the jump to
+ * the application. Framing and the common commands are in bl_core.c.
  */
 
 #include "bootloader.h"
 
-uint8_t bl_rx_buffer[BL_RX_LEN];
 UART_HandleTypeDef *C_UART = NULL;
 
-void  bootloader_uart_read_data(void)
+/* Sector erase that runs in the background, one sector at a time, while the
+ * command loop keeps serving frames */
+typedef struct
+{
+	uint8_t active;         //sectors left to erase or one in flight
+	uint8_t in_flight;      //next_sector is being erased right now
+	uint8_t next_sector;
+	uint8_t done;
+	uint8_t remaining;
+	uint8_t status;         //HAL status of the last erase job
+	uint32_t started;       //cycle count when the sector in flight was started
+} bl_erase_job_t;
+
+static bl_erase_job_t bl_erase_job;
+
+typedef struct
 {
-    uint8_t rcv_len=0;
+	uint32_t magic;
+	uint32_t app_size;      //0 withdraws the previous record, an update is in progress
+	uint32_t app_crc;
+	uint32_t verdict;       //BL_VERDICT_SIGNED once the signature checked out
+	uint32_t check;         //magic ^ app_size ^ app_crc ^ verdict, catches a torn write
+	uint32_t reserved[3];
+} bl_boot_record_t;
+
+/* Commands whose frames are particular to this board.
+ * Returns 0 when the command is not one of them. */
+BL_RAM_FUNC uint8_t bl_port_handle_cmd(uint8_t *pBuffer)
+{
+	switch(pBuffer[1])
+	{
+		case BL_FLASH_ERASE:
+			bootloader_handle_flash_erase_cmd(pBuffer);
+			return 1;
+		case BL_ERASE_STATUS:
+			bootloader_handle_erase_status_cmd(pBuffer);
+			return 1;
+		default:
+			return 0;
+	}
+}
 
-	while(1)
+//Batch operations particular to this board, the payload of the matching command frame
+uint8_t bl_port_batch_op(uint8_t op, uint8_t *pArgs, uint8_t args_len)
+{
+	if( op != BL_FLASH_ERASE || args_len != 2 )
+		return BL_BATCH_BAD_OP;
+	return execute_flash_erase(pArgs[0], pArgs[1]);
+}
+
+/* Update mode runs from the PLL instead of the 16 MHz HSI: 16 / 16 * 336 / 4
+ * gives the F401's 84 MHz, which voltage scale 2 allows with two flash wait
+ * states. APB1 is halved to its 42 MHz limit. The UARTs were set up for the
+ * HSI clock and get their baud divisors again. If any step fails the clock
+ * is left where it was and the bootloader carries on at 16 MHz. */
+void bootloader_clock_boost(void)
+{
+	RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+	RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+	UART_HandleTypeDef *uarts[] = { &huart1, &huart2, &huart6 };
+
+	__HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE2);
+
+	RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+	RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+	RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+	RCC_OscInitStruct.PLL.PLLM = 16;
+	RCC_OscInitStruct.PLL.PLLN = 336;
+	RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV4;
+	RCC_OscInitStruct.PLL.PLLQ = 7;
+	if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
 	{
-		memset(bl_rx_buffer,0,200);
-        HAL_UART_Receive(C_UART,bl_rx_buffer,1,HAL_MAX_DELAY);
-		rcv_len= bl_rx_buffer[0];
-		HAL_UART_Receive(C_UART,&bl_rx_buffer[1],rcv_len,HAL_MAX_DELAY);
-		switch(bl_rx_buffer[1])
+		printf("BL_MSG: PLL did not lock, staying at %" PRIu32 " Hz\n", SystemCoreClock);
+		return;
+	}
+
+	RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+	                            |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+	RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+	RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+	RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
+	RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+	if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
+	{
+		printf("BL_MSG: PLL switch failed, staying at %" PRIu32 " Hz\n", SystemCoreClock);
+		return;
+	}
+
+	for (uint32_t i = 0; i < sizeof(uarts) / sizeof(uarts[0]); i++)
+	{
+		if (HAL_UART_Init(uarts[i]) != HAL_OK)
 		{
-            case BL_GET_CID:
-                bootloader_handle_getcid_cmd(bl_rx_buffer);
-                break;
-            case BL_GO_TO_RESET:
-            	bootloader_go_reset_cmd(bl_rx_buffer);
-                break;
-            case BL_FLASH_ERASE:
-                bootloader_handle_flash_erase_cmd(bl_rx_buffer);
-                break;
-            case BL_MEM_WRITE:
-                bootloader_handle_mem_write_cmd(bl_rx_buffer);
-                break;
-            default:
-                printf("BL_MSG:Invalid command code received from host \n");
-                break;
+			Error_Handler();
 		}
 	}
+	printf("BL_MSG: update mode clock %" PRIu32 " Hz\n", SystemCoreClock);
 }
 
 void bootloader_jump_to_user_app(void)
@@ -47,19 +117,21 @@ void bootloader_jump_to_user_app(void)
 
 	    printf("BL_MSG: bootloader_jump_to_user_app\n");
 
-	    uint32_t msp_value = *(volatile uint32_t *)FLASH_SECTOR2_BASE_ADDRESS;
-	    uint32_t reset_handler_address = *(volatile uint32_t *)(FLASH_SECTOR2_BASE_ADDRESS + 4);
+	    uint32_t msp_value = *(volatile uint32_t *)BL_BOARD_APP_BASE;
+	    uint32_t reset_handler_address = *(volatile uint32_t *)(BL_BOARD_APP_BASE + 4);
 
 	    char msg[23];
-		snprintf(msg, sizeof(msg), "MSP: 0x%08lX", msp_value);
+		snprintf(msg, sizeof(msg), "MSP: 0x%08" PRIX32, msp_value);
 		printf("%s",msg);
 
-		snprintf(msg, sizeof(msg), "Reset: 0x%08lX", reset_handler_address);
+		snprintf(msg, sizeof(msg), "Reset: 0x%08" PRIX32, reset_handler_address);
 		printf("%s",msg);
 
 		HAL_Delay(1000);
 
 	    HAL_RCC_DeInit();
+	    //back to the reset clock, the wait states of update mode are left behind by the HAL
+	    __HAL_FLASH_SET_LATENCY(FLASH_LATENCY_0);
 		HAL_DeInit();
 
 		SysTick->CTRL = 0;
@@ -71,279 +143,255 @@ void bootloader_jump_to_user_app(void)
 			NVIC->ICPR[i] = 0xFFFFFFFF;
 		}
 
-	    SCB->VTOR = FLASH_SECTOR2_BASE_ADDRESS;
+	    SCB->VTOR = BL_BOARD_APP_BASE;
 		__DSB();
 		__ISB();
 	    __set_MSP(msp_value);
 
-	    app_reset_handler = (void *)reset_handler_address;
+	    app_reset_handler = (void *)(uintptr_t)reset_handler_address;
 	    app_reset_handler();
 
 }
 
-void bootloader_go_reset_cmd(uint8_t *pBuffer)
-{
-	printf("BL_MSG:bootloader_go_reset_cmd\n");
-	uint32_t command_packet_len = bl_rx_buffer[0]+1 ;
-	uint32_t host_crc = *((uint32_t * ) (bl_rx_buffer+command_packet_len - 4) ) ;
-
-	if (! bootloader_verify_crc(&bl_rx_buffer[0],command_packet_len-4,host_crc))
-	{
-		 printf("BL_MSG:checksum success !!\n");
-		 bootloader_send_ack(pBuffer[0],0);
-		 bootloader_uart_write_data(ADDR_VALID, 1);
-		 printf("BL_MSG:Going to reset... !!\n");
-		 HAL_Delay(1000);
-		 NVIC_SystemReset();
-	}
-	else
-	{
-		 printf("BL_MSG:checksum fail !!\n");
-		 bootloader_send_nack();
-	}
-}
-
- void bootloader_handle_getcid_cmd(uint8_t *pBuffer)
- {
- 	uint16_t bl_cid_num = 0;
- 	printf("BL_MSG:bootloader_handle_getcid_cmd\n");
-
-     //Total length of the command packet
- 	uint32_t command_packet_len = bl_rx_buffer[0]+1 ;
-
- 	//extract the CRC32 sent by the Host
- 	uint32_t host_crc = *((uint32_t * ) (bl_rx_buffer+command_packet_len - 4) ) ;
-
- 	if (! bootloader_verify_crc(&bl_rx_buffer[0],command_packet_len-4,host_crc))
- 	{
-         printf("BL_MSG:checksum success !!\n");
-         bootloader_send_ack(pBuffer[0],2);
-         bl_cid_num = get_mcu_chip_id();
-         printf("BL_MSG:MCU id : %d %#x !!\n",bl_cid_num, bl_cid_num);
-         bootloader_uart_write_data((uint8_t *)&bl_cid_num,2);
-
- 	}
- 	else
- 	{
-         printf("BL_MSG:checksum fail !!\n");
-         bootloader_send_nack();
- 	}
- }
-
+ /* Frame: len | cmd | first sector | sector count | crc(4), 0xff erases every
+  * application sector.
+  * Reply: ACK, 1 | status */
  void bootloader_handle_flash_erase_cmd(uint8_t *pBuffer)
  {
      uint8_t erase_status = 0x00;
-     printf("BL_MSG:bootloader_handle_flash_erase_cmd\n");
-
-     //Total length of the command packet
- 	uint32_t command_packet_len = bl_rx_buffer[0]+1 ;
+     printf("BL_MSG:initial_sector : %d  no_ofsectors: %d\n",pBuffer[2],pBuffer[3]);
 
- 	//extract the CRC32 sent by the Host
- 	uint32_t host_crc = *((uint32_t * ) (bl_rx_buffer+command_packet_len - 4) ) ;
+     bootloader_send_ack(pBuffer[0],1);
 
- 	if (! bootloader_verify_crc(&bl_rx_buffer[0],command_packet_len-4,host_crc))
- 	{
-         printf("BL_MSG:checksum success !!\n");
-         bootloader_send_ack(pBuffer[0],1);
-         printf("BL_MSG:initial_sector : %d  no_ofsectors: %d\n",pBuffer[2],pBuffer[3]);
-
-         HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin,1);
-         erase_status = execute_flash_erase(pBuffer[2] , pBuffer[3]);
-         HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin,0);
-
-         printf("BL_MSG: flash erase status: %#x\n",erase_status);
+     HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin,1);
+     erase_status = execute_flash_erase(pBuffer[2] , pBuffer[3]);
+     if(!bl_erase_job.active)
+     {
+    	 HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin,0);
+     }
 
-         bootloader_uart_write_data(&erase_status,1);
+     //for a sector erase this only says the job was accepted, it goes on in the background
+     printf("BL_MSG: flash erase status: %#x\n",erase_status);
 
- 	}else
- 	{
-         printf("BL_MSG:checksum fail !!\n");
-         bootloader_send_nack();
- 	}
+     bootloader_uart_write_data(&erase_status,1);
  }
 
 
- void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
+ /* Reports how far the background erase has got, so the host can write into
+  * sectors that are done while the later ones are still erasing.
+  * Reply: ACK, 4 | state | sectors done | sectors remaining | status */
+ BL_RAM_FUNC void bootloader_handle_erase_status_cmd(uint8_t *pBuffer)
  {
- 	uint8_t addr_valid = ADDR_VALID;
- 	uint8_t write_status = 0x00;
- 	uint8_t chksum =0, len=0;
- 	len = pBuffer[0];
- 	uint8_t payload_len = pBuffer[6];
-
- 	uint32_t mem_address = *((uint32_t *) ( &pBuffer[2]) );
-
- 	chksum = pBuffer[len];
-
-     printf("BL_MSG:bootloader_handle_mem_write_cmd\n");
+ 	uint8_t reply[4];
+
+     bootloader_send_ack(pBuffer[0],4);
+     reply[0] = bl_erase_job.active ? BL_ERASE_BUSY : BL_ERASE_IDLE;
+     reply[1] = bl_erase_job.done;
+     reply[2] = bl_erase_job.remaining;
+     reply[3] = bl_erase_job.status;
+     bootloader_uart_write_data(reply,4);
+ }
 
-     //Total length of the command packet
- 	uint32_t command_packet_len = bl_rx_buffer[0]+1 ;
 
- 	//extract the CRC32 sent by the Host
- 	uint32_t host_crc = *((uint32_t * ) (bl_rx_buffer+command_packet_len - 4) ) ;
+uint8_t execute_flash_erase(uint8_t sector_number , uint8_t number_of_sector)
+ {
+ 	uint8_t app_sector = (uint8_t)bl_flash_unit(BL_BOARD_APP_BASE);
 
+ 	if( number_of_sector > 8 )
+ 		return INVALID_SECTOR;
 
- 	if (! bootloader_verify_crc(&bl_rx_buffer[0],command_packet_len-4,host_crc))
+ 	/*Only the application sectors are the host's to erase, a mass erase
+ 	 *clears all of them. The bootloader sectors are never erased and the
+ 	 *boot record sector only by bl_port_write_boot_record() */
+ 	if( sector_number == 0xff )
  	{
-         printf("BL_MSG:checksum success !!\n");
-
-         bootloader_send_ack(pBuffer[0],1);
-
-         printf("BL_MSG: write addr:%#lx\n", mem_address);
-
- 		if( verify_address(mem_address) == ADDR_VALID )
- 		{
+ 		sector_number = app_sector;
+ 		number_of_sector = BL_META_SECTOR - app_sector;
+ 	}
+ 	if( sector_number < app_sector || sector_number >= BL_META_SECTOR )
+ 		return INVALID_SECTOR;
 
-             printf("BL_MSG: valid mem write address\n");
+ 	/*Here we are just calculating how many sectors needs to erased*/
+ 	uint8_t remanining_sector = BL_META_SECTOR - sector_number;
+ 	if( number_of_sector > remanining_sector)
+ 	{
+ 		number_of_sector = remanining_sector;
+ 	}
 
-             //glow the led to indicate bootloader is currently writing to memory
-             HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
+ 	if( number_of_sector == 0 )
+ 	{
+ 		return HAL_OK;
+ 	}
 
-             //execute mem write
-             write_status = execute_mem_write(&pBuffer[7],mem_address, payload_len);
+ 	//a batch can queue one erase behind another
+ 	bootloader_erase_wait(0xffff);
 
-             //turn off the led to indicate memory write is over
-             HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+ 	/*The application is touched, its boot record no longer holds */
+ 	bl_port_write_boot_record(0, 0, BL_VERDICT_UNSIGNED);
 
-             //inform host about the status
-             bootloader_uart_write_data(&write_status,1);
+ 	/*Only the job is set up here, bootloader_erase_poll() runs it sector
+ 	 *by sector from SRAM while the UART keeps receiving */
+ 	bl_erase_job.active = 1;
+ 	bl_erase_job.in_flight = 0;
+ 	bl_erase_job.next_sector = sector_number;
+ 	bl_erase_job.done = 0;
+ 	bl_erase_job.remaining = number_of_sector;
+ 	bl_erase_job.status = HAL_OK;
+ 	bl_stats_erase_begin(sector_number, number_of_sector);
+ 	bootloader_erase_poll(1);
 
- 		}
- 		else
- 		{
-             printf("BL_MSG: invalid mem write address\n");
-             write_status = ADDR_INVALID;
-             //inform host that address is invalid
-             bootloader_uart_write_data(&write_status,1);
- 		}
- 	}
- 	else
- 	{
-         printf("BL_MSG:checksum fail !!\n");
-         bootloader_send_nack();
- 	}
+ 	return HAL_OK;
  }
 
 
- void bootloader_send_ack(uint8_t command_code, uint8_t follow_len)
+ /* Counts the sector at next_sector as done and closes the job after the last one */
+ BL_RAM_FUNC static void bootloader_erase_step(uint8_t status)
  {
- 	 //here we send 2 byte.. first byte is ack and the second byte is len value
- 	uint8_t ack_buf[2];
- 	ack_buf[0] = BL_ACK;
- 	ack_buf[1] = follow_len;
- 	HAL_UART_Transmit(C_UART,ack_buf,2,HAL_MAX_DELAY);
+     bl_erase_job.next_sector++;
+     bl_erase_job.done++;
+     bl_erase_job.remaining--;
 
+     if( status != HAL_OK )
+     {
+         bl_erase_job.status = status;
+         bl_erase_job.remaining = 0;
+     }
+     if( bl_erase_job.remaining == 0 )
+     {
+         bl_erase_job.active = 0;
+         HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin,0);
+         printf("BL_MSG: background erase of %d sectors status: %#x\n",bl_erase_job.done,bl_erase_job.status);
+     }
  }
 
- /*This function sends NACK */
- void bootloader_send_nack(void)
- {
- 	uint8_t nack = BL_NACK;
- 	HAL_UART_Transmit(C_UART,&nack,1,HAL_MAX_DELAY);
- }
 
- //This verifies the CRC of the given buffer in pData .
- uint8_t bootloader_verify_crc (uint8_t *pData, uint32_t len, uint32_t crc_host)
+ /* Advances the background erase without blocking: collects a finished sector
+  * and, when start_next is set, starts the next one. A sector that already
+  * reads blank is counted as done without an erase. */
+ BL_RAM_FUNC void bootloader_erase_poll(uint8_t start_next)
  {
-     uint32_t uwCRCValue=0xff;
+     if( !bl_erase_job.active )
+    	 return;
 
-     for (uint32_t i=0 ; i < len ; i++)
- 	{
-         uint32_t i_data = pData[i];
-         uwCRCValue = HAL_CRC_Accumulate(&hcrc, &i_data, 1);
- 	}
-
- 	 /* Reset CRC Calculation Unit */
-   __HAL_CRC_DR_RESET(&hcrc);
-
- 	if( uwCRCValue == crc_host)
- 	{
- 		return VERIFY_CRC_SUCCESS;
- 	}
+     if( bl_erase_job.in_flight )
+     {
+         if( bootloader_flash_busy() )
+        	 return;
+
+         uint8_t status = bootloader_flash_erase_end();
+         HAL_FLASH_Lock();
+         bl_stats_stage(BL_STAGE_ERASE, bl_erase_job.started);
+         bl_erase_job.in_flight = 0;
+         bl_stats_erase_unit(bl_erase_job.next_sector);
+         bootloader_erase_step(status);
+         if( !bl_erase_job.active )
+        	 return;
+     }
 
- 	return VERIFY_CRC_FAIL;
+     if( start_next )
+     {
+         uint32_t size;
+         uint32_t address = bl_flash_unit_address(bl_erase_job.next_sector, &size);
+
+         if( bl_flash_is_blank(address, size) )
+         {
+        	 bootloader_erase_step(HAL_OK);
+        	 return;
+         }
+         HAL_FLASH_Unlock();
+         bl_erase_job.started = bl_stats_cycles();
+         bootloader_flash_erase_start(bl_erase_job.next_sector);
+         bl_erase_job.in_flight = 1;
+     }
  }
 
 
- void bootloader_uart_write_data(uint8_t *pBuffer,uint32_t len)
+ //Blocks until every queued sector up to last_unit is erased, 0xffff drains the whole job
+ BL_RAM_FUNC void bootloader_erase_wait(uint16_t last_unit)
  {
-     /*you can replace the below ST's USART driver API call with your MCUs driver API call */
- 	HAL_UART_Transmit(C_UART,pBuffer,len,HAL_MAX_DELAY);
-
- }
-
- uint16_t get_mcu_chip_id(void)
- {
- 	uint16_t cid;
- 	cid = (uint16_t)(DBGMCU->IDCODE) & 0x0FFF;
- 	return  cid;
+     while( bl_erase_job.active &&
+            (bl_erase_job.in_flight || bl_erase_job.next_sector <= last_unit) )
+     {
+         bootloader_erase_poll(bl_erase_job.next_sector <= last_unit);
+     }
  }
 
 
- uint8_t verify_address(uint32_t go_address)
+  //Newest intact boot record, or NULL. next_free gets the first blank slot, 0 when the sector is full
+ static const bl_boot_record_t *find_boot_record(uint32_t *next_free)
  {
- 	if ( go_address >= SRAM1_BASE && go_address <= SRAM1_END)
- 	{
- 		return ADDR_VALID;
- 	}
-// 	else if ( go_address >= SRAM2_BASE && go_address <= SRAM2_END)
-// 	{
-// 		return ADDR_VALID;
-// 	}
- 	else if ( go_address >= FLASH_BASE && go_address <= FLASH_END)
- 	{
- 		return ADDR_VALID;
- 	}
-// 	else if ( go_address >= BKPSRAM_BASE && go_address <= BKPSRAM_END)
-// 	{
-// 		return ADDR_VALID;
-// 	}
- 	else
- 		return ADDR_INVALID;
+     const bl_boot_record_t *latest = NULL;
+     uint32_t address;
+
+     *next_free = 0;
+     for(address = BL_META_BASE ; address < BL_META_BASE + BL_META_SIZE ; address += sizeof(bl_boot_record_t))
+     {
+         const bl_boot_record_t *record = (const bl_boot_record_t *)(uintptr_t)address;
+
+         if( record->magic == 0xFFFFFFFFU )
+         {
+        	 *next_free = address;
+        	 break;
+         }
+         if( record->magic == BL_META_MAGIC &&
+             record->check == (record->magic ^ record->app_size ^ record->app_crc ^ record->verdict) )
+         {
+        	 latest = record;
+         }
+     }
+     return latest;
  }
 
 
-uint8_t execute_flash_erase(uint8_t sector_number , uint8_t number_of_sector)
+ //Appends a record, a full sector is erased and started again
+ uint8_t bl_port_write_boot_record(uint32_t app_size, uint32_t app_crc, uint32_t verdict)
  {
- 	FLASH_EraseInitTypeDef flashErase_handle;
- 	uint32_t sectorError;
- 	HAL_StatusTypeDef status;
+     bl_boot_record_t record = { BL_META_MAGIC, app_size, app_crc, verdict,
+                                 BL_META_MAGIC ^ app_size ^ app_crc ^ verdict,
+                                 { 0xFFFFFFFFU, 0xFFFFFFFFU, 0xFFFFFFFFU } };
+     const bl_boot_record_t *latest;
+     uint32_t next_free;
+     uint8_t status = HAL_OK;
+
+     latest = find_boot_record(&next_free);
+     //a withdrawn record is written even when there was none, it marks the update in progress
+     if( latest && latest->app_size == app_size && latest->app_crc == app_crc && latest->verdict == verdict )
+    	 return HAL_OK;
 
+     HAL_FLASH_Unlock();
+     if( next_free == 0 )
+     {
+    	 bootloader_flash_erase_start(BL_META_SECTOR);
+    	 status = bootloader_flash_erase_end();
+    	 next_free = BL_META_BASE;
+     }
+     if( status == HAL_OK )
+     {
+    	 status = bootloader_flash_program(next_free, (const uint8_t *)&record, sizeof(record));
+     }
+     HAL_FLASH_Lock();
 
- 	if( number_of_sector > 8 )
- 		return INVALID_SECTOR;
-
- 	if( (sector_number == 0xff ) || (sector_number <= 7) )
- 	{
- 		if(sector_number == (uint8_t) 0xff)
- 		{
- 			flashErase_handle.TypeErase = FLASH_TYPEERASE_MASSERASE;
- 		}else
- 		{
- 		    /*Here we are just calculating how many sectors needs to erased */
- 			uint8_t remanining_sector = 8 - sector_number;
-             if( number_of_sector > remanining_sector)
-             {
-             	number_of_sector = remanining_sector;
-             }
- 			flashErase_handle.TypeErase = FLASH_TYPEERASE_SECTORS;
- 			flashErase_handle.Sector = sector_number; // this is the initial sector
- 			flashErase_handle.NbSectors = number_of_sector;
- 		}
- 		flashErase_handle.Banks = FLASH_BANK_1;
-
- 		/*Get access to touch the flash registers */
- 		HAL_FLASH_Unlock();
- 		flashErase_handle.VoltageRange = FLASH_VOLTAGE_RANGE_3;  // our mcu will work on this voltage range
- 		status = (uint8_t) HAL_FLASHEx_Erase(&flashErase_handle, &sectorError);
- 		HAL_FLASH_Lock();
-
- 		return status;
- 	}
+     return status;
+ }
 
 
- 	return INVALID_SECTOR;
+ /* A device that never had a record starts its application as before, unless
+  * signed boot is on. A withdrawn record (app_size 0) means an update is in
+  * progress and a sector holding only torn records says the same, neither is
+  * started. The cached verdict stands in for the signature, the hardware CRC
+  * still catches anything written since. */
+ uint8_t bootloader_app_is_valid(void)
+ {
+     uint32_t next_free;
+     const bl_boot_record_t *record = find_boot_record(&next_free);
+
+     if( record == NULL )
+    	 return (next_free == BL_META_BASE) ? !BL_SIGNED_BOOT : 0;
+     if( record->app_size == 0 )
+    	 return 0;
+     if( BL_SIGNED_BOOT && record->verdict != BL_VERDICT_SIGNED )
+    	 return 0;
+     return execute_range_crc(BL_BOARD_APP_BASE, record->app_size) == record->app_crc;
  }
 
 
@@ -354,13 +402,18 @@ uint8_t execute_flash_erase(uint8_t sector_number , uint8_t number_of_sector)
      //We have to unlock flash module to get control of registers
      HAL_FLASH_Unlock();
 
-     for(uint32_t i = 0 ; i <len ; i++)
-     {
-         //Here we program the flash byte by byte
-         status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE,mem_address+i,pBuffer[i] );
-     }
+     //Words where aligned, bytes elsewhere, from SRAM
+     uint32_t started = bl_stats_cycles();
+     status = bootloader_flash_program(mem_address, pBuffer, len);
+     bl_stats_stage(BL_STAGE_PROGRAM, started);
 
      HAL_FLASH_Lock();
 
+     //read back, a write into a cell that was not erased can pass without an error flag
+     if( status == HAL_OK && memcmp((const void *)(uintptr_t)mem_address, pBuffer, len) != 0 )
+     {
+    	 status = HAL_ERROR;
+     }
+
      return status;
  }
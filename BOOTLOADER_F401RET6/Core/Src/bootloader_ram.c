@@ -0,0 +1,217 @@
+/*
+ * bootloader_ram.c
+ *
+ * On the single bank F4 parts any instruction fetch from flash stalls while a
+ * sector erase or a program operation runs. Everything that must keep working
+ * in that window lives in SRAM: the vector table copy, the command UART
+ * interrupt, the receive ring and the flash erase/program loops.
+ */
+
+#include "bootloader.h"
+#include "bootloader_ram.h"
+
+#define BL_FLASH_SR_ERRORS  (FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | \
+                             FLASH_SR_WRPERR | FLASH_SR_OPERR | FLASH_SR_RDERR)
+
+//Only the command UART interrupt (priority 0) may run while flash is busy
+#define BL_FLASH_BUSY_BASEPRI  (1U << (8U - __NVIC_PRIO_BITS))
+
+//VTOR needs the table aligned to its size rounded up to a power of two
+static uint32_t bl_ram_vectors[BL_RAM_VECTOR_COUNT] __attribute__((section(".ram_vector"), aligned(512)));
+
+static volatile uint8_t bl_rx_ring[BL_RX_RING_SIZE];
+static volatile uint16_t bl_rx_head;
+static volatile uint16_t bl_rx_tail;
+static USART_TypeDef *bl_uart;
+
+static IRQn_Type bootloader_uart_irqn(USART_TypeDef *uart)
+{
+    if (uart == USART1) return USART1_IRQn;
+    if (uart == USART2) return USART2_IRQn;
+#if defined(USART3)
+    if (uart == USART3) return USART3_IRQn;
+#endif
+#if defined(UART4)
+    if (uart == UART4) return UART4_IRQn;
+#endif
+#if defined(UART5)
+    if (uart == UART5) return UART5_IRQn;
+#endif
+    return USART6_IRQn;
+}
+
+__RAM_FUNC static void bootloader_uart_irq_handler(void)
+{
+    uint32_t sr = bl_uart->SR;
+
+    if (sr & (USART_SR_RXNE | USART_SR_ORE))
+    {
+        //reading DR after SR also clears an overrun
+        uint8_t byte = (uint8_t)bl_uart->DR;
+        uint16_t next = (bl_rx_head + 1U) & (BL_RX_RING_SIZE - 1U);
+
+        if (next != bl_rx_tail)
+        {
+            bl_rx_ring[bl_rx_head] = byte;
+            bl_rx_head = next;
+        }
+    }
+}
+
+/* Moves the vector table to SRAM and switches the command UART (C_UART) to
+ * interrupt driven reception into the ring. Bytes already buffered by the
+ * UART are dropped. */
+void bootloader_uart_start(void)
+{
+    IRQn_Type irqn;
+
+    bl_uart = C_UART->Instance;
+    irqn = bootloader_uart_irqn(bl_uart);
+
+    memcpy(bl_ram_vectors, (const void *)SCB->VTOR, sizeof(bl_ram_vectors));
+    bl_ram_vectors[16 + irqn] = (uint32_t)bootloader_uart_irq_handler;
+
+    __disable_irq();
+    SCB->VTOR = (uint32_t)bl_ram_vectors;
+    __DSB();
+    __ISB();
+
+    bl_rx_head = 0;
+    bl_rx_tail = 0;
+    (void)bl_uart->SR;
+    (void)bl_uart->DR;
+    bl_uart->CR1 |= USART_CR1_RXNEIE;
+
+    NVIC_SetPriority(irqn, 0);
+    NVIC_ClearPendingIRQ(irqn);
+    NVIC_EnableIRQ(irqn);
+    __enable_irq();
+}
+
+//Blocks until len bytes have been received
+__RAM_FUNC void bootloader_uart_read(uint8_t *pBuffer, uint32_t len)
+{
+    while (len--)
+    {
+        while (bl_rx_head == bl_rx_tail)
+        {
+        }
+        *pBuffer++ = bl_rx_ring[bl_rx_tail];
+        bl_rx_tail = (bl_rx_tail + 1U) & (BL_RX_RING_SIZE - 1U);
+    }
+}
+
+__RAM_FUNC uint8_t bootloader_uart_available(void)
+{
+    return (bl_rx_head != bl_rx_tail) ? 1 : 0;
+}
+
+__RAM_FUNC void bootloader_uart_write(const uint8_t *pBuffer, uint32_t len)
+{
+    USART_TypeDef *uart = C_UART->Instance;
+
+    while (len--)
+    {
+        while (!(uart->SR & USART_SR_TXE))
+        {
+        }
+        uart->DR = *pBuffer++;
+    }
+    while (!(uart->SR & USART_SR_TC))
+    {
+    }
+}
+
+//Waits out the operation from SRAM, the UART interrupt keeps filling the ring meanwhile
+__RAM_FUNC static uint8_t bootloader_flash_wait(void)
+{
+    uint32_t sr;
+
+    while (FLASH->SR & FLASH_SR_BSY)
+    {
+    }
+    sr = FLASH->SR;
+    FLASH->SR = BL_FLASH_SR_ERRORS | FLASH_SR_EOP;
+
+    return (sr & BL_FLASH_SR_ERRORS) ? HAL_ERROR : HAL_OK;
+}
+
+/* Starts erasing a sector and returns at once, the UART interrupt is the only
+ * one left enabled until bootloader_flash_erase_end(). Flash must be unlocked
+ * by the caller. */
+__RAM_FUNC void bootloader_flash_erase_start(uint32_t sector)
+{
+    __set_BASEPRI(BL_FLASH_BUSY_BASEPRI);
+
+    FLASH->CR &= ~(FLASH_CR_PSIZE | FLASH_CR_SNB);
+    FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+}
+
+__RAM_FUNC uint8_t bootloader_flash_busy(void)
+{
+    return (FLASH->SR & FLASH_SR_BSY) ? 1 : 0;
+}
+
+//Waits for the sector erase started above and returns its status
+__RAM_FUNC uint8_t bootloader_flash_erase_end(void)
+{
+    uint8_t status = bootloader_flash_wait();
+
+    FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+
+    //the ART caches may still hold the old contents
+    if (FLASH->ACR & FLASH_ACR_ICEN)
+    {
+        FLASH->ACR &= ~FLASH_ACR_ICEN;
+        FLASH->ACR |= FLASH_ACR_ICRST;
+        FLASH->ACR &= ~FLASH_ACR_ICRST;
+        FLASH->ACR |= FLASH_ACR_ICEN;
+    }
+    if (FLASH->ACR & FLASH_ACR_DCEN)
+    {
+        FLASH->ACR &= ~FLASH_ACR_DCEN;
+        FLASH->ACR |= FLASH_ACR_DCRST;
+        FLASH->ACR &= ~FLASH_ACR_DCRST;
+        FLASH->ACR |= FLASH_ACR_DCEN;
+    }
+
+    __set_BASEPRI(0);
+    return status;
+}
+
+/* Programs whole words where the address is aligned (x32 parallelism, 2.7-3.6V)
+ * and single bytes elsewhere. Flash must be unlocked by the caller. */
+__RAM_FUNC uint8_t bootloader_flash_program(uint32_t mem_address, const uint8_t *pBuffer, uint32_t len)
+{
+    uint8_t status = HAL_OK;
+    uint32_t i = 0;
+
+    __set_BASEPRI(BL_FLASH_BUSY_BASEPRI);
+
+    while (i < len && status == HAL_OK)
+    {
+        uint32_t address = mem_address + i;
+
+        FLASH->CR &= ~FLASH_CR_PSIZE;
+        if ((address & 0x3U) == 0 && len - i >= 4)
+        {
+            uint32_t word = pBuffer[i] | (pBuffer[i + 1] << 8) | (pBuffer[i + 2] << 16) |
+                            ((uint32_t)pBuffer[i + 3] << 24);
+            FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+            *(volatile uint32_t *)address = word;
+            i += 4;
+        }
+        else
+        {
+            FLASH->CR |= FLASH_CR_PG;
+            *(volatile uint8_t *)address = pBuffer[i];
+            i++;
+        }
+        status = bootloader_flash_wait();
+        FLASH->CR &= ~FLASH_CR_PG;
+    }
+
+    __set_BASEPRI(0);
+    return status;
+}
@@ -69,6 +69,7 @@ void bootloader_main(void)
 	{
 		C_UART = &huart1;
 		printf("button pressed...entering the bootloader mode\n");
+		bootloader_clock_boost();
 		bootloader_uart_read_data();
 	}
 	else
@@ -81,6 +82,16 @@ void bootloader_main(void)
 		{
 			C_UART = &huart1;
 			printf("BOOT_CMD (0x50) received...entering bootloader mode\n\r");
+			//before READY, the host sends its first frame once it has the answer
+			bootloader_clock_boost();
+			bootloader_send_ready();
+			bootloader_uart_read_data();
+		}
+		else if(!bootloader_app_is_valid())
+		{
+			C_UART = &huart1;
+			printf("Application does not match its boot record...staying in bootloader mode\n\r");
+			bootloader_clock_boost();
 			bootloader_uart_read_data();
 		}
 		else
@@ -0,0 +1,54 @@
+/*
+ * bl_board.h
+ *
+ * Board traits of the STM32L073RZ for the shared bootloader core: flash
+ * geometry, program width, RAM budget, UARTs and the optional features.
+ */
+
+#ifndef INC_BL_BOARD_H_
+#define INC_BL_BOARD_H_
+
+#include "main.h"
+
+#define D_UART     &huart2
+#define C_UART     &huart1
+
+extern UART_HandleTypeDef huart2;
+extern UART_HandleTypeDef huart1;
+
+void debug_puts(char *s);
+void debug_logf(const char *fmt, ...);
+
+/* debug_logf() formats the few conversions the core messages use */
+#define BL_LOG(...)               debug_logf("BL_MSG: " __VA_ARGS__)
+#define BL_BOARD_ACTIVITY(on)     HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, (on) ? GPIO_PIN_SET : GPIO_PIN_RESET)
+
+/* Flash: 128 byte pages in two banks, the boot record is in data EEPROM */
+#define BL_BOARD_APP_BASE         0x08006000U
+#define BL_BOARD_FLASH_SIZE       (192U * 1024U)   //the HAL's FLASH_SIZE is read at runtime
+#define BL_BOARD_APP_END          (FLASH_BASE + BL_BOARD_FLASH_SIZE)
+#define BL_BOARD_FLASH_REGIONS    { { BL_BOARD_FLASH_SIZE / FLASH_PAGE_SIZE, 7 } }
+#define BL_BOARD_ERASE_UNITS      (BL_BOARD_FLASH_SIZE / FLASH_PAGE_SIZE)   //pages, for the BL_STATS_ERASED mask
+#define BL_BOARD_WRITE_ALIGN      (FLASH_PAGE_SIZE / 2U)     //aligned half pages take the fast path
+#define BL_BOARD_ERASED_WORD      0x00000000U      //L0 flash erases to zero
+#define BL_BOARD_CAPS             (BL_CAP_VERIFY | BL_CAP_WORD_PROGRAM | BL_CAP_PAGE_ERASE | BL_CAP_ERASE_RANGE | BL_CAP_HALF_PAGE)
+
+/* RAM: 20KB */
+#define SRAM1_BASE                SRAM_BASE
+#define SRAM1_SIZE                (20U * 1024U)
+#define SRAM1_END                 (SRAM1_BASE + SRAM1_SIZE)
+#define BL_BOARD_MEMORY_MAP       { { BL_BOARD_APP_BASE, BL_BOARD_APP_END } }   //BL_VERIFY, never the bootloader's keys
+#define BL_BOARD_RX_LEN           256              //Largest frame the one byte length allows
+#define BL_BOARD_BATCH_MAX_OPS    32
+
+/* The L0 UID words are not contiguous */
+#define BL_BOARD_UID_OFFSETS      { 0x00, 0x04, 0x14 }
+#define BL_BOARD_CYCLES_DWT       0
+
+/* Page erases block, there is no RWW across the whole erase path */
+#define BL_BOARD_ASYNC_ERASE      0
+#define BL_BOARD_RAM_FUNC                          //nothing gains from SRAM while a page erase blocks
+#define BL_BOARD_SIGNATURE        0
+#define BL_BOARD_CIPHER           0
+
+#endif /* INC_BL_BOARD_H_ */
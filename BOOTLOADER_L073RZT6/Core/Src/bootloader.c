@@ -3,11 +3,22 @@
  *
  *  Created on: July 12, 2025
  *      Author: kjeyabalan
+ *
+ * STM32L0 port of the bootloader core: polled HAL UART, page and range
+ * erases, half page programming, the boot record in data EEPROM and the jump
+ * to the application. Framing and the common commands are in bl_core.c.
  */
 
+#include <stdarg.h>
 #include "bootloader.h"
 
-uint8_t bl_rx_buffer[BL_RX_LEN];
+typedef struct
+{
+    uint32_t magic;
+    uint32_t app_size;      /* 0 withdraws the record, an update is in progress */
+    uint32_t app_crc;
+    uint32_t check;         /* magic ^ app_size ^ app_crc */
+} bl_boot_record_t;
 
 void debug_puts(char *s)
 {
@@ -18,35 +29,141 @@ void debug_puts(char *s)
 	HAL_UART_Transmit(&huart2, (uint8_t *)"\n", 1, HAL_MAX_DELAY);
 }
 
-void  bootloader_uart_read_data(void)
+/* Just the conversions the core messages use: %d %u %x %s, with an optional
+ * '#' and 'l'. The newlib printf family would not fit the 24K bootloader. */
+void debug_logf(const char *fmt, ...)
 {
-    uint8_t rcv_len=0;
+	char line[96];
+	uint32_t len = 0;
+	va_list args;
 
-	while(1)
+	va_start(args, fmt);
+	while(*fmt && len < sizeof(line) - 12)
 	{
-		memset(bl_rx_buffer,0,200);
-        HAL_UART_Receive(C_UART,bl_rx_buffer,1,HAL_MAX_DELAY);
-		rcv_len= bl_rx_buffer[0];
-		HAL_UART_Receive(C_UART,&bl_rx_buffer[1],rcv_len,HAL_MAX_DELAY);
-		switch(bl_rx_buffer[1])
+		char digits[10];
+		uint8_t n = 0, alt = 0;
+		uint32_t value, base = 10;
+
+		if(*fmt != '%')
+		{
+			line[len++] = *fmt++;
+			continue;
+		}
+		fmt++;
+		if(*fmt == '#') { alt = 1; fmt++; }
+		if(*fmt == 'l') fmt++;
+
+		switch(*fmt)
 		{
-            case BL_GET_CID:
-                bootloader_handle_getcid_cmd(bl_rx_buffer);
-                break;
-            case BL_GO_TO_RESET:
-            	bootloader_go_reset_cmd(bl_rx_buffer);
-                break;
-            case BL_FLASH_ERASE:
-                bootloader_handle_flash_erase_cmd(bl_rx_buffer);
-                break;
-            case BL_MEM_WRITE:
-                bootloader_handle_mem_write_cmd(bl_rx_buffer);
-                break;
-            default:
-            	debug_puts("BL_MSG: Invalid command");
-                break;
+		case 's':
+			for(const char *str = va_arg(args, const char *); *str && len < sizeof(line) - 12; str++)
+				line[len++] = *str;
+			fmt++;
+			continue;
+		case 'd':
+			value = va_arg(args, int);
+			if((int32_t)value < 0)
+			{
+				line[len++] = '-';
+				value = -value;
+			}
+			break;
+		case 'x':
+			value = va_arg(args, uint32_t);
+			base = 16;
+			if(alt && value)
+			{
+				line[len++] = '0';
+				line[len++] = 'x';
+			}
+			break;
+		case 'u':
+			value = va_arg(args, uint32_t);
+			break;
+		default:
+			line[len++] = '%';
+			if(*fmt == '%')
+				fmt++;
+			continue;
 		}
+		fmt++;
+
+		do
+		{
+			digits[n++] = "0123456789abcdef"[value % base];
+			value /= base;
+		} while(value);
+		while(n)
+			line[len++] = digits[--n];
 	}
+	va_end(args);
+
+	line[len] = '\0';
+	debug_puts(line);
+}
+
+/* The command UART is polled through the HAL, nothing to set up */
+void bootloader_uart_start(void)
+{
+}
+
+/* An overrun stops reception on this USART until it is cleared, the polled
+ * HAL receive never does, so a single missed byte used to hang the link */
+uint8_t bootloader_uart_available(void)
+{
+    if (__HAL_UART_GET_FLAG(C_UART, UART_FLAG_ORE))
+    {
+        __HAL_UART_CLEAR_OREFLAG(C_UART);
+    }
+    return __HAL_UART_GET_FLAG(C_UART, UART_FLAG_RXNE) ? 1 : 0;
+}
+
+void bootloader_uart_read(uint8_t *pBuffer, uint32_t len)
+{
+    HAL_UART_Receive(C_UART, pBuffer, len, HAL_MAX_DELAY);
+}
+
+void bootloader_uart_write(const uint8_t *pBuffer, uint32_t len)
+{
+    HAL_UART_Transmit(C_UART, (uint8_t *)pBuffer, len, HAL_MAX_DELAY);
+}
+
+/* Commands whose frames are particular to this board, 0 when not one of them */
+uint8_t bl_port_handle_cmd(uint8_t *pBuffer)
+{
+    switch (pBuffer[1])
+    {
+    case BL_FLASH_ERASE:
+        bootloader_handle_flash_erase_cmd(pBuffer);
+        return 1;
+    case BL_ERASE_RANGE:
+        bootloader_handle_erase_range_cmd(pBuffer);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Batch operations particular to this board, the payload of the matching command frame */
+uint8_t bl_port_batch_op(uint8_t op, uint8_t *pArgs, uint8_t args_len)
+{
+    uint32_t mem_address, length;
+
+    switch (op)
+    {
+    case BL_FLASH_ERASE:
+        if (args_len != 3) return BL_BATCH_BAD_OP;
+        return execute_flash_erase(pArgs[0], pArgs[1] | (pArgs[2] << 8));
+
+    case BL_ERASE_RANGE:
+        if (args_len != 8) return BL_BATCH_BAD_OP;
+        memcpy(&mem_address, &pArgs[0], 4);
+        memcpy(&length, &pArgs[4], 4);
+        return execute_flash_erase_range(mem_address, length);
+
+    default:
+        return BL_BATCH_BAD_OP;
+    }
 }
 
 void bootloader_jump_to_user_app(void)
@@ -55,8 +172,8 @@ void bootloader_jump_to_user_app(void)
 
 	debug_puts("BL_MSG: Jumping to user app");
 
-	uint32_t msp_value = *(volatile uint32_t *)FLASH_SECTOR2_BASE_ADDRESS;
-	uint32_t reset_handler_address = *(volatile uint32_t *)(FLASH_SECTOR2_BASE_ADDRESS + 4);
+	uint32_t msp_value = *(volatile uint32_t *)BL_BOARD_APP_BASE;
+	uint32_t reset_handler_address = *(volatile uint32_t *)(BL_BOARD_APP_BASE + 4);
 
 	HAL_Delay(1000);
 
@@ -67,37 +184,18 @@ void bootloader_jump_to_user_app(void)
 	SysTick->LOAD = 0;
 	SysTick->VAL = 0;
 
-	for (int i = 0; i < 8; i++) {
-		NVIC->ICER[i] = 0xFFFFFFFF;
-		NVIC->ICPR[i] = 0xFFFFFFFF;
-	}
+	//the M0+ has 32 interrupts, a single clear enable and clear pending register
+	NVIC->ICER[0] = 0xFFFFFFFF;
+	NVIC->ICPR[0] = 0xFFFFFFFF;
 	__DSB();
 	__ISB();
 	__set_MSP(msp_value);
 
-	app_reset_handler = (void *)reset_handler_address;
+	app_reset_handler = (void *)(uintptr_t)reset_handler_address;
 	app_reset_handler();
 
 }
 
-void bootloader_go_reset_cmd(uint8_t *pBuffer)
-{
-	debug_puts("BL_MSG: Reset command received");
-    bootloader_send_ack(pBuffer[0], 0);
-    uint8_t resp = ADDR_VALID;
-    bootloader_uart_write_data(&resp, 1);
-    HAL_Delay(1000);
-    NVIC_SystemReset();
-}
-
-void bootloader_handle_getcid_cmd(uint8_t *pBuffer)
-{
-    uint16_t bl_cid_num = get_mcu_chip_id();
-    uint8_t tx_buf[4] = { BL_ACK, 2, (uint8_t)(bl_cid_num & 0xFF), (uint8_t)((bl_cid_num >> 8) & 0xFF) };
-    HAL_UART_Transmit(C_UART, tx_buf, sizeof(tx_buf), HAL_MAX_DELAY);
-    debug_puts("BL_MSG: Sent chip ID");
-}
-
 void bootloader_handle_flash_erase_cmd(uint8_t *pBuffer)
 {
     debug_puts("BL_MSG: Flash erase command");
@@ -113,95 +211,171 @@ void bootloader_handle_flash_erase_cmd(uint8_t *pBuffer)
     bootloader_uart_write_data(&erase_status, 1);
 }
 
-void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
+/* Frame: len | cmd | addr(4) | length(4) | crc(4)
+ * Reply: ACK, 1 | status, the ACK goes out first as a long erase can take seconds */
+void bootloader_handle_erase_range_cmd(uint8_t *pBuffer)
 {
-    debug_puts("BL_MSG: Memory write command");
-    uint8_t len = pBuffer[0];
-    if (len < 7) return;
-
-    uint8_t payload_len = pBuffer[6];
-    uint32_t mem_address;
+    debug_puts("BL_MSG: Erase range command");
+    uint8_t erase_status;
+    uint32_t mem_address, length;
     memcpy(&mem_address, &pBuffer[2], 4);
+    memcpy(&length, &pBuffer[6], 4);
 
     bootloader_send_ack(pBuffer[0], 1);
 
-    uint8_t write_status = (verify_address(mem_address) == ADDR_VALID)
-        ? execute_mem_write(&pBuffer[7], mem_address, payload_len)
-        : ADDR_INVALID;
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, 1);
+    erase_status = execute_flash_erase_range(mem_address, length);
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, 0);
 
-    bootloader_uart_write_data(&write_status, 1);
+    bootloader_uart_write_data(&erase_status, 1);
 }
 
-void bootloader_send_ack(uint8_t command_code, uint8_t follow_len)
+/* Erases nb_pages pages from address one at a time, passing over pages that
+ * already read blank. Stops at the first page that fails to erase. */
+static HAL_StatusTypeDef bootloader_erase_pages(uint32_t address, uint32_t nb_pages)
 {
-    uint8_t ack_buf[2] = { BL_ACK, follow_len };
-    HAL_UART_Transmit(C_UART, ack_buf, 2, HAL_MAX_DELAY);
-}
+    FLASH_EraseInitTypeDef flashErase_handle;
+    uint32_t pageError;
+    HAL_StatusTypeDef status = HAL_OK;
 
-void bootloader_send_nack(void)
-{
-    uint8_t nack = BL_NACK;
-    HAL_UART_Transmit(C_UART, &nack, 1, HAL_MAX_DELAY);
-}
+    bl_stats_erase_begin(bl_flash_unit(address), nb_pages);
+    flashErase_handle.TypeErase = FLASH_TYPEERASE_PAGES;
+    flashErase_handle.NbPages = 1;
 
-void bootloader_uart_write_data(uint8_t *pBuffer, uint32_t len)
-{
-    HAL_UART_Transmit(C_UART, pBuffer, len, HAL_MAX_DELAY);
+    HAL_FLASH_Unlock();
+    for (; nb_pages > 0 && status == HAL_OK; nb_pages--, address += FLASH_PAGE_SIZE)
+    {
+        if (bl_flash_is_blank(address, FLASH_PAGE_SIZE))
+            continue;
+
+        flashErase_handle.PageAddress = address;
+        uint32_t started = bl_stats_cycles();
+        status = HAL_FLASHEx_Erase(&flashErase_handle, &pageError);
+        bl_stats_stage(BL_STAGE_ERASE, started);
+        if (status == HAL_OK)
+            bl_stats_erase_unit(bl_flash_unit(address));
+    }
+    HAL_FLASH_Lock();
+
+    return status;
 }
 
-uint16_t get_mcu_chip_id(void)
+/* Only application pages are the host's to erase, the bootloader's never */
+uint8_t execute_flash_erase(uint8_t page_number, uint16_t number_of_pages)
 {
-    return (uint16_t)(DBGMCU->IDCODE) & 0x0FFF;
-}
+    uint32_t address = FLASH_BASE + (uint32_t)page_number * FLASH_PAGE_SIZE;
 
+    if (address < BL_BOARD_APP_BASE || number_of_pages > (BL_BOARD_APP_END - address) / FLASH_PAGE_SIZE)
+        return INVALID_SECTOR;
+    if (number_of_pages == 0)
+        return HAL_OK;
 
-uint8_t verify_address(uint32_t go_address)
-{
-    return ((go_address >= SRAM1_BASE && go_address < SRAM1_END) ||
-            (go_address >= FLASH_BASE && go_address < FLASH_END))
-            ? ADDR_VALID : ADDR_INVALID;
+    /* The application is touched, its boot record no longer holds */
+    bl_port_write_boot_record(0, 0, BL_VERDICT_UNSIGNED);
+
+    return bootloader_erase_pages(address, number_of_pages);
 }
 
-uint8_t execute_flash_erase(uint8_t page_number, uint16_t number_of_pages)
+/* Erases every page touching [mem_address, mem_address + len), in either bank,
+ * but never the bootloader itself */
+uint8_t execute_flash_erase_range(uint32_t mem_address, uint32_t len)
 {
-    FLASH_EraseInitTypeDef flashErase_handle;
-    uint32_t pageError;
-
-    if (number_of_pages > 512) return INVALID_SECTOR;
+    uint32_t first_page = mem_address & ~(FLASH_PAGE_SIZE - 1U);
+    uint32_t end = mem_address + len;
 
-    flashErase_handle.TypeErase = FLASH_TYPEERASE_PAGES;
-    flashErase_handle.PageAddress = FLASH_BASE + ((uint32_t)page_number * 128);
-    flashErase_handle.NbPages = number_of_pages;
+    if (len == 0 || first_page < BL_BOARD_APP_BASE || end < mem_address || end > BL_BOARD_APP_END)
+        return INVALID_SECTOR;
 
-    HAL_FLASH_Unlock();
-    HAL_FLASHEx_Erase(&flashErase_handle, &pageError);
-    HAL_FLASH_Lock();
+    bl_port_write_boot_record(0, 0, BL_VERDICT_UNSIGNED);
 
-    return HAL_OK;
+    return bootloader_erase_pages(first_page, (end - first_page + FLASH_PAGE_SIZE - 1U) / FLASH_PAGE_SIZE);
 }
 
+/* Aligned 64 byte blocks go through the RAM resident half-page program (16 words
+ * per operation), the unaligned head and tail are programmed a word at a time */
 uint8_t execute_mem_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len)
 {
     HAL_StatusTypeDef status = HAL_OK;
-    uint32_t padded_len = (len + 3) & ~0x03;
+    uint32_t half_page[FLASH_HALF_PAGE_WORDS];
+    uint32_t i = 0;
+    uint32_t started = bl_stats_cycles();
 
     HAL_FLASH_Unlock();
-    for (uint32_t i = 0; i < padded_len; i += 4)
+    while (i < len && status == HAL_OK)
     {
-        uint32_t word = 0xFFFFFFFF;
-        word  = (i + 0 < len ? pBuffer[i + 0] : 0xFF);
-        word |= (i + 1 < len ? pBuffer[i + 1] : 0xFF) << 8;
-        word |= (i + 2 < len ? pBuffer[i + 2] : 0xFF) << 16;
-        word |= (i + 3 < len ? pBuffer[i + 3] : 0xFF) << 24;
-
-        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, mem_address + i, word);
-        if (status != HAL_OK) break;
+        uint32_t address = mem_address + i;
+
+        if ((address & (FLASH_HALF_PAGE_SIZE - 1U)) == 0 && len - i >= FLASH_HALF_PAGE_SIZE)
+        {
+            /* The payload sits at an odd offset in bl_rx_buffer, the HAL reads whole words */
+            memcpy(half_page, &pBuffer[i], FLASH_HALF_PAGE_SIZE);
+            status = HAL_FLASHEx_HalfPageProgram(address, half_page);
+            i += FLASH_HALF_PAGE_SIZE;
+        }
+        else
+        {
+            uint32_t word;
+            word  = (i + 0 < len ? pBuffer[i + 0] : 0xFF);
+            word |= (i + 1 < len ? pBuffer[i + 1] : 0xFF) << 8;
+            word |= (i + 2 < len ? pBuffer[i + 2] : 0xFF) << 16;
+            word |= (uint32_t)(i + 3 < len ? pBuffer[i + 3] : 0xFF) << 24;
+
+            status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, word);
+            i += 4;
+        }
     }
     HAL_FLASH_Lock();
+    bl_stats_stage(BL_STAGE_PROGRAM, started);
+
+    /* Read back, programming a cell that was not erased is not always flagged */
+    if (status == HAL_OK && memcmp((const void *)(uintptr_t)mem_address, pBuffer, len) != 0)
+    {
+        status = HAL_ERROR;
+    }
     return status;
 }
 
+/* The magic goes last, a torn update leaves no record rather than a wrong one.
+ * The check word goes first, it is never 0, so a torn record cannot pass for
+ * the blank EEPROM of a device that never had one. A withdrawn record is
+ * written even when there was none, it marks the update in progress.
+ * Signed boot is not built here, so there is no verdict to keep. */
+uint8_t bl_port_write_boot_record(uint32_t app_size, uint32_t app_crc, uint32_t verdict)
+{
+    const bl_boot_record_t *current = (const bl_boot_record_t *)BL_META_BASE;
+    uint32_t words[3] = { app_size, app_crc, BL_META_MAGIC ^ app_size ^ app_crc };
+    HAL_StatusTypeDef status;
+
+    (void)verdict;
+    if (current->magic == BL_META_MAGIC && current->app_size == app_size && current->app_crc == app_crc &&
+        current->check == words[2])
+        return HAL_OK;
+
+    HAL_FLASHEx_DATAEEPROM_Unlock();
+    status = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, BL_META_BASE, 0);
+    for (uint32_t i = 3; i > 0 && status == HAL_OK; i--)
+    {
+        status = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, BL_META_BASE + i * 4, words[i - 1]);
+    }
+    if (status == HAL_OK)
+    {
+        status = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, BL_META_BASE, BL_META_MAGIC);
+    }
+    HAL_FLASHEx_DATAEEPROM_Lock();
+    return status;
+}
 
-
-
-
+/* Only a device whose record area is still blank, one that never had a record,
+ * starts its application unchecked. A withdrawn record (app_size 0) means an
+ * update is in progress and a torn one is not trusted either. */
+uint8_t bootloader_app_is_valid(void)
+{
+    const bl_boot_record_t *record = (const bl_boot_record_t *)BL_META_BASE;
+
+    if (record->magic != BL_META_MAGIC)
+        return record->app_size == 0 && record->app_crc == 0 && record->check == 0;
+    if (record->check != (record->magic ^ record->app_size ^ record->app_crc) ||
+        record->app_size == 0)
+        return 0;
+    return execute_range_crc(BL_BOARD_APP_BASE, record->app_size) == record->app_crc;
+}
@@ -75,6 +75,12 @@ void bootloader_main(void)
 		if (status == HAL_OK && rx_byte == BOOT_CMD)
 		{
 			debug_puts("BOOT_CMD received: Entering bootloader mode");
+			bootloader_send_ready();
+			bootloader_uart_read_data();
+		}
+		else if(!bootloader_app_is_valid())
+		{
+			debug_puts("Application does not match its boot record: Staying in bootloader mode");
 			bootloader_uart_read_data();
 		}
 		else
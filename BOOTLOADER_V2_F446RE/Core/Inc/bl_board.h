@@ -0,0 +1,80 @@
+/*
+ * bl_board.h
+ *
+ * Board traits of the STM32F446RE for the shared bootloader core: flash
+ * geometry, program width, RAM budget, UARTs and the optional features.
+ */
+
+#ifndef INC_BL_BOARD_H_
+#define INC_BL_BOARD_H_
+
+#include <stdio.h>
+#include "main.h"
+
+#define D_UART    &huart2
+extern UART_HandleTypeDef *C_UART;     //picked by bootloader_main() from the UART the host used
+
+extern UART_HandleTypeDef huart5;
+extern UART_HandleTypeDef huart2;
+extern UART_HandleTypeDef huart3;
+
+#define BL_LOG(...)               do { printf("BL_MSG:" __VA_ARGS__); printf("\n"); } while(0)
+#define BL_BOARD_ACTIVITY(on)     HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, (on) ? GPIO_PIN_SET : GPIO_PIN_RESET)
+
+/* Flash: 4 x 16KB, 1 x 64KB, then 128KB sectors. The last sector holds the
+ * boot records and is left out of the table the host sees. */
+#define BL_BOARD_APP_BASE         0x08008000U      //Application base address, sector 2
+#define BL_BOARD_APP_END          0x08060000U      //start of the boot record sector
+#define BL_BOARD_FLASH_SIZE       (512U * 1024U)
+#define BL_BOARD_FLASH_REGIONS    { { 4, 14 }, { 1, 16 }, { (BL_BOARD_FLASH_SIZE - 0x20000U) / 0x20000U - 1U, 17 } }
+#define BL_BOARD_ERASE_UNITS      8                //sectors, for the BL_STATS_ERASED mask
+#define BL_BOARD_WRITE_ALIGN      1                //words where aligned, bytes elsewhere, any alignment
+#define BL_BOARD_ERASED_WORD      0xFFFFFFFFU
+#define BL_BOARD_CAPS             (BL_CAP_VERIFY | BL_CAP_ASYNC_ERASE)
+
+/* RAM: 112KB SRAM1, 16KB SRAM2 and 4KB backup SRAM */
+#define SRAM1_SIZE                (112U * 1024U)
+#define SRAM1_END                 (SRAM1_BASE + SRAM1_SIZE)
+#define SRAM2_SIZE                (16U * 1024U)
+#define SRAM2_END                 (SRAM2_BASE + SRAM2_SIZE)
+#define BKPSRAM_SIZE              (4U * 1024U)
+#define BKPSRAM_END               (BKPSRAM_BASE + BKPSRAM_SIZE)
+#define BL_BOARD_MEMORY_MAP       { { BL_BOARD_APP_BASE, BL_BOARD_APP_END } }   //BL_VERIFY, never the bootloader's keys
+#define BL_BOARD_RX_LEN           256              //Largest frame the one byte length allows
+#define BL_BOARD_BATCH_MAX_OPS    32
+
+#define BL_BOARD_UID_OFFSETS      { 0x00, 0x04, 0x08 }
+#define BL_BOARD_CYCLES_DWT       1
+
+/* Sector erases run in the background from SRAM, see bootloader_ram.c. The
+ * command loop, replies and erase poll run from SRAM as well, so frames are
+ * served while a sector erases. */
+#define BL_BOARD_ASYNC_ERASE      1
+#define BL_BOARD_RAM_FUNC         __RAM_FUNC
+
+/* Keys are provisioned per build in Core/Inc/bl_keys.h, which is kept out of
+ * the repository. A feature whose key is not provisioned is left out. */
+#if __has_include("bl_keys.h")
+#include "bl_keys.h"
+#endif
+
+/* Signed boot. The signature is over the SHA-256 of the image and is checked
+ * once, when the boot record is written; later boots trust the record's
+ * verdict and only re-check the hardware CRC. Defining the release public key
+ * as BL_SIGNING_PUBKEY { 32 bytes } in bl_keys.h builds it in; define
+ * BL_SIGNED_BOOT 1 there as well to refuse unsigned images. */
+#ifdef BL_SIGNING_PUBKEY
+#define BL_BOARD_SIGNATURE 1
+#else
+#define BL_BOARD_SIGNATURE 0
+#endif
+
+/* Encrypted transport. The key is shared with the image build and defined as
+ * BL_IMAGE_KEY { 32 bytes } in bl_keys.h, without it the feature is left out. */
+#ifdef BL_IMAGE_KEY
+#define BL_BOARD_CIPHER    1
+#else
+#define BL_BOARD_CIPHER    0
+#endif
+
+#endif /* INC_BL_BOARD_H_ */
@@ -82,6 +82,13 @@ void bootloader_main(void)
 		{
 			C_UART = &huart3;
 			printf("BOOT_CMD received...entering ESP32 bootloader mode\n\r");
+			bootloader_send_ready();
+			bootloader_uart_read_data();
+		}
+		else if(!bootloader_app_is_valid())
+		{
+			C_UART = &huart3;
+			printf("Application does not match its boot record...staying in bootloader mode\n\r");
 			bootloader_uart_read_data();
 		}
 		else
@@ -0,0 +1,24 @@
+#ifndef CMD_PARSER_H
+#define CMD_PARSER_H
+
+#include "ota_update.h"
+
+#define CMD_PARSER_MAX_DEPTH            8   // Nesting allowed in values that are skipped
+
+typedef enum {
+    CMD_FIELD_INT = 0,
+    CMD_FIELD_STRING,
+} cmd_field_type_t;
+
+// One expected member of a flat JSON command object; unknown members are skipped
+typedef struct {
+    const char *key;
+    cmd_field_type_t type;
+    void *value;            // int * or char buffer of value_size bytes
+    size_t value_size;
+    bool found;
+} cmd_field_t;
+
+esp_err_t cmd_parse(const char *data, size_t len, cmd_field_t *fields, size_t field_count);
+
+#endif
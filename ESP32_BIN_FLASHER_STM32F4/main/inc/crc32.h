@@ -3,7 +3,7 @@
 
 #include "ota_update.h"
 
-uint32_t get_crc(uint8_t *buff, uint32_t len);
+uint32_t get_crc(const uint8_t *buff, uint32_t len);
 uint8_t word_to_byte(uint32_t addr, int index);
 
 #endif
\ No newline at end of file
@@ -3,20 +3,25 @@
 
 #include "ota_update.h"
 #include "mqtt.h"
+#include "image_store.h"
 
 #define HTTP_BUFFER_SIZE                2048
 #define FIRMWARE_CHUNK_SIZE             128   // Size for each write command
-#define DOWNLOAD_BUFFER_SIZE            32768 // 32KB buffer for larger files
-#define MAX_FIRMWARE_SIZE               (512 * 1024)  // 512KB max
+#define MAX_FIRMWARE_SIZE               (IMAGE_STORE_SLOT_SIZE - IMAGE_STORE_HEADER_SIZE)  // What a cache slot holds
+#define HTTP_DOWNLOAD_MAX_ATTEMPTS      8
+#define HTTP_RETRY_BASE_DELAY_MS        1000  // Doubled after each failed attempt
+#define HTTP_RETRY_MAX_DELAY_MS         30000
+#define HTTP_PROGRESS_NAMESPACE         "stm32_dl"
+#define HTTP_PROGRESS_KEY               "download"
+#define HTTP_PROGRESS_OFFSET_KEY        "offset"
+#define HTTP_PROGRESS_COMMIT_BYTES      (16 * 1024)  // Persist the resume point every 16KB staged
 
-extern uint8_t *download_buffer;
 extern size_t total_firmware_size;
 extern size_t bytes_downloaded;
 extern bool download_complete;
-extern size_t allocated_buffer_size;
 
 
 esp_err_t http_event_handler(esp_http_client_event_t *evt);
-esp_err_t download_firmware(const char *url);
+esp_err_t download_firmware(const char *url, const image_store_header_t *cached, bool *not_modified, int *slot);
 
 #endif
\ No newline at end of file
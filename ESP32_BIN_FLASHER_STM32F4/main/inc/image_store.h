@@ -0,0 +1,46 @@
+#ifndef IMAGE_STORE_H
+#define IMAGE_STORE_H
+
+#include "ota_update.h"
+#include "esp_partition.h"
+
+#define IMAGE_STORE_PARTITION_LABEL     "stm32img"
+#define IMAGE_STORE_MAGIC               0x53544D49  // "STMI"
+#define IMAGE_STORE_VERSION             3
+// The partition is split into fixed size slots: two in the 0xF0000 of partitions.csv. A slot holds
+// an image of up to 476KB, enough for the largest application area, 352KB on the F401 and F446
+// (0x08008000-0x08060000), with the cipher header of an encrypted image on top
+#define IMAGE_STORE_SLOT_SIZE           0x78000
+#define IMAGE_STORE_HEADER_SIZE         0x1000      // First sector of each slot holds the header
+#define IMAGE_STORE_MAX_SLOTS           8
+#define IMAGE_STORE_FAMILY_LEN          16
+#define IMAGE_STORE_URL_LEN             256
+#define IMAGE_STORE_ETAG_LEN            128
+#define IMAGE_STORE_LAST_MODIFIED_LEN   64
+
+// Written after the image data, so a valid header always describes a complete image
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t image_size;
+    uint32_t sequence;          // Higher is more recently used
+    uint8_t sha256[32];
+    char target_family[IMAGE_STORE_FAMILY_LEN];
+    char url[IMAGE_STORE_URL_LEN];
+    char etag[IMAGE_STORE_ETAG_LEN];
+    char last_modified[IMAGE_STORE_LAST_MODIFIED_LEN];
+} image_store_header_t;
+
+esp_err_t image_store_init(void);
+size_t image_store_capacity(void);
+int image_store_find_by_url(const char *url, image_store_header_t *header);
+int image_store_find_by_sha256(const uint8_t *sha256, image_store_header_t *header);
+esp_err_t image_store_touch(int slot);
+esp_err_t image_store_begin(size_t image_size, int *slot);
+esp_err_t image_store_resume(int slot, size_t image_size);
+esp_err_t image_store_write(size_t offset, const void *data, size_t len);
+esp_err_t image_store_finish(const char *url, const char *etag, const char *last_modified);
+esp_err_t image_store_open(int slot, const uint8_t **image, size_t *image_size);
+void image_store_close(void);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef UPDATE_JOBS_H
+#define UPDATE_JOBS_H
+
+#include "ota_update.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define UPDATE_JOB_POOL_SIZE            4   // Jobs that can be pending at once
+#define UPDATE_JOB_URL_LEN              256
+#define UPDATE_JOB_TARGET_LEN           16
+
+typedef enum {
+    UPDATE_JOB_STM32_IMAGE = 0,
+    UPDATE_JOB_ESP32_OTA,
+    UPDATE_JOB_TYPE_COUNT,
+} update_job_type_t;
+
+typedef enum {
+    UPDATE_JOB_PRIORITY_NORMAL = 0,
+    UPDATE_JOB_PRIORITY_HIGH,
+    UPDATE_JOB_PRIORITY_COUNT,
+} update_job_priority_t;
+
+typedef struct {
+    update_job_type_t type;
+    update_job_priority_t priority;
+    char target[UPDATE_JOB_TARGET_LEN];     // Target family the image is built for, empty for any
+    char url[UPDATE_JOB_URL_LEN];
+    uint8_t sha256[32];
+    bool sha256_set;
+    uint8_t signature[64];                  // Ed25519 over the image SHA-256, checked by the bootloader
+    bool signature_set;
+} update_job_t;
+
+esp_err_t update_jobs_init(void);
+void update_jobs_set_worker(update_job_type_t type, TaskHandle_t worker);
+esp_err_t update_jobs_submit(const update_job_t *job);
+bool update_jobs_take(update_job_type_t type, update_job_t *job);
+
+#endif
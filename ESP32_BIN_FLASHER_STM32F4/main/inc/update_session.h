@@ -0,0 +1,38 @@
+#ifndef UPDATE_SESSION_H
+#define UPDATE_SESSION_H
+
+#include "ota_update.h"
+#include "update_jobs.h"
+
+#define UPDATE_SESSION_NAMESPACE        "stm32_update"
+#define UPDATE_SESSION_KEY              "session"
+#define UPDATE_SESSION_OFFSET_KEY       "acked"
+#define UPDATE_SESSION_VERSION          2
+#define UPDATE_SESSION_COMMIT_BYTES     4096  // Persist progress every 4KB written
+
+// State of an STM32 update that survives an ESP32 reset or a dropped link
+typedef struct {
+    uint32_t version;
+    char url[256];
+    uint32_t image_size;
+    uint32_t image_crc;         // get_crc() over the whole image
+    uint32_t base_address;
+    uint32_t acked_offset;      // Bytes acknowledged by the bootloader, stored under its own key
+    uint32_t erased_sectors;    // Bit n set once sector n was erased in this session
+    // What a resumed job needs besides the URL, so it closes the way the original would have
+    char target[UPDATE_JOB_TARGET_LEN];
+    uint8_t sha256[32];
+    bool sha256_set;
+    uint8_t signature[64];
+    bool signature_set;
+} update_session_t;
+
+void update_session_begin(update_session_t *session, const update_job_t *job, uint32_t image_size, uint32_t image_crc);
+void update_session_to_job(const update_session_t *session, update_job_t *job);
+esp_err_t update_session_load(update_session_t *session);
+esp_err_t update_session_save(const update_session_t *session);
+esp_err_t update_session_save_progress(const update_session_t *session);
+esp_err_t update_session_clear(void);
+bool update_session_matches(const update_session_t *session, const char *url, uint32_t image_size, uint32_t image_crc);
+
+#endif
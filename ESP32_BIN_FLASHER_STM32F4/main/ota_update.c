@@ -3,47 +3,118 @@
 #include "wifi.h"
 #include "http.h"
 #include "mqtt.h"
+#include "update_session.h"
+#include "image_store.h"
+#include "update_jobs.h"
+#include "update_esp.h"
 
 
-bool firmware_update_requested = false;
-char firmware_url[256];
-
 static const char *TAG = "OTA_UPDATE";
+static update_session_t update_session;
+
+// Finds the image for the job in the cache, revalidating or downloading it when needed
+static int acquire_firmware_image(const update_job_t *job, bool have_session) {
+    image_store_header_t cached;
+    int slot;
+    
+    // An unfinished update of the same URL is retried from the cached copy, without the network
+    if (have_session && (slot = image_store_find_by_url(job->url, NULL)) >= 0) {
+        ESP_LOGI(TAG, "Resuming from cached image in slot %d", slot);
+        return slot;
+    }
+    
+    // Known content (e.g. a rollback) needs no network at all
+    if (job->sha256_set && (slot = image_store_find_by_sha256(job->sha256, NULL)) >= 0) {
+        ESP_LOGI(TAG, "Image with requested SHA-256 is cached in slot %d", slot);
+        send_mqtt_status("Downloaded", "bin file found in cache");
+        return slot;
+    }
+    
+    int cached_slot = image_store_find_by_url(job->url, &cached);
+    bool not_modified = false;
+    if (download_firmware(job->url, cached_slot >= 0 ? &cached : NULL, &not_modified, &slot) != ESP_OK) {
+        return -1;
+    }
+    if (not_modified) {
+        slot = cached_slot;
+    }
+    
+    if (job->sha256_set && image_store_find_by_sha256(job->sha256, NULL) != slot) {
+        ESP_LOGE(TAG, "Downloaded image does not match the requested SHA-256");
+        send_mqtt_status("Failed", "bin file SHA-256 mismatch");
+        return -1;
+    }
+    return slot;
+}
 
-static esp_err_t flash_stm32_firmware(void) {
+static esp_err_t flash_stm32_firmware(const update_job_t *job) {
     ESP_LOGI(TAG, "Starting STM32 firmware update process");
     
-    if (download_firmware(firmware_url) != ESP_OK) {
+    if (job->target[0] && strncmp(job->target, CONFIG_STM32_TARGET_FAMILY, sizeof(job->target)) != 0) {
+        ESP_LOGE(TAG, "Job targets %s, this flasher drives %s", job->target, CONFIG_STM32_TARGET_FAMILY);
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    const uint8_t *image = NULL;
+    size_t image_size = 0;
+    bool have_session = update_session_load(&update_session) == ESP_OK &&
+                        strncmp(update_session.url, job->url, sizeof(update_session.url)) == 0;
+    
+    int slot = acquire_firmware_image(job, have_session);
+    if (slot < 0) {
         ESP_LOGE(TAG, "Firmware download failed");
         return ESP_FAIL;
     }
+    if (image_store_open(slot, &image, &image_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Cached firmware image is not readable");
+        return ESP_FAIL;
+    }
+    image_store_touch(slot);
     
-    esp_err_t result = flash_downloaded_firmware();
+    uint32_t image_crc = get_crc(image, image_size);
+    if (have_session && update_session_matches(&update_session, job->url, image_size, image_crc)) {
+        ESP_LOGI(TAG, "Resuming update session at offset %" PRIu32, update_session.acked_offset);
+    } else {
+        update_session_begin(&update_session, job, image_size, image_crc);
+        update_session_save(&update_session);
+    }
     
-    if (download_buffer) {
-        free(download_buffer);
-        download_buffer = NULL;
+    esp_err_t result = flash_downloaded_firmware(image, image_size, job->signature_set ? job->signature : NULL,
+                                                 &update_session);
+    if (result == ESP_OK) {
+        update_session_clear();
     }
     
+    image_store_close();
     return result;
 }
 
 static void firmware_update_task(void *pvParameters) {
+    update_job_t job;
+    update_session_t pending;
+    
+    update_jobs_set_worker(UPDATE_JOB_STM32_IMAGE, xTaskGetCurrentTaskHandle());
+    
+    if (update_session_load(&pending) == ESP_OK) {
+        ESP_LOGI(TAG, "Found interrupted update at offset %" PRIu32 "/%" PRIu32 ", resuming",
+                 pending.acked_offset, pending.image_size);
+        update_session_to_job(&pending, &job);
+        update_jobs_submit(&job);
+    }
+    
     while (1) {
-        if (firmware_update_requested) {
-            firmware_update_requested = false;
-            
+        // Jobs submitted while one runs leave the notification pending, so none is missed
+        while (update_jobs_take(UPDATE_JOB_STM32_IMAGE, &job)) {
             ESP_LOGI(TAG, "Processing firmware update request");
-            
-            if (flash_stm32_firmware() == ESP_OK) {
+            if (flash_stm32_firmware(&job) == ESP_OK) {
                 ESP_LOGI(TAG, "Firmware update completed successfully");
                 send_mqtt_status("Success", "STM32 firmware updated successfully");
             } else {
                 ESP_LOGE(TAG, "Firmware update failed");
                 send_mqtt_status("Failed", "STM32 firmware update failed");
             }
-        }       
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
 }
 
@@ -56,6 +127,9 @@ void app_main(void) {
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    
+    ESP_ERROR_CHECK(image_store_init());
+    ESP_ERROR_CHECK(update_jobs_init());
 
     uart_init();
     ESP_LOGI(TAG, "UART initialized");
@@ -68,6 +142,7 @@ void app_main(void) {
     ESP_LOGI(TAG, "MQTT client started");
 
     xTaskCreatePinnedToCore(firmware_update_task, "firmware_update", 8192, NULL, 5, NULL, 1);
+    ota_init();
     
     ESP_LOGI(TAG, "System ready. Waiting for firmware update requests...");
 }
@@ -3,20 +3,51 @@
 
 static const char *TAG = "FLASH_CMD";
 
+// Waits up to timeout_ms for BL_READY, skipping any other byte on the line
+static bool wait_for_bootloader_ready(int timeout_ms) {
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    int64_t now;
+    uint8_t reply;
+    
+    while ((now = esp_timer_get_time()) < deadline) {
+        int left_ms = (int)((deadline - now + 999) / 1000);
+        if (uart_read_bytes_timeout(&reply, 1, left_ms) == 1 && reply == BL_READY) {
+            return true;
+        }
+    }
+    return false;
+}
+
 esp_err_t send_sync_command(void) {
-    ESP_LOGI(TAG, "Sending sync command (0x50) twice with 1000ms interval");
+    ESP_LOGI(TAG, "Probing bootloader with sync command (0x50)");
     
     uart_flush_rx_buffer();
     
-    for (int i = 0; i < 2; i++) {
-        ESP_LOGI(TAG, "Sending sync command %d/2", i + 1);
-        uart_write_byte(0x50);
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    int64_t start = esp_timer_get_time();
+    int wait_ms = BL_SYNC_PROBE_MIN_MS;
+    int probes = 0;
+    
+    while (esp_timer_get_time() - start < (int64_t)BL_SYNC_TIMEOUT_MS * 1000) {
+        uart_write_byte(BL_BOOT_CMD);
+        probes++;
+        
+        if (wait_for_bootloader_ready(wait_ms)) {
+            // Probes still in flight are each answered, drop those replies before the first frame
+            uart_flush_rx_buffer();
+            ESP_LOGI(TAG, "Bootloader ready after %d probe(s) in %lld ms", probes,
+                     (long long)((esp_timer_get_time() - start) / 1000));
+            send_mqtt_status("Success", "Bootloader started successfully");
+            return ESP_OK;
+        }
+        
+        wait_ms *= 2;
+        if (wait_ms > BL_SYNC_PROBE_MAX_MS) {
+            wait_ms = BL_SYNC_PROBE_MAX_MS;
+        }
     }
     
-    vTaskDelay(pdMS_TO_TICKS(500));
-    send_mqtt_status("Success", "Bootloader started successfully");
-    return ESP_OK;
+    ESP_LOGE(TAG, "No bootloader ready reply after %d probes", probes);
+    return ESP_ERR_TIMEOUT;
 }
 
 esp_err_t send_get_cid_command(void) {
@@ -81,7 +112,262 @@ esp_err_t send_flash_erase_command(uint8_t sector, uint8_t num_sectors) {
     return ESP_FAIL;
 }
 
-esp_err_t send_mem_write_command(uint32_t base_address, uint8_t *data, uint8_t length) {
+esp_err_t send_page_erase_command(uint8_t first_page, uint16_t num_pages) {
+    ESP_LOGI(TAG, "Command ==> BL_FLASH_ERASE - Page: %d, Count: %d", first_page, num_pages);
+    send_mqtt_status("Sending", "Sending flash erase cmd");
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_PAGE_ERASE_LEN];
+    data_buf[0] = COMMAND_BL_PAGE_ERASE_LEN - 1;
+    data_buf[1] = COMMAND_BL_FLASH_ERASE;
+    data_buf[2] = first_page;
+    data_buf[3] = word_to_byte(num_pages, 1);
+    data_buf[4] = word_to_byte(num_pages, 2);
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_PAGE_ERASE_LEN - 4);
+    data_buf[5] = word_to_byte(crc32, 1);
+    data_buf[6] = word_to_byte(crc32, 2);
+    data_buf[7] = word_to_byte(crc32, 3);
+    data_buf[8] = word_to_byte(crc32, 4);
+    
+    send_bootloader_packet(data_buf, COMMAND_BL_PAGE_ERASE_LEN);
+    
+    uint8_t erase_status;
+    size_t response_len;
+    if (read_bootloader_reply(COMMAND_BL_FLASH_ERASE, &erase_status, &response_len) == ESP_OK) {
+        if (erase_status == Flash_HAL_OK) {
+            ESP_LOGI(TAG, "Erase Status: Success Code: Flash_HAL_OK");
+            send_mqtt_status("Success", "Flash erased successfully");
+            return ESP_OK;
+        }
+        ESP_LOGE(TAG, "Erase Status: Fail Code: 0x%02x", erase_status);
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t send_erase_range_command(uint32_t base_address, uint32_t length) {
+    ESP_LOGI(TAG, "Command ==> BL_ERASE_RANGE - Address: 0x%08" PRIx32 ", Length: %" PRIu32, base_address, length);
+    send_mqtt_status("Sending", "Sending flash erase cmd");
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_ERASE_RANGE_LEN];
+    data_buf[0] = COMMAND_BL_ERASE_RANGE_LEN - 1;
+    data_buf[1] = COMMAND_BL_ERASE_RANGE;
+    data_buf[2] = word_to_byte(base_address, 1);
+    data_buf[3] = word_to_byte(base_address, 2);
+    data_buf[4] = word_to_byte(base_address, 3);
+    data_buf[5] = word_to_byte(base_address, 4);
+    data_buf[6] = word_to_byte(length, 1);
+    data_buf[7] = word_to_byte(length, 2);
+    data_buf[8] = word_to_byte(length, 3);
+    data_buf[9] = word_to_byte(length, 4);
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_ERASE_RANGE_LEN - 4);
+    data_buf[10] = word_to_byte(crc32, 1);
+    data_buf[11] = word_to_byte(crc32, 2);
+    data_buf[12] = word_to_byte(crc32, 3);
+    data_buf[13] = word_to_byte(crc32, 4);
+    
+    send_bootloader_packet(data_buf, COMMAND_BL_ERASE_RANGE_LEN);
+    
+    // The status follows the ACK once every page is erased
+    int timeout_ms = BL_REPLY_TIMEOUT_MS + (int)(length / 128) * BL_PAGE_ERASE_TIME_MS;
+    uint8_t erase_status;
+    size_t response_len;
+    if (read_bootloader_reply_timeout(COMMAND_BL_ERASE_RANGE, &erase_status, &response_len, timeout_ms) == ESP_OK) {
+        if (erase_status == Flash_HAL_OK) {
+            ESP_LOGI(TAG, "Erase Status: Success Code: Flash_HAL_OK");
+            send_mqtt_status("Success", "Flash erased successfully");
+            return ESP_OK;
+        }
+        ESP_LOGE(TAG, "Erase Status: Fail Code: 0x%02x", erase_status);
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t send_erase_status_command(bl_erase_status_t *status) {
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_ERASE_STATUS_LEN];
+    data_buf[0] = COMMAND_BL_ERASE_STATUS_LEN - 1;
+    data_buf[1] = COMMAND_BL_ERASE_STATUS;
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_ERASE_STATUS_LEN - 4);
+    data_buf[2] = word_to_byte(crc32, 1);
+    data_buf[3] = word_to_byte(crc32, 2);
+    data_buf[4] = word_to_byte(crc32, 3);
+    data_buf[5] = word_to_byte(crc32, 4);
+    send_bootloader_packet(data_buf, COMMAND_BL_ERASE_STATUS_LEN);
+    
+    // Reply: state | units done | units remaining | status
+    uint8_t reply[4];
+    size_t response_len = 0;
+    if (read_bootloader_reply(COMMAND_BL_ERASE_STATUS, reply, &response_len) != ESP_OK || response_len != sizeof(reply)) {
+        return ESP_FAIL;
+    }
+    status->busy = reply[0] != 0;
+    status->done = reply[1];
+    status->remaining = reply[2];
+    status->status = reply[3];
+    return ESP_OK;
+}
+
+// Layout the flasher assumed before BL_GET_CAPS: STM32F4 sectors, application at sector 2
+static void default_target_caps(bl_target_caps_t *caps) {
+    memset(caps, 0, sizeof(*caps));
+    caps->max_payload = BL_WRITE_CHUNK_DEFAULT;
+    caps->write_align = 1;
+    caps->app_base = FLASH_BASE_ADDRESS;
+    caps->flash_base = 0x08000000;
+    caps->flash_size = 512 * 1024;
+    caps->region_count = 3;
+    caps->regions[0].count = 4;
+    caps->regions[0].size_log2 = 14;
+    caps->regions[1].count = 1;
+    caps->regions[1].size_log2 = 16;
+    caps->regions[2].count = 3;
+    caps->regions[2].size_log2 = 17;
+}
+
+esp_err_t send_get_caps_command(bl_target_caps_t *caps) {
+    ESP_LOGI(TAG, "Command ==> BL_GET_CAPS");
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_GET_CAPS_LEN];
+    data_buf[0] = COMMAND_BL_GET_CAPS_LEN - 1;
+    data_buf[1] = COMMAND_BL_GET_CAPS;
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_GET_CAPS_LEN - 4);
+    data_buf[2] = word_to_byte(crc32, 1);
+    data_buf[3] = word_to_byte(crc32, 2);
+    data_buf[4] = word_to_byte(crc32, 3);
+    data_buf[5] = word_to_byte(crc32, 4);
+    send_bootloader_packet(data_buf, COMMAND_BL_GET_CAPS_LEN);
+    
+    // Reply: version | flags | max payload | write align | app base(4) | flash base(4) |
+    //        flash size(4) | uid(12) | regions | {count(2), log2 size}...
+    uint8_t reply[255];
+    size_t response_len = 0;
+    if (read_bootloader_reply(COMMAND_BL_GET_CAPS, reply, &response_len) != ESP_OK || response_len < 29) {
+        ESP_LOGW(TAG, "Bootloader did not report capabilities, using defaults");
+        default_target_caps(caps);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    
+    memset(caps, 0, sizeof(*caps));
+    caps->protocol_version = reply[0];
+    caps->flags = reply[1];
+    caps->max_payload = reply[2];
+    caps->write_align = reply[3] ? reply[3] : 1;
+    memcpy(&caps->app_base, &reply[4], 4);
+    memcpy(&caps->flash_base, &reply[8], 4);
+    memcpy(&caps->flash_size, &reply[12], 4);
+    memcpy(caps->uid, &reply[16], sizeof(caps->uid));
+    caps->region_count = reply[28];
+    if (caps->region_count == 0 || caps->region_count > BL_CAPS_MAX_REGIONS ||
+        response_len < 29 + 3 * (size_t)caps->region_count) {
+        ESP_LOGE(TAG, "Malformed capability reply");
+        default_target_caps(caps);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    for (int i = 0; i < caps->region_count; i++) {
+        caps->regions[i].count = reply[29 + 3 * i] | (reply[30 + 3 * i] << 8);
+        caps->regions[i].size_log2 = reply[31 + 3 * i];
+    }
+    if (response_len > 29 + 3 * (size_t)caps->region_count) {
+        caps->flags2 = reply[29 + 3 * caps->region_count];
+    }
+    
+    ESP_LOGI(TAG, "Target: protocol v%d, flags 0x%02x/0x%02x, app base 0x%08" PRIx32 ", flash %" PRIu32 "KB, max payload %d",
+             caps->protocol_version, caps->flags, caps->flags2, caps->app_base, caps->flash_size / 1024, caps->max_payload);
+    uint32_t uid_words[3];
+    memcpy(uid_words, caps->uid, sizeof(uid_words));
+    ESP_LOGI(TAG, "UID: %08" PRIx32 "%08" PRIx32 "%08" PRIx32, uid_words[2], uid_words[1], uid_words[0]);
+    return ESP_OK;
+}
+
+// Finds the run of erase units covering [app_base, app_base + image_size) and its length in bytes
+static esp_err_t plan_erase(const bl_target_caps_t *caps, size_t image_size, uint16_t *first, uint16_t *count,
+                            uint32_t *length) {
+    uint32_t image_end = caps->app_base + image_size;
+    uint32_t addr = caps->flash_base;
+    uint16_t unit = 0;
+    bool started = false;
+    
+    *count = 0;
+    *length = 0;
+    for (int r = 0; r < caps->region_count; r++) {
+        uint32_t size = 1U << caps->regions[r].size_log2;
+        for (uint16_t i = 0; i < caps->regions[r].count; i++, unit++, addr += size) {
+            if (!started && addr == caps->app_base) {
+                started = true;
+                *first = unit;
+            }
+            if (started) {
+                (*count)++;
+                *length += size;
+                if (addr + size >= image_end) {
+                    return ESP_OK;
+                }
+            }
+        }
+    }
+    ESP_LOGE(TAG, "Image of %zu bytes does not fit the application area", image_size);
+    return ESP_ERR_INVALID_SIZE;
+}
+
+// Start address of an erase unit, counted from flash_base like the caps region map
+static uint32_t erase_unit_address(const bl_target_caps_t *caps, uint16_t unit) {
+    uint32_t addr = caps->flash_base;
+    
+    for (int r = 0; r < caps->region_count; r++) {
+        uint16_t n = unit < caps->regions[r].count ? unit : caps->regions[r].count;
+        addr += (uint32_t)n << caps->regions[r].size_log2;
+        unit -= n;
+    }
+    return addr;
+}
+
+// Polls a background erase until everything below end is erased, *erased_end tracks how far it got
+static esp_err_t wait_for_erase(const bl_target_caps_t *caps, uint16_t first, uint16_t count, uint32_t end,
+                                uint32_t *erased_end) {
+    int64_t deadline = esp_timer_get_time() + (int64_t)count * BL_SECTOR_ERASE_TIME_MS * 1000;
+    int last_done = -1;
+    bl_erase_status_t status;
+    
+    while (*erased_end < end) {
+        if (send_erase_status_command(&status) != ESP_OK) {
+            ESP_LOGE(TAG, "Erase status poll failed");
+            return ESP_FAIL;
+        }
+        if (status.status != Flash_HAL_OK) {
+            ESP_LOGE(TAG, "Erase Status: Fail Code: 0x%02x after %d units", status.status, status.done);
+            return ESP_FAIL;
+        }
+        *erased_end = erase_unit_address(caps, first + status.done);
+        if (status.done != last_done) {
+            char status_erase[64];
+            snprintf(status_erase, sizeof(status_erase), "Erased %d/%d units", status.done, count);
+            send_mqtt_status("Erasing", status_erase);
+            last_done = status.done;
+        }
+        if (*erased_end >= end) {
+            break;
+        }
+        if (!status.busy) {
+            ESP_LOGE(TAG, "Erase ended after %d of %d units", status.done, count);
+            return ESP_FAIL;
+        }
+        if (esp_timer_get_time() > deadline) {
+            ESP_LOGE(TAG, "Erase did not finish in time");
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(BL_ERASE_POLL_MS));
+    }
+    return ESP_OK;
+}
+
+esp_err_t send_mem_write_command(uint32_t base_address, const uint8_t *data, uint8_t length) {
     ESP_LOGD(TAG, "Command ==> BL_MEM_WRITE - Address: 0x%08" PRIx32 ", Length: %d", base_address, length);
     
     uart_flush_rx_buffer();
@@ -106,9 +392,8 @@ esp_err_t send_mem_write_command(uint32_t base_address, uint8_t *data, uint8_t l
     data_buf[10 + length] = word_to_byte(crc32, 4);
     
     send_bootloader_packet(data_buf, mem_write_cmd_total_len);
-
-    vTaskDelay(pdMS_TO_TICKS(100));
     
+    // The status follows once the chunk is programmed and read back, no fixed delay needed
     uint8_t write_status;
     size_t response_len;
     if (read_bootloader_reply(COMMAND_BL_MEM_WRITE, &write_status, &response_len) == ESP_OK) {
@@ -123,6 +408,167 @@ esp_err_t send_mem_write_command(uint32_t base_address, uint8_t *data, uint8_t l
     return ESP_FAIL;
 }
 
+esp_err_t send_verify_command(uint32_t base_address, uint32_t length, uint32_t *crc) {
+    ESP_LOGI(TAG, "Command ==> BL_VERIFY - Address: 0x%08" PRIx32 ", Length: %" PRIu32, base_address, length);
+    
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_VERIFY_LEN];
+    data_buf[0] = COMMAND_BL_VERIFY_LEN - 1;
+    data_buf[1] = COMMAND_BL_VERIFY;
+    data_buf[2] = word_to_byte(base_address, 1);
+    data_buf[3] = word_to_byte(base_address, 2);
+    data_buf[4] = word_to_byte(base_address, 3);
+    data_buf[5] = word_to_byte(base_address, 4);
+    data_buf[6] = word_to_byte(length, 1);
+    data_buf[7] = word_to_byte(length, 2);
+    data_buf[8] = word_to_byte(length, 3);
+    data_buf[9] = word_to_byte(length, 4);
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_VERIFY_LEN - 4);
+    data_buf[10] = word_to_byte(crc32, 1);
+    data_buf[11] = word_to_byte(crc32, 2);
+    data_buf[12] = word_to_byte(crc32, 3);
+    data_buf[13] = word_to_byte(crc32, 4);
+    
+    send_bootloader_packet(data_buf, COMMAND_BL_VERIFY_LEN);
+    
+    // Reply: status byte followed by the little-endian CRC of the range
+    uint8_t verify_reply[5];
+    size_t response_len = 0;
+    if (read_bootloader_reply(COMMAND_BL_VERIFY, verify_reply, &response_len) == ESP_OK && response_len == sizeof(verify_reply)) {
+        if (verify_reply[0] == Flash_HAL_OK) {
+            memcpy(crc, &verify_reply[1], sizeof(*crc));
+            ESP_LOGI(TAG, "Target CRC: 0x%08" PRIx32, *crc);
+            return ESP_OK;
+        }
+        ESP_LOGE(TAG, "Verify_status: FAIL - Code: 0x%02x", verify_reply[0]);
+    }
+    return ESP_FAIL;
+}
+
+// Tells the target how the following write payloads are encrypted, BL_CIPHER_NONE for plaintext
+esp_err_t send_cipher_start_command(uint8_t cipher, const uint8_t *nonce) {
+    ESP_LOGI(TAG, "Command ==> BL_CIPHER_START - Cipher: %d", cipher);
+    
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_CIPHER_START_LEN];
+    data_buf[0] = COMMAND_BL_CIPHER_START_LEN - 1;
+    data_buf[1] = COMMAND_BL_CIPHER_START;
+    data_buf[2] = cipher;
+    memcpy(&data_buf[3], nonce, 12);
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_CIPHER_START_LEN - 4);
+    data_buf[15] = word_to_byte(crc32, 1);
+    data_buf[16] = word_to_byte(crc32, 2);
+    data_buf[17] = word_to_byte(crc32, 3);
+    data_buf[18] = word_to_byte(crc32, 4);
+    
+    send_bootloader_packet(data_buf, COMMAND_BL_CIPHER_START_LEN);
+    
+    uint8_t status = 0xFF;
+    size_t response_len = 0;
+    if (read_bootloader_reply(COMMAND_BL_CIPHER_START, &status, &response_len) != ESP_OK || response_len != 1 ||
+        status != Flash_HAL_OK) {
+        ESP_LOGE(TAG, "Cipher_status: FAIL - Code: 0x%02x", status);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static const char *const stage_names[] = { "rx", "crc", "program", "erase", "reply", "blank" };
+
+// Logs which sectors or pages of the last erase the target really erased, blank ones it passed over
+static esp_err_t log_erased_units(const uint8_t *reply, size_t response_len) {
+    uint16_t first_unit, units;
+    char list[96];
+    size_t list_len = 0;
+    int erased = 0;
+
+    if (response_len < 4) {
+        return ESP_FAIL;
+    }
+    memcpy(&first_unit, &reply[0], 2);
+    memcpy(&units, &reply[2], 2);
+    if (response_len != 4 + ((size_t)units + 7) / 8) {
+        return ESP_FAIL;
+    }
+
+    list[0] = '\0';
+    for (uint16_t i = 0; i < units; i++) {
+        if (!(reply[4 + i / 8] & (1U << (i % 8)))) {
+            continue;
+        }
+        erased++;
+        if (list_len < sizeof(list) - 8) {
+            list_len += snprintf(&list[list_len], sizeof(list) - list_len, " %u", first_unit + i);
+        } else if (list_len < sizeof(list) - 4) {
+            list_len += snprintf(&list[list_len], sizeof(list) - list_len, " ...");
+        }
+    }
+    ESP_LOGI(TAG, "Target erased %d of %u units from %u:%s", erased, units, first_unit, list);
+    return ESP_OK;
+}
+
+// Logs the target's cycle counters, per frame stage or per command, in microseconds,
+// or the units its last erase erased
+esp_err_t send_get_stats_command(uint8_t selector) {
+    ESP_LOGI(TAG, "Command ==> BL_GET_STATS - Selector: 0x%02x", selector);
+    
+    uart_flush_rx_buffer();
+    
+    uint8_t data_buf[COMMAND_BL_GET_STATS_LEN];
+    data_buf[0] = COMMAND_BL_GET_STATS_LEN - 1;
+    data_buf[1] = COMMAND_BL_GET_STATS;
+    data_buf[2] = selector;
+    
+    uint32_t crc32 = get_crc(data_buf, COMMAND_BL_GET_STATS_LEN - 4);
+    data_buf[3] = word_to_byte(crc32, 1);
+    data_buf[4] = word_to_byte(crc32, 2);
+    data_buf[5] = word_to_byte(crc32, 3);
+    data_buf[6] = word_to_byte(crc32, 4);
+    
+    send_bootloader_packet(data_buf, COMMAND_BL_GET_STATS_LEN);
+    
+    // Reply: core clock(4) | entries | {id | count(4) | min(4) | max(4) | avg(4)}...
+    //        first unit(2) | units(2) | mask                 for BL_STATS_ERASED
+    uint8_t reply[UINT8_MAX];
+    size_t response_len = 0;
+    if (read_bootloader_reply(COMMAND_BL_GET_STATS, reply, &response_len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if ((selector & ~BL_STATS_CLEAR) == BL_STATS_ERASED) {
+        return log_erased_units(reply, response_len);
+    }
+    if (response_len < 5 ||
+        response_len != 5 + (size_t)reply[4] * BL_STATS_ENTRY_LEN) {
+        return ESP_FAIL;
+    }
+    
+    uint32_t clock_hz;
+    memcpy(&clock_hz, &reply[0], 4);
+    uint32_t cycles_per_us = clock_hz >= 1000000 ? clock_hz / 1000000 : 1;
+    for (int i = 0; i < reply[4]; i++) {
+        const uint8_t *entry = &reply[5 + i * BL_STATS_ENTRY_LEN];
+        uint32_t count, min, max, avg;
+        char name[8];
+        
+        memcpy(&count, &entry[1], 4);
+        memcpy(&min, &entry[5], 4);
+        memcpy(&max, &entry[9], 4);
+        memcpy(&avg, &entry[13], 4);
+        if (selector & BL_STATS_COMMANDS) {
+            snprintf(name, sizeof(name), "0x%02x", entry[0]);
+        } else {
+            snprintf(name, sizeof(name), "%s", entry[0] < sizeof(stage_names) / sizeof(stage_names[0]) ? stage_names[entry[0]] : "?");
+        }
+        ESP_LOGI(TAG, "Target %-7s n=%" PRIu32 " min=%" PRIu32 "us avg=%" PRIu32 "us max=%" PRIu32 "us",
+                 name, count, min / cycles_per_us, avg / cycles_per_us, max / cycles_per_us);
+    }
+    return ESP_OK;
+}
+
 esp_err_t send_go_reset() {
     ESP_LOGI(TAG, "Command ==> BL_GO_TO_ADDR");
     
@@ -149,16 +595,138 @@ esp_err_t send_go_reset() {
     return ESP_FAIL;
 }
 
-esp_err_t flash_downloaded_firmware(void) {
-    if (!download_buffer || bytes_downloaded == 0) {
-        ESP_LOGE(TAG, "No firmware data to flash");
+void batch_init(bl_batch_t *batch) {
+    batch->frame[1] = COMMAND_BL_BATCH;
+    batch->len = 3;
+    batch->count = 0;
+}
+
+// Appends one operation, args are the payload of the matching command frame
+esp_err_t batch_add(bl_batch_t *batch, uint8_t op, const uint8_t *args, uint8_t args_len) {
+    if (batch->count >= BL_BATCH_MAX_OPS || batch->len + 2 + args_len + 4 > BL_FRAME_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    batch->frame[batch->len++] = op;
+    batch->frame[batch->len++] = args_len;
+    memcpy(&batch->frame[batch->len], args, args_len);
+    batch->len += args_len;
+    batch->count++;
+    return ESP_OK;
+}
+
+// Sends the batch, *failed_index is the first operation that failed, BL_BATCH_NOT_RUN when none
+// did or no reply came back
+esp_err_t send_batch_command(bl_batch_t *batch, uint8_t *failed_index) {
+    ESP_LOGI(TAG, "Command ==> BL_BATCH - %d operations", batch->count);
+    
+    uart_flush_rx_buffer();
+    
+    batch->frame[0] = batch->len + 4 - 1;
+    batch->frame[2] = batch->count;
+    uint32_t crc32 = get_crc(batch->frame, batch->len);
+    batch->frame[batch->len] = word_to_byte(crc32, 1);
+    batch->frame[batch->len + 1] = word_to_byte(crc32, 2);
+    batch->frame[batch->len + 2] = word_to_byte(crc32, 3);
+    batch->frame[batch->len + 3] = word_to_byte(crc32, 4);
+    send_bootloader_packet(batch->frame, batch->len + 4);
+    
+    // Reply: first failed index | executed | status per operation
+    uint8_t reply[2 + BL_BATCH_MAX_OPS];
+    size_t response_len = 0;
+    *failed_index = BL_BATCH_NOT_RUN;
+    // A signature check in the batch keeps the target busy well past the usual reply time
+    if (read_bootloader_reply_timeout(COMMAND_BL_BATCH, reply, &response_len, BL_BATCH_TIMEOUT_MS) != ESP_OK ||
+        response_len != 2 + (size_t)batch->count) {
+        return ESP_FAIL;
+    }
+    *failed_index = reply[0];
+    if (reply[0] != BL_BATCH_NOT_RUN) {
+        ESP_LOGE(TAG, "Batch operation %d failed with 0x%02x", reply[0],
+                 reply[0] < batch->count ? reply[2 + reply[0]] : 0);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// BL_SET_BOOT_FLAG: the image length, the CRC its boot record holds and, for a signed image,
+// the signature the bootloader checks once there
+static esp_err_t batch_add_boot_flag(bl_batch_t *batch, uint32_t image_len, uint32_t boot_crc,
+                                     const uint8_t *signature) {
+    uint8_t args[8 + 64];
+    
+    memcpy(&args[0], &image_len, 4);
+    memcpy(&args[4], &boot_crc, 4);
+    if (signature) {
+        memcpy(&args[8], signature, 64);
+    }
+    return batch_add(batch, COMMAND_BL_SET_BOOT_FLAG, args, signature ? sizeof(args) : 8);
+}
+
+// Checks that the bytes acknowledged before an interruption are really in the target flash
+static bool confirm_resume_point(const uint8_t *image, const update_session_t *session) {
+    uint32_t target_crc = 0;
+    
+    if (send_verify_command(session->base_address, session->acked_offset, &target_crc) != ESP_OK) {
+        ESP_LOGW(TAG, "Target range CRC unavailable, restarting from offset 0");
+        return false;
+    }
+    
+    uint32_t image_crc = get_crc(image, session->acked_offset);
+    if (target_crc != image_crc) {
+        ESP_LOGW(TAG, "Target range CRC mismatch (0x%08" PRIx32 " != 0x%08" PRIx32 "), restarting from offset 0",
+                 target_crc, image_crc);
+        return false;
+    }
+    return true;
+}
+
+// An encrypted image file starts with a bl_cipher_header_t, anything else is taken as plaintext
+static esp_err_t read_cipher_header(const uint8_t *image, size_t image_size, bl_cipher_header_t *header) {
+    memset(header, 0, sizeof(*header));
+    if (image_size < sizeof(*header)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(header, image, sizeof(*header));
+    if (header->magic != BL_CIPHER_IMAGE_MAGIC) {
+        memset(header, 0, sizeof(*header));
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header->cipher != BL_CIPHER_CHACHA20 || header->image_size != image_size - sizeof(*header)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+// What one update actually did, reported in the result line
+typedef struct {
+    size_t image_size;
+    size_t start_offset;                // Non-zero when the update resumed
+    size_t chunk_size;
+    bool batched;
+} flash_run_t;
+
+static esp_err_t flash_image(const uint8_t *image, size_t image_size, const uint8_t *signature,
+                             update_session_t *session, flash_run_t *run) {
+    
+    // Encrypted images are relayed as ciphertext, only the target holds the key
+    bl_cipher_header_t cipher;
+    esp_err_t cipher_err = read_cipher_header(image, image_size, &cipher);
+    if (cipher_err == ESP_ERR_INVALID_SIZE) {
+        ESP_LOGE(TAG, "Encrypted image header is malformed");
+        send_mqtt_status("Failed", "Malformed encrypted image");
         return ESP_FAIL;
     }
+    bool encrypted = cipher_err == ESP_OK;
+    if (encrypted) {
+        image += sizeof(cipher);
+        image_size = cipher.image_size;
+    }
     
     send_mqtt_status("Starting", "STM32 firmware flashing started");
     ESP_LOGI(TAG, "Starting STM32 firmware flashing");
     
     // Step 1: Send sync command
+    flash_stats_phase(FLASH_PHASE_SYNC);
    send_mqtt_status("Sending", "Sending bootloader enable cmd");
     ESP_LOGI(TAG, "Step 1: Sending sync commands");
     if (send_sync_command() != ESP_OK) {
@@ -168,6 +736,7 @@ esp_err_t flash_downloaded_firmware(void) {
     }
     
     // Step 2: Get version
+    flash_stats_phase(FLASH_PHASE_IDENTIFY);
     ESP_LOGI(TAG, "Step 2: Checking bootloader version");
     if (send_get_cid_command() != ESP_OK) {
         ESP_LOGE(TAG, "Get version command failed");
@@ -175,29 +744,115 @@ esp_err_t flash_downloaded_firmware(void) {
         return ESP_FAIL;
     }
     
-    // Step 3: Flash erase
-    ESP_LOGI(TAG, "Step 3: Erasing flash sectors");
-    if (send_flash_erase_command(FLASH_ERASE_BASE_SECTOR, FLASH_ERASE_SECTORS) != ESP_OK) {
-        ESP_LOGE(TAG, "Flash erase command failed");
-        send_mqtt_status("Failed", "Flash erase failed");
+    // Step 3: Learn the target layout and size the erase and the write chunks from it
+    bl_target_caps_t caps;
+    send_get_caps_command(&caps);
+    if ((caps.flags2 & BL_CAP2_SIGNED_ONLY) && !signature) {
+        ESP_LOGE(TAG, "Target only accepts signed images and the job carries no signature");
+        send_mqtt_status("Failed", "Target requires a signed image");
         return ESP_FAIL;
     }
+    if (signature && !(caps.flags2 & BL_CAP2_SIGNATURE)) {
+        ESP_LOGW(TAG, "Target does not check signatures, flashing unsigned");
+        signature = NULL;
+    }
+    if (encrypted && !(caps.flags2 & BL_CAP2_ENCRYPTION)) {
+        ESP_LOGE(TAG, "Image is encrypted and the target cannot decrypt it");
+        send_mqtt_status("Failed", "Target cannot decrypt the image");
+        return ESP_FAIL;
+    }
+    // Sent for plaintext too, the target may still hold the cipher of an earlier attempt
+    if ((caps.flags2 & BL_CAP2_ENCRYPTION) &&
+        send_cipher_start_command(encrypted ? (uint8_t)cipher.cipher : BL_CIPHER_NONE, cipher.nonce) != ESP_OK) {
+        send_mqtt_status("Failed", "Target refused the image cipher");
+        return ESP_FAIL;
+    }
+    
+    uint16_t erase_first, erase_count;
+    uint32_t erase_length;
+    if (plan_erase(&caps, image_size, &erase_first, &erase_count, &erase_length) != ESP_OK) {
+        send_mqtt_status("Failed", "Firmware does not fit the target flash");
+        return ESP_FAIL;
+    }
+    // Pages are too many for the bitmap, a single bit then stands for the whole planned range
+    uint32_t erase_mask = (caps.flags & (BL_CAP_PAGE_ERASE | BL_CAP_ERASE_RANGE)) ? 1U : ((1U << erase_count) - 1) << erase_first;
+    
+    size_t chunk_size = caps.max_payload;
+    if (CONFIG_STM32_WRITE_CHUNK_MAX > 0 && chunk_size > CONFIG_STM32_WRITE_CHUNK_MAX) {
+        chunk_size = CONFIG_STM32_WRITE_CHUNK_MAX;
+    }
+    chunk_size -= chunk_size % caps.write_align;
+    if (chunk_size == 0) {
+        chunk_size = BL_WRITE_CHUNK_DEFAULT;
+    }
+    
+    // Step 4: Resume from the last committed chunk, or erase and start over
+    flash_stats_phase(FLASH_PHASE_ERASE);
+    bool resume = false;
+    // With a background erase, writes only go below erased_end until the erase has caught up
+    uint32_t erased_end = UINT32_MAX;
+    
+    if (session->acked_offset > 0 && session->base_address == caps.app_base &&
+        (session->erased_sectors & erase_mask) == erase_mask) {
+        ESP_LOGI(TAG, "Step 4: Confirming resume point at offset %" PRIu32, session->acked_offset);
+        resume = confirm_resume_point(image, session);
+    }
+    
+    if (resume) {
+        char status_resume[100];
+        snprintf(status_resume, sizeof(status_resume), "Resuming firmware write at %" PRIu32 "/%" PRIu32 " bytes",
+                 session->acked_offset, session->image_size);
+        send_mqtt_status("Resuming", status_resume);
+    } else {
+        ESP_LOGI(TAG, "Step 4: Erasing %d erase units from %d", erase_count, erase_first);
+        esp_err_t erase_result;
+        if (caps.flags & BL_CAP_ERASE_RANGE) {
+            erase_result = send_erase_range_command(caps.app_base, erase_length);
+        } else if (caps.flags & BL_CAP_PAGE_ERASE) {
+            erase_result = erase_first <= UINT8_MAX ? send_page_erase_command(erase_first, erase_count) : ESP_ERR_INVALID_ARG;
+        } else {
+            erase_result = send_flash_erase_command(erase_first, erase_count);
+        }
+        if (erase_result != ESP_OK) {
+            ESP_LOGE(TAG, "Flash erase command failed");
+            send_mqtt_status("Failed", "Flash erase failed");
+            return ESP_FAIL;
+        }
+        session->base_address = caps.app_base;
+        session->erased_sectors = erase_mask;
+        if (caps.flags & BL_CAP_ASYNC_ERASE) {
+            // Nothing can be resumed until the background erase has covered the whole image
+            erased_end = caps.app_base;
+            session->erased_sectors = 0;
+        }
+        session->acked_offset = 0;
+        update_session_save(session);
+    }
     
-    // Step 4: Write firmware data
-    ESP_LOGI(TAG, "Step 4: Writing firmware data (%zu bytes)", bytes_downloaded);
+    // Step 5: Write firmware data
+    flash_stats_phase(FLASH_PHASE_WRITE);
+    ESP_LOGI(TAG, "Step 5: Writing firmware data (%zu bytes, %zu byte chunks)", image_size, chunk_size);
     send_mqtt_status("Starting", "Firmware writing started");
-    uint32_t base_mem_address = FLASH_BASE_ADDRESS;
-    size_t bytes_remaining = bytes_downloaded;
-    size_t bytes_sent = 0;
-    uint8_t *data_ptr = download_buffer;
+    uint32_t base_mem_address = session->base_address + session->acked_offset;
+    size_t bytes_remaining = image_size - session->acked_offset;
+    size_t bytes_sent = session->acked_offset;
+    const uint8_t *data_ptr = image + session->acked_offset;
     int retry_count = 0;
     const int max_retries = 3;
+    bool batch_final = BL_BATCH_FINAL && (caps.flags2 & BL_CAP2_BATCH) != 0;
+    // Closing batch without the last write: header, VERIFY, SET_BOOT_FLAG, RESET and the frame CRC
+    size_t closing_len = 3 + (2 + 12) + (2 + (signature ? 8 + 64 : 8)) + 2 + 4;
+    
+    run->image_size = image_size;
+    run->start_offset = session->acked_offset;
+    run->chunk_size = chunk_size;
+    run->batched = batch_final;
     
     while (bytes_remaining > 0) {
         size_t len_to_read;
         
-        if (bytes_remaining >= 128) {
-            len_to_read = 128;
+        if (bytes_remaining >= chunk_size) {
+            len_to_read = chunk_size;
         } else {
             len_to_read = bytes_remaining;
         }
@@ -205,6 +860,25 @@ esp_err_t flash_downloaded_firmware(void) {
         ESP_LOGI(TAG, "base mem address = 0x%08" PRIx32, base_mem_address);
         ESP_LOGI(TAG, "bytes_so_far_sent:%zu -- bytes_remaining:%zu", bytes_sent, bytes_remaining);
         
+        if (base_mem_address + len_to_read > erased_end) {
+            flash_stats_phase(FLASH_PHASE_ERASE_WAIT);
+            if (wait_for_erase(&caps, erase_first, erase_count, base_mem_address + len_to_read, &erased_end) != ESP_OK) {
+                send_mqtt_status("Failed", "Flash erase failed");
+                return ESP_FAIL;
+            }
+            flash_stats_phase(FLASH_PHASE_WRITE);
+        }
+        if (session->erased_sectors != erase_mask && erased_end >= session->base_address + image_size) {
+            session->erased_sectors = erase_mask;
+            update_session_save(session);
+        }
+        
+        // With batch support the last chunk goes out together with the closing operations,
+        // when it is too large to share their frame it is written on its own like the others
+        if (batch_final && len_to_read == bytes_remaining && closing_len + 2 + 5 + len_to_read <= BL_FRAME_MAX_LEN) {
+            break;
+        }
+        
         esp_err_t result = send_mem_write_command(base_mem_address, data_ptr, len_to_read);
         
         if (result == ESP_OK) {
@@ -213,20 +887,27 @@ esp_err_t flash_downloaded_firmware(void) {
             bytes_sent += len_to_read;
             bytes_remaining -= len_to_read;
             retry_count = 0;
-            float progress_percentage = (float)bytes_sent * 100.0 / bytes_downloaded;
+            
+            if (bytes_sent - session->acked_offset >= UPDATE_SESSION_COMMIT_BYTES || bytes_remaining == 0) {
+                session->acked_offset = bytes_sent;
+                update_session_save_progress(session);
+            }
+            
+            float progress_percentage = (float)bytes_sent * 100.0 / image_size;
     
             char status_firm[300];
             snprintf(status_firm, sizeof(status_firm), "Flash progress: %zu/%zu bytes (%.1f%%)", 
-                    bytes_sent, bytes_downloaded, progress_percentage);
+                    bytes_sent, image_size, progress_percentage);
             send_mqtt_status("Writing", status_firm);
             
             ESP_LOGI(TAG, "Flash progress: %zu/%zu bytes (%.1f%%)", 
-                    bytes_sent, bytes_downloaded, progress_percentage);
+                    bytes_sent, image_size, progress_percentage);
         } 
         else {
             retry_count++;
             if (retry_count <= max_retries) {
                 ESP_LOGW(TAG, "Write failed, retrying (%d/%d)...", retry_count, max_retries);
+                flash_stats_retry(COMMAND_BL_MEM_WRITE);
                 vTaskDelay(pdMS_TO_TICKS(200));
             } else {
                 ESP_LOGE(TAG, "Failed to write chunk after %d retries", max_retries);
@@ -236,8 +917,112 @@ esp_err_t flash_downloaded_firmware(void) {
         }
     }
 
-    //Step 5: Go to Reset command
-    ESP_LOGI(TAG, "Step 5: Firmware write completed, sending RESET command");
+    flash_stats_phase(FLASH_PHASE_FINISH);
+    // The target's own view of where the write time went, read before the closing reset
+    if (caps.flags2 & BL_CAP2_STATS) {
+        send_get_stats_command(BL_STATS_STAGES);
+        send_get_stats_command(BL_STATS_COMMANDS);
+        send_get_stats_command(BL_STATS_ERASED);
+    }
+    if (batch_final) {
+        // Step 6: Last chunk, image verify, boot record and reset in a single round trip
+        ESP_LOGI(TAG, "Step 6: Closing batch with %zu final bytes", bytes_remaining);
+        uint32_t image_crc = get_crc(image, image_size);
+        uint32_t image_len = image_size;
+        uint8_t args[5 + UINT8_MAX];
+        uint8_t failed_index;
+        bl_batch_t batch;
+        
+        batch_init(&batch);
+        esp_err_t err = ESP_OK;
+        uint8_t write_ops = 0;
+        if (bytes_remaining > 0) {
+            memcpy(&args[0], &base_mem_address, 4);
+            args[4] = (uint8_t)bytes_remaining;
+            memcpy(&args[5], data_ptr, bytes_remaining);
+            err = batch_add(&batch, COMMAND_BL_MEM_WRITE, args, 5 + bytes_remaining);
+            write_ops = 1;
+        }
+        memcpy(&args[0], &session->base_address, 4);
+        memcpy(&args[4], &image_len, 4);
+        memcpy(&args[8], &image_crc, 4);
+        if (err == ESP_OK) {
+            err = batch_add(&batch, COMMAND_BL_VERIFY, args, 12);
+        }
+        // Target CRCs over what it was sent match the ciphertext, the boot record holds the plaintext's
+        if (err == ESP_OK) {
+            err = batch_add_boot_flag(&batch, image_len, encrypted ? cipher.image_crc : image_crc, signature);
+        }
+        if (err == ESP_OK) {
+            err = batch_add(&batch, COMMAND_BL_GO_TO_RESET, NULL, 0);
+        }
+        
+        if (err != ESP_OK) {
+            // Cannot happen while closing_len matches the operations added above
+            ESP_LOGE(TAG, "Closing batch does not fit in one frame");
+            send_mqtt_status("Failed", "Closing batch too large");
+            return ESP_FAIL;
+        }
+        if (send_batch_command(&batch, &failed_index) != ESP_OK) {
+            if (failed_index == BL_BATCH_NOT_RUN) {
+                // No reply, the acknowledged progress still holds for the next attempt
+                send_mqtt_status("Failed", "Closing batch got no reply");
+            } else if (failed_index <= write_ops) {
+                send_mqtt_status("Failed", failed_index < write_ops ? "Firmware flash write failed" : "Firmware verify failed");
+                // Start from a fresh erase next time rather than resuming onto bad flash
+                session->acked_offset = 0;
+                session->erased_sectors = 0;
+                update_session_save(session);
+            } else {
+                // The image is in place, the target refused its boot record (signature) or reset
+                send_mqtt_status("Failed", "Boot flag refused by target");
+            }
+            return ESP_FAIL;
+        }
+        send_mqtt_status("Success", "Firmware verified on target, boot flag set and target reset");
+        ESP_LOGI(TAG, "STM32 firmware update completed successfully!");
+        return ESP_OK;
+    }
+    
+    // Step 6: Check the whole image through the target's CRC unit, the frame CRCs only cover the UART
+    uint32_t image_crc = get_crc(image, image_size);
+    if (caps.flags & BL_CAP_VERIFY) {
+        ESP_LOGI(TAG, "Step 6: Verifying %zu bytes on target", image_size);
+        uint32_t target_crc = 0;
+        
+        if (send_verify_command(session->base_address, image_size, &target_crc) != ESP_OK || target_crc != image_crc) {
+            ESP_LOGE(TAG, "Image CRC mismatch: target 0x%08" PRIx32 ", image 0x%08" PRIx32, target_crc, image_crc);
+            send_mqtt_status("Failed", "Firmware verify failed");
+            // Start from a fresh erase next time rather than resuming onto bad flash
+            session->acked_offset = 0;
+            session->erased_sectors = 0;
+            update_session_save(session);
+            return ESP_FAIL;
+        }
+        send_mqtt_status("Success", "Firmware verified on target");
+    }
+    
+    // Step 7: Commit the boot record. The erase withdrew the old one, without a new one
+    // the target stays in the bootloader after the reset
+    if (caps.flags2 & BL_CAP2_BATCH) {
+        ESP_LOGI(TAG, "Step 7: Setting the boot flag");
+        bl_batch_t batch;
+        uint8_t failed_index;
+        
+        batch_init(&batch);
+        if (batch_add_boot_flag(&batch, image_size, encrypted ? cipher.image_crc : image_crc, signature) != ESP_OK ||
+            send_batch_command(&batch, &failed_index) != ESP_OK) {
+            ESP_LOGE(TAG, "Boot flag not set");
+            send_mqtt_status("Failed", "Boot flag refused by target");
+            return ESP_FAIL;
+        }
+    } else {
+        // Bootloaders from before BL_GET_CAPS keep no boot record and start whatever is flashed
+        ESP_LOGW(TAG, "Target takes no boot flag");
+    }
+    
+    // Step 8: Go to Reset command
+    ESP_LOGI(TAG, "Step 8: Firmware write completed, sending RESET command");
     send_mqtt_status("Completed", "Firmware write completed, sending GO to RESET command");
     
     if (send_go_reset() != ESP_OK) {
@@ -248,4 +1033,38 @@ esp_err_t flash_downloaded_firmware(void) {
     
     ESP_LOGI(TAG, "STM32 firmware update completed successfully!");
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+/* Logs one machine readable line per update, so a sweep over baud, chunk size and
+ * batching can be scraped from the console into baseline files:
+ * STM32_RESULT {"ok":1,"bytes":...,"sent":...,"ms":...,"bytes_per_s":...,...} */
+static void log_update_result(const flash_run_t *run, esp_err_t err, int64_t elapsed_us) {
+    size_t sent = run->image_size - run->start_offset;
+    int64_t rate = elapsed_us > 0 ? (int64_t)sent * 1000000 / elapsed_us : 0;
+    
+    if (!BL_RESULT_LOG) {
+        return;
+    }
+    ESP_LOGI(TAG, "STM32_RESULT {\"ok\":%d,\"bytes\":%zu,\"sent\":%zu,\"ms\":%" PRId64 ",\"bytes_per_s\":%" PRId64
+             ",\"baud\":%d,\"chunk\":%zu,\"batch\":%d,\"resumed\":%d}",
+             err == ESP_OK, run->image_size, sent, elapsed_us / 1000, rate,
+             UART_BAUD_RATE, run->chunk_size, run->batched, run->start_offset > 0);
+}
+
+// signature is the image's Ed25519 signature, NULL to flash it unsigned
+esp_err_t flash_downloaded_firmware(const uint8_t *image, size_t image_size, const uint8_t *signature,
+                                    update_session_t *session) {
+    flash_run_t run = { 0 };
+    
+    if (!image || image_size == 0) {
+        ESP_LOGE(TAG, "No firmware data to flash");
+        return ESP_FAIL;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    flash_stats_reset();
+    esp_err_t err = flash_image(image, image_size, signature, session, &run);
+    log_update_result(&run, err, esp_timer_get_time() - start);
+    flash_stats_publish(err, run.image_size);
+    return err;
+}
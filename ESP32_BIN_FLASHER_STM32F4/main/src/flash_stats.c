@@ -0,0 +1,143 @@
+#include "flash_stats.h"
+#include "mqtt.h"
+
+static const char *TAG = "FLASH_STATS";
+
+// Upper bounds in ms of the round trip histogram buckets, the last one is open ended
+static const int flash_bucket_ms[FLASH_STATS_BUCKETS - 1] = { 1, 2, 5, 10, 20, 50, 100, 500, 2000 };
+
+static const char *const flash_phase_names[FLASH_PHASE_COUNT] = {
+    "sync", "identify", "erase", "write", "erase_wait", "finish",
+};
+
+// One update at a time runs on the STM32 worker task, so no locking is needed
+static int64_t phase_us[FLASH_PHASE_COUNT];
+static int64_t phase_start_us;
+static int phase_current = -1;
+static int64_t update_start_us;
+static flash_command_stats_t command_stats[FLASH_STATS_COMMAND_COUNT];
+static int64_t frame_start_us;
+static uint8_t frame_command;
+
+static flash_command_stats_t *command_slot(uint8_t command_code) {
+    if (command_code < FLASH_STATS_FIRST_COMMAND || command_code >= FLASH_STATS_FIRST_COMMAND + FLASH_STATS_COMMAND_COUNT) {
+        return NULL;
+    }
+    return &command_stats[command_code - FLASH_STATS_FIRST_COMMAND];
+}
+
+void flash_stats_reset(void) {
+    memset(phase_us, 0, sizeof(phase_us));
+    memset(command_stats, 0, sizeof(command_stats));
+    phase_current = -1;
+    frame_start_us = 0;
+    update_start_us = esp_timer_get_time();
+}
+
+// Closes the running phase and starts the next, time in a phase adds up across visits
+void flash_stats_phase(flash_phase_t phase) {
+    int64_t now = esp_timer_get_time();
+    
+    if (phase_current >= 0) {
+        phase_us[phase_current] += now - phase_start_us;
+    }
+    phase_current = phase < FLASH_PHASE_COUNT ? (int)phase : -1;
+    phase_start_us = now;
+}
+
+void flash_stats_frame_sent(uint8_t command_code, int64_t start_us, int64_t end_us) {
+    flash_command_stats_t *stats = command_slot(command_code);
+    
+    frame_command = command_code;
+    frame_start_us = start_us;
+    if (stats) {
+        stats->wire_us += end_us - start_us;
+    }
+}
+
+// Ends the round trip started by the last frame sent
+void flash_stats_reply(uint8_t command_code, bool ok) {
+    flash_command_stats_t *stats = command_slot(command_code);
+    int64_t rtt = esp_timer_get_time() - frame_start_us;
+    int bucket = 0;
+    
+    if (!stats || frame_start_us == 0 || frame_command != command_code) {
+        return;
+    }
+    frame_start_us = 0;
+    
+    if (stats->count == 0 || rtt < stats->min_us) {
+        stats->min_us = rtt;
+    }
+    if (rtt > stats->max_us) {
+        stats->max_us = rtt;
+    }
+    stats->count++;
+    stats->total_us += rtt;
+    if (!ok) {
+        stats->failures++;
+    }
+    while (bucket < FLASH_STATS_BUCKETS - 1 && rtt > (int64_t)flash_bucket_ms[bucket] * 1000) {
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+}
+
+void flash_stats_retry(uint8_t command_code) {
+    flash_command_stats_t *stats = command_slot(command_code);
+    if (stats) {
+        stats->retries++;
+    }
+}
+
+/* Publishes one summary record per update:
+ * {"ok":..,"bytes":..,"ms":..,"phases_ms":{..},"buckets_ms":[..],
+ *  "commands":{"0x54":{"n":..,"fail":..,"retry":..,"wire_ms":..,"avg_us":..,"min_us":..,"max_us":..,"hist":[..]}}} */
+void flash_stats_publish(esp_err_t result, size_t image_size) {
+    flash_stats_phase(FLASH_PHASE_COUNT);
+    
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddBoolToObject(json, "ok", result == ESP_OK);
+    cJSON_AddNumberToObject(json, "bytes", image_size);
+    cJSON_AddNumberToObject(json, "ms", (double)((esp_timer_get_time() - update_start_us) / 1000));
+    
+    cJSON *phases = cJSON_AddObjectToObject(json, "phases_ms");
+    for (int i = 0; i < FLASH_PHASE_COUNT; i++) {
+        cJSON_AddNumberToObject(phases, flash_phase_names[i], (double)(phase_us[i] / 1000));
+    }
+    cJSON_AddItemToObject(json, "buckets_ms", cJSON_CreateIntArray(flash_bucket_ms, FLASH_STATS_BUCKETS - 1));
+    
+    cJSON *commands = cJSON_AddObjectToObject(json, "commands");
+    for (int i = 0; i < FLASH_STATS_COMMAND_COUNT; i++) {
+        const flash_command_stats_t *stats = &command_stats[i];
+        int histogram[FLASH_STATS_BUCKETS];
+        char name[8];
+        
+        if (stats->count == 0 && stats->retries == 0) {
+            continue;
+        }
+        for (int b = 0; b < FLASH_STATS_BUCKETS; b++) {
+            histogram[b] = (int)stats->histogram[b];
+        }
+        snprintf(name, sizeof(name), "0x%02x", FLASH_STATS_FIRST_COMMAND + i);
+        cJSON *item = cJSON_AddObjectToObject(commands, name);
+        cJSON_AddNumberToObject(item, "n", stats->count);
+        cJSON_AddNumberToObject(item, "fail", stats->failures);
+        cJSON_AddNumberToObject(item, "retry", stats->retries);
+        cJSON_AddNumberToObject(item, "wire_ms", (double)(stats->wire_us / 1000));
+        cJSON_AddNumberToObject(item, "avg_us", stats->count ? (double)(stats->total_us / stats->count) : 0);
+        cJSON_AddNumberToObject(item, "min_us", (double)stats->min_us);
+        cJSON_AddNumberToObject(item, "max_us", (double)stats->max_us);
+        cJSON_AddItemToObject(item, "hist", cJSON_CreateIntArray(histogram, FLASH_STATS_BUCKETS));
+    }
+    
+    char *json_string = cJSON_PrintUnformatted(json);
+    if (json_string) {
+        ESP_LOGI(TAG, "%s", json_string);
+        if (mqtt_connected) {
+            esp_mqtt_client_publish(mqtt_client, MQTT_STATS_PUBLISH, json_string, 0, 1, 0);
+        }
+        free(json_string);
+    }
+    cJSON_Delete(json);
+}
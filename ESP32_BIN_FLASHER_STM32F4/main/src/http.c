@@ -1,16 +1,37 @@
 #include "http.h"
 
-uint8_t *download_buffer = NULL;
 size_t total_firmware_size = 0;
 size_t bytes_downloaded = 0;
 bool download_complete = false;
-size_t allocated_buffer_size = 0;
-
-extern bool firmware_update_requested;
-extern char firmware_url[256];
 
 static const char *TAG = "HTTP_HANDLER";
 
+// Response headers of the current request, captured by the event handler
+static char resp_etag[IMAGE_STORE_ETAG_LEN];
+static char resp_last_modified[IMAGE_STORE_LAST_MODIFIED_LEN];
+static char resp_content_range[64];
+
+// Validators of the image being downloaded; sent back in If-Range and kept with the cached copy
+static char image_etag[IMAGE_STORE_ETAG_LEN];
+static char image_last_modified[IMAGE_STORE_LAST_MODIFIED_LEN];
+static int image_slot = -1;
+
+// Network data is streamed through this buffer into the staging partition
+static uint8_t http_rx_buffer[HTTP_BUFFER_SIZE];
+
+// Where an interrupted download stands; kept in NVS so that after a reset the next job
+// for the URL continues with a Range request instead of starting over
+typedef struct {
+    char url[IMAGE_STORE_URL_LEN];
+    char etag[IMAGE_STORE_ETAG_LEN];
+    char last_modified[IMAGE_STORE_LAST_MODIFIED_LEN];
+    uint32_t image_size;
+    int32_t slot;
+    uint32_t offset;            // Bytes written to the slot, stored under its own key
+} download_progress_t;
+
+static download_progress_t progress;
+
 esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     switch(evt->event_id) {
         case HTTP_EVENT_ERROR:
@@ -18,59 +39,25 @@ esp_err_t http_event_handler(esp_http_client_event_t *evt) {
             break;
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-            bytes_downloaded = 0;
-            download_complete = false;
             break;
         case HTTP_EVENT_HEADER_SENT:
             ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
             break;
         case HTTP_EVENT_ON_HEADER:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            if (strcasecmp(evt->header_key, "Content-Length") == 0) {
-                total_firmware_size = atoi(evt->header_value);
-                ESP_LOGI(TAG, "Firmware size: %zu bytes", total_firmware_size);
-                
-                if (total_firmware_size > MAX_FIRMWARE_SIZE) {
-                    ESP_LOGE(TAG, "Firmware too large: %zu bytes (max: %d)", total_firmware_size, MAX_FIRMWARE_SIZE);
-                    return ESP_FAIL;
-                }
-                
-                allocated_buffer_size = total_firmware_size;
-                
-                if (!download_buffer) {
-                    download_buffer = malloc(allocated_buffer_size);
-                    if (!download_buffer) {
-                        ESP_LOGE(TAG, "Failed to allocate download buffer of %zu bytes", allocated_buffer_size);
-                        return ESP_ERR_NO_MEM;
-                    }
-                    ESP_LOGI(TAG, "Allocated download buffer: %zu bytes for %zu byte firmware", 
-                            allocated_buffer_size, total_firmware_size);
-                }
+            if (strcasecmp(evt->header_key, "ETag") == 0) {
+                strlcpy(resp_etag, evt->header_value, sizeof(resp_etag));
+            } else if (strcasecmp(evt->header_key, "Last-Modified") == 0) {
+                strlcpy(resp_last_modified, evt->header_value, sizeof(resp_last_modified));
+            } else if (strcasecmp(evt->header_key, "Content-Range") == 0) {
+                strlcpy(resp_content_range, evt->header_value, sizeof(resp_content_range));
             }
             break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            
-            if (download_buffer && evt->data_len > 0) {
-                if (bytes_downloaded + evt->data_len <= allocated_buffer_size) {
-                    memcpy(download_buffer + bytes_downloaded, evt->data, evt->data_len);
-                    bytes_downloaded += evt->data_len;
-                    
-                    if (bytes_downloaded % 2048 == 0) {
-                        ESP_LOGI(TAG, "Downloaded: %zu/%zu bytes (%.1f%%)", 
-                               bytes_downloaded, total_firmware_size,
-                               (float)bytes_downloaded * 100.0 / total_firmware_size);
-                    }
-                } else {
-                    ESP_LOGE(TAG, "Download buffer overflow! Tried to write %d bytes at offset %zu (buffer size: %zu)", 
-                           evt->data_len, bytes_downloaded, allocated_buffer_size);
-                    return ESP_FAIL;
-                }
-            }
             break;
         case HTTP_EVENT_ON_FINISH:
-            ESP_LOGI(TAG, "HTTP download completed. Total bytes: %zu/%zu", bytes_downloaded, total_firmware_size);
-            download_complete = true;
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
             break;
         case HTTP_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
@@ -82,17 +69,247 @@ esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
-esp_err_t download_firmware(const char *url) {
+static esp_err_t progress_load(const char *url) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(HTTP_PROGRESS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t len = sizeof(progress);
+    err = nvs_get_blob(handle, HTTP_PROGRESS_KEY, &progress, &len);
+    if (err == ESP_OK && nvs_get_u32(handle, HTTP_PROGRESS_OFFSET_KEY, &progress.offset) != ESP_OK) {
+        progress.offset = 0;
+    }
+    nvs_close(handle);
+
+    if (err == ESP_OK && (len != sizeof(progress) || progress.offset >= progress.image_size ||
+                          strncmp(progress.url, url, sizeof(progress.url)) != 0)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return err;
+}
+
+// Records the image being downloaded, once the server has named its size and validator
+static esp_err_t progress_save(const char *url) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(HTTP_PROGRESS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memset(&progress, 0, sizeof(progress));
+    strlcpy(progress.url, url, sizeof(progress.url));
+    strlcpy(progress.etag, image_etag, sizeof(progress.etag));
+    strlcpy(progress.last_modified, image_last_modified, sizeof(progress.last_modified));
+    progress.image_size = total_firmware_size;
+    progress.slot = image_slot;
+    err = nvs_set_blob(handle, HTTP_PROGRESS_KEY, &progress, sizeof(progress));
+    if (err == ESP_OK) {
+        err = nvs_set_u32(handle, HTTP_PROGRESS_OFFSET_KEY, 0);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+// Only the offset moves while downloading, the data below it is already in the slot
+static esp_err_t progress_save_offset(void) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(HTTP_PROGRESS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_set_u32(handle, HTTP_PROGRESS_OFFSET_KEY, bytes_downloaded);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static esp_err_t progress_clear(void) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(HTTP_PROGRESS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_erase_all(handle);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+// Parses "bytes <start>-<end>/<total>"
+static bool parse_content_range(const char *value, size_t *start, size_t *total) {
+    unsigned long range_start, range_end, range_total;
+    if (sscanf(value, "bytes %lu-%lu/%lu", &range_start, &range_end, &range_total) != 3) {
+        return false;
+    }
+    *start = range_start;
+    *total = range_total;
+    return true;
+}
+
+// Starts (or restarts) the image from byte 0 using the response just received
+static esp_err_t restart_download(const char *url, int64_t content_length) {
+    bytes_downloaded = 0;
+    total_firmware_size = content_length > 0 ? (size_t)content_length : 0;
+    strlcpy(image_etag, resp_etag, sizeof(image_etag));
+    strlcpy(image_last_modified, resp_last_modified, sizeof(image_last_modified));
+    
+    if (total_firmware_size == 0 || total_firmware_size > MAX_FIRMWARE_SIZE) {
+        ESP_LOGE(TAG, "Invalid firmware size: %zu bytes (max: %d)", total_firmware_size, MAX_FIRMWARE_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = image_store_begin(total_firmware_size, &image_slot);
+    if (err == ESP_OK && (image_etag[0] || image_last_modified[0])) {
+        progress_save(url);
+    } else {
+        progress_clear();       // Without a validator the server cannot be asked for the rest
+    }
+    return err;
+}
+
+// One HTTP request; continues from bytes_downloaded when a previous attempt was interrupted.
+// With a cached copy of the URL the request is conditional and 304 means the copy is current.
+static esp_err_t download_attempt(esp_http_client_handle_t client, const char *url,
+                                  const image_store_header_t *cached, bool *not_modified) {
+    char range_header[32];
+    const char *image_validator = image_etag[0] ? image_etag : image_last_modified;
+    
+    resp_etag[0] = '\0';
+    resp_last_modified[0] = '\0';
+    resp_content_range[0] = '\0';
+    
+    bool resuming = bytes_downloaded > 0 && image_validator[0] != '\0';
+    if (resuming) {
+        snprintf(range_header, sizeof(range_header), "bytes=%zu-", bytes_downloaded);
+        esp_http_client_set_header(client, "Range", range_header);
+        esp_http_client_set_header(client, "If-Range", image_validator);
+        esp_http_client_delete_header(client, "If-None-Match");
+        esp_http_client_delete_header(client, "If-Modified-Since");
+        ESP_LOGI(TAG, "Resuming download at byte %zu", bytes_downloaded);
+    } else {
+        esp_http_client_delete_header(client, "Range");
+        esp_http_client_delete_header(client, "If-Range");
+        if (cached && cached->etag[0]) {
+            esp_http_client_set_header(client, "If-None-Match", cached->etag);
+        }
+        if (cached && cached->last_modified[0]) {
+            esp_http_client_set_header(client, "If-Modified-Since", cached->last_modified);
+        }
+        bytes_downloaded = 0;
+    }
+    
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+        return err;
+    }
+    
+    int64_t content_length = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    
+    if (status == 304 && cached && !resuming) {
+        ESP_LOGI(TAG, "Cached image is up to date (HTTP 304)");
+        esp_http_client_close(client);
+        *not_modified = true;
+        return ESP_OK;
+    } else if (status == 206 && resuming) {
+        size_t range_start = 0, range_total = 0;
+        const char *validator = resp_etag[0] ? resp_etag : resp_last_modified;
+        
+        if (!parse_content_range(resp_content_range, &range_start, &range_total) ||
+            range_start != bytes_downloaded || range_total != total_firmware_size ||
+            (validator[0] && strcmp(validator, image_validator) != 0)) {
+            ESP_LOGW(TAG, "Partial response does not match the stored image, restarting download");
+            bytes_downloaded = 0;
+            image_etag[0] = '\0';
+            image_last_modified[0] = '\0';
+            esp_http_client_close(client);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    } else if (status == 200) {
+        // Either a fresh download or the server decided the image changed
+        if (resuming) {
+            ESP_LOGW(TAG, "Server sent the full image, restarting from byte 0");
+        }
+        err = restart_download(url, content_length);
+        if (err != ESP_OK) {
+            esp_http_client_close(client);
+            return err;
+        }
+        ESP_LOGI(TAG, "Firmware size: %zu bytes", total_firmware_size);
+    } else {
+        ESP_LOGE(TAG, "Unexpected HTTP status: %d", status);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    
+    while (bytes_downloaded < total_firmware_size) {
+        size_t remaining = total_firmware_size - bytes_downloaded;
+        int read_len = esp_http_client_read(client, (char *)http_rx_buffer,
+                                            remaining < HTTP_BUFFER_SIZE ? remaining : HTTP_BUFFER_SIZE);
+        if (read_len <= 0) {
+            ESP_LOGW(TAG, "Connection interrupted at %zu/%zu bytes", bytes_downloaded, total_firmware_size);
+            esp_http_client_close(client);
+            return ESP_FAIL;
+        }
+        
+        esp_err_t err = image_store_write(bytes_downloaded, http_rx_buffer, read_len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to stage firmware data: %s", esp_err_to_name(err));
+            esp_http_client_close(client);
+            return err;
+        }
+        
+        size_t previous = bytes_downloaded;
+        bytes_downloaded += read_len;
+        if (bytes_downloaded / HTTP_PROGRESS_COMMIT_BYTES != previous / HTTP_PROGRESS_COMMIT_BYTES) {
+            progress_save_offset();
+        }
+        if (bytes_downloaded / 2048 != previous / 2048) {
+            ESP_LOGI(TAG, "Downloaded: %zu/%zu bytes (%.1f%%)", 
+                   bytes_downloaded, total_firmware_size,
+                   (float)bytes_downloaded * 100.0 / total_firmware_size);
+        }
+    }
+    
+    esp_http_client_close(client);
+    download_complete = true;
+    ESP_LOGI(TAG, "HTTP download completed. Total bytes: %zu/%zu", bytes_downloaded, total_firmware_size);
+    return ESP_OK;
+}
+
+// Fetches url into the image cache. *slot receives the cache slot holding the image, which is
+// the cached one when the server reports it unchanged (*not_modified is then set).
+esp_err_t download_firmware(const char *url, const image_store_header_t *cached, bool *not_modified, int *slot) {
     ESP_LOGI(TAG, "Downloading firmware from: %s", url);
     send_mqtt_status("Downloading", "bin file downloading");
     bytes_downloaded = 0;
     total_firmware_size = 0;
     download_complete = false;
-    allocated_buffer_size = 0;
+    image_etag[0] = '\0';
+    image_last_modified[0] = '\0';
+    image_slot = -1;
+    *not_modified = false;
     
-    if (download_buffer) {
-        free(download_buffer);
-        download_buffer = NULL;
+    // A download of this URL cut short by a reset continues where its slot was left
+    if (progress_load(url) == ESP_OK && progress.offset > 0 &&
+        image_store_resume(progress.slot, progress.image_size) == ESP_OK) {
+        total_firmware_size = progress.image_size;
+        bytes_downloaded = progress.offset;
+        image_slot = progress.slot;
+        strlcpy(image_etag, progress.etag, sizeof(image_etag));
+        strlcpy(image_last_modified, progress.last_modified, sizeof(image_last_modified));
+        ESP_LOGI(TAG, "Continuing interrupted download at byte %zu/%zu", bytes_downloaded, total_firmware_size);
     }
     
     esp_http_client_config_t config = {
@@ -100,6 +317,7 @@ esp_err_t download_firmware(const char *url) {
         .event_handler = http_event_handler,
         .buffer_size = HTTP_BUFFER_SIZE,
         .timeout_ms = 60000,
+        .keep_alive_enable = true,
     };
     
     esp_http_client_handle_t client = esp_http_client_init(&config);
@@ -108,9 +326,42 @@ esp_err_t download_firmware(const char *url) {
         return ESP_FAIL;
     }
     
-    esp_err_t err = esp_http_client_perform(client);
+    esp_err_t err = ESP_FAIL;
+    uint32_t retry_delay_ms = HTTP_RETRY_BASE_DELAY_MS;
+    
+    for (int attempt = 1; attempt <= HTTP_DOWNLOAD_MAX_ATTEMPTS; attempt++) {
+        err = download_attempt(client, url, cached, not_modified);
+        if (err == ESP_OK || err == ESP_ERR_INVALID_SIZE) {
+            break;
+        }
+        
+        if (attempt < HTTP_DOWNLOAD_MAX_ATTEMPTS) {
+            ESP_LOGW(TAG, "Download attempt %d/%d failed, retrying in %" PRIu32 " ms",
+                     attempt, HTTP_DOWNLOAD_MAX_ATTEMPTS, retry_delay_ms);
+            vTaskDelay(pdMS_TO_TICKS(retry_delay_ms));
+            retry_delay_ms *= 2;
+            if (retry_delay_ms > HTTP_RETRY_MAX_DELAY_MS) {
+                retry_delay_ms = HTTP_RETRY_MAX_DELAY_MS;
+            }
+        }
+    }
     esp_http_client_cleanup(client);
     
+    if (err == ESP_OK && *not_modified) {
+        send_mqtt_status("Downloaded", "bin file unchanged, using cached copy");
+        return ESP_OK;
+    }
+    
+    if (err == ESP_OK && download_complete && bytes_downloaded > 0) {
+        err = image_store_finish(url, image_etag, image_last_modified);
+        *slot = image_slot;
+    }
+    
+    // A failed download keeps its resume point for the next job of the URL
+    if (err == ESP_OK || err == ESP_ERR_INVALID_SIZE) {
+        progress_clear();
+    }
+    
     if (err == ESP_OK && download_complete && bytes_downloaded > 0) {
         ESP_LOGI(TAG, "Firmware download completed successfully. Size: %zu bytes", bytes_downloaded);
         send_mqtt_status("Downloaded", "bin file downloaded successfully");
@@ -118,10 +369,6 @@ esp_err_t download_firmware(const char *url) {
     } else {
         ESP_LOGE(TAG, "Firmware download failed: %s", esp_err_to_name(err));
         send_mqtt_status("Failed", "bin file download failed");
-        if (download_buffer) {
-            free(download_buffer);
-            download_buffer = NULL;
-        }
         return ESP_FAIL;
     }
 }
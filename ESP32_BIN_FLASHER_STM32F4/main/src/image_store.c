@@ -0,0 +1,287 @@
+#include "image_store.h"
+#include "mbedtls/sha256.h"
+
+static const char *TAG = "IMAGE_STORE";
+
+static const esp_partition_t *store_partition = NULL;
+static int slot_count = 0;
+static esp_partition_mmap_handle_t store_mmap_handle;
+static bool store_mapped = false;
+static int pending_slot = -1;
+static size_t pending_image_size = 0;
+
+static size_t slot_offset(int slot) {
+    return (size_t)slot * IMAGE_STORE_SLOT_SIZE;
+}
+
+esp_err_t image_store_init(void) {
+    store_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                               IMAGE_STORE_PARTITION_LABEL);
+    if (!store_partition) {
+        ESP_LOGE(TAG, "Partition '%s' not found", IMAGE_STORE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    slot_count = store_partition->size / IMAGE_STORE_SLOT_SIZE;
+    if (slot_count > IMAGE_STORE_MAX_SLOTS) {
+        slot_count = IMAGE_STORE_MAX_SLOTS;
+    }
+    ESP_LOGI(TAG, "Image cache at 0x%08" PRIx32 ": %d slots of %d bytes",
+             store_partition->address, slot_count, IMAGE_STORE_SLOT_SIZE);
+    return slot_count > 0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+size_t image_store_capacity(void) {
+    return IMAGE_STORE_SLOT_SIZE - IMAGE_STORE_HEADER_SIZE;
+}
+
+static esp_err_t compute_sha256(const uint8_t *image, size_t image_size, uint8_t *sha256) {
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    int ret = mbedtls_sha256_starts(&ctx, 0);
+    if (ret == 0) {
+        ret = mbedtls_sha256_update(&ctx, image, image_size);
+    }
+    if (ret == 0) {
+        ret = mbedtls_sha256_finish(&ctx, sha256);
+    }
+    mbedtls_sha256_free(&ctx);
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+// Reads the header of a slot; fails unless it holds a complete image for this target family
+static esp_err_t read_header(int slot, image_store_header_t *header) {
+    esp_err_t err = esp_partition_read(store_partition, slot_offset(slot), header, sizeof(*header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (header->magic != IMAGE_STORE_MAGIC || header->version != IMAGE_STORE_VERSION ||
+        header->image_size == 0 || header->image_size > image_store_capacity() ||
+        strncmp(header->target_family, CONFIG_STM32_TARGET_FAMILY, sizeof(header->target_family)) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t write_header(int slot, const image_store_header_t *header) {
+    esp_err_t err = esp_partition_erase_range(store_partition, slot_offset(slot), IMAGE_STORE_HEADER_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(store_partition, slot_offset(slot), header, sizeof(*header));
+    }
+    return err;
+}
+
+static uint32_t next_sequence(void) {
+    image_store_header_t header;
+    uint32_t sequence = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        if (read_header(slot, &header) == ESP_OK && header.sequence > sequence) {
+            sequence = header.sequence;
+        }
+    }
+    return sequence + 1;
+}
+
+int image_store_find_by_url(const char *url, image_store_header_t *header) {
+    image_store_header_t candidate;
+    int found = -1;
+    uint32_t found_sequence = 0;
+
+    for (int slot = 0; store_partition && slot < slot_count; slot++) {
+        if (read_header(slot, &candidate) == ESP_OK &&
+            strncmp(candidate.url, url, sizeof(candidate.url)) == 0 &&
+            (found < 0 || candidate.sequence > found_sequence)) {
+            found = slot;
+            found_sequence = candidate.sequence;
+            if (header) {
+                *header = candidate;
+            }
+        }
+    }
+    return found;
+}
+
+int image_store_find_by_sha256(const uint8_t *sha256, image_store_header_t *header) {
+    image_store_header_t candidate;
+
+    for (int slot = 0; store_partition && slot < slot_count; slot++) {
+        if (read_header(slot, &candidate) == ESP_OK &&
+            memcmp(candidate.sha256, sha256, sizeof(candidate.sha256)) == 0) {
+            if (header) {
+                *header = candidate;
+            }
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Marks a slot as most recently used so it is evicted last
+esp_err_t image_store_touch(int slot) {
+    image_store_header_t header;
+    esp_err_t err = read_header(slot, &header);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t sequence = next_sequence();
+    if (header.sequence + 1 == sequence) {
+        return ESP_OK;
+    }
+    header.sequence = sequence;
+    return write_header(slot, &header);
+}
+
+// Picks an empty slot, or the least recently used one
+static int pick_victim_slot(void) {
+    image_store_header_t header;
+    int victim = 0;
+    uint32_t victim_sequence = UINT32_MAX;
+
+    for (int slot = 0; slot < slot_count; slot++) {
+        if (read_header(slot, &header) != ESP_OK) {
+            return slot;
+        }
+        if (header.sequence < victim_sequence) {
+            victim = slot;
+            victim_sequence = header.sequence;
+        }
+    }
+    return victim;
+}
+
+// Invalidates a slot and erases room for a new image in it
+esp_err_t image_store_begin(size_t image_size, int *slot) {
+    if (!store_partition) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (image_size == 0 || image_size > image_store_capacity()) {
+        ESP_LOGE(TAG, "Image of %zu bytes does not fit (capacity %zu)", image_size, image_store_capacity());
+        return ESP_ERR_INVALID_SIZE;
+    }
+    image_store_close();
+
+    pending_slot = pick_victim_slot();
+    size_t erase_len = IMAGE_STORE_HEADER_SIZE + image_size;
+    erase_len = (erase_len + store_partition->erase_size - 1) & ~(store_partition->erase_size - 1);
+
+    esp_err_t err = esp_partition_erase_range(store_partition, slot_offset(pending_slot), erase_len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erase failed: %s", esp_err_to_name(err));
+        pending_slot = -1;
+        return err;
+    }
+    ESP_LOGI(TAG, "Caching new image in slot %d", pending_slot);
+    pending_image_size = image_size;
+    *slot = pending_slot;
+    return ESP_OK;
+}
+
+// Continues writing a slot that image_store_begin() erased before an interruption
+esp_err_t image_store_resume(int slot, size_t image_size) {
+    image_store_header_t header;
+    if (!store_partition) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (slot < 0 || slot >= slot_count || image_size == 0 || image_size > image_store_capacity() ||
+        read_header(slot, &header) == ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    image_store_close();
+    pending_slot = slot;
+    pending_image_size = image_size;
+    return ESP_OK;
+}
+
+esp_err_t image_store_write(size_t offset, const void *data, size_t len) {
+    if (pending_slot < 0 || offset + len > pending_image_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_partition_write(store_partition, slot_offset(pending_slot) + IMAGE_STORE_HEADER_SIZE + offset, data, len);
+}
+
+// Hashes the written image and commits the header that makes the slot valid
+esp_err_t image_store_finish(const char *url, const char *etag, const char *last_modified) {
+    if (pending_slot < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    image_store_header_t header = {
+        .magic = IMAGE_STORE_MAGIC,
+        .version = IMAGE_STORE_VERSION,
+        .image_size = pending_image_size,
+        .sequence = next_sequence(),
+    };
+    strncpy(header.target_family, CONFIG_STM32_TARGET_FAMILY, sizeof(header.target_family) - 1);
+    strncpy(header.url, url, sizeof(header.url) - 1);
+    strncpy(header.etag, etag, sizeof(header.etag) - 1);
+    strncpy(header.last_modified, last_modified, sizeof(header.last_modified) - 1);
+
+    const void *image;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(store_partition, slot_offset(pending_slot) + IMAGE_STORE_HEADER_SIZE,
+                                       pending_image_size, ESP_PARTITION_MMAP_DATA, &image, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = compute_sha256(image, pending_image_size, header.sha256);
+    esp_partition_munmap(handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Keep one copy per content: an older slot with the same bytes is dropped
+    image_store_header_t other;
+    for (int slot = 0; slot < slot_count; slot++) {
+        if (slot != pending_slot && read_header(slot, &other) == ESP_OK &&
+            memcmp(other.sha256, header.sha256, sizeof(header.sha256)) == 0) {
+            ESP_LOGI(TAG, "Slot %d held the same image, releasing it", slot);
+            esp_partition_erase_range(store_partition, slot_offset(slot), IMAGE_STORE_HEADER_SIZE);
+        }
+    }
+
+    err = esp_partition_write(store_partition, slot_offset(pending_slot), &header, sizeof(header));
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Cached %" PRIu32 " byte image for %s in slot %d",
+                 header.image_size, header.target_family, pending_slot);
+    }
+    pending_slot = -1;
+    return err;
+}
+
+// Maps a cached image into the data address space; no copy is made
+esp_err_t image_store_open(int slot, const uint8_t **image, size_t *image_size) {
+    image_store_header_t header;
+    if (slot < 0 || slot >= slot_count || read_header(slot, &header) != ESP_OK) {
+        ESP_LOGE(TAG, "No cached image in slot %d", slot);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    image_store_close();
+    const void *ptr;
+    esp_err_t err = esp_partition_mmap(store_partition, slot_offset(slot) + IMAGE_STORE_HEADER_SIZE,
+                                       header.image_size, ESP_PARTITION_MMAP_DATA, &ptr, &store_mmap_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mmap failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    store_mapped = true;
+
+    uint8_t sha256[32];
+    if (compute_sha256(ptr, header.image_size, sha256) != ESP_OK ||
+        memcmp(sha256, header.sha256, sizeof(sha256)) != 0) {
+        ESP_LOGE(TAG, "Cached image SHA-256 mismatch in slot %d", slot);
+        image_store_close();
+        esp_partition_erase_range(store_partition, slot_offset(slot), IMAGE_STORE_HEADER_SIZE);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *image = ptr;
+    *image_size = header.image_size;
+    return ESP_OK;
+}
+
+void image_store_close(void) {
+    if (store_mapped) {
+        esp_partition_munmap(store_mmap_handle);
+        store_mapped = false;
+    }
+}
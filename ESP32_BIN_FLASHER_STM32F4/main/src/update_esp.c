@@ -8,6 +8,8 @@ extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
 
 #define OTA_URL_SIZE 256
 
+static volatile bool ota_cancel_requested = false;
+
 esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
     switch (evt->event_id) {
@@ -39,29 +41,87 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-void ota_task(char *ota_firmware_url)
+// Streams the image into the next OTA partition, reporting progress and honouring cancellation
+static esp_err_t ota_download(const char *url)
 {
-    ESP_LOGI(OTA_TAG, "Starting OTA task");
-    send_mqtt_status("Starting","ESP32 ota updated started");
     esp_http_client_config_t config = {
-        .url = ota_firmware_url,
+        .url = url,
         .cert_pem = (char *)server_cert_pem_start,
         .event_handler = _http_event_handler,
+        .buffer_size = OTA_HTTP_BUFFER_SIZE,
+        .buffer_size_tx = OTA_HTTP_BUFFER_SIZE_TX,
+        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
         .keep_alive_enable = true,
     };
 
     esp_https_ota_config_t ota_config = {
         .http_config = &config,
+        .partial_http_download = true,
+        .max_http_request_size = OTA_HTTP_REQUEST_SIZE,
     };
-    ESP_LOGI(OTA_TAG, "Attempting to download update from %s", config.url);
+
+    esp_https_ota_handle_t handle = NULL;
+    esp_err_t err = esp_https_ota_begin(&ota_config, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "OTA begin failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    esp_app_desc_t new_app;
+    if (esp_https_ota_get_img_desc(handle, &new_app) == ESP_OK) {
+        ESP_LOGI(OTA_TAG, "New firmware version: %s", new_app.version);
+    }
+
+    int image_size = esp_https_ota_get_image_size(handle);
+    int next_report = OTA_PROGRESS_STEP;
+    while ((err = esp_https_ota_perform(handle)) == ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+        if (ota_cancel_requested) {
+            break;
+        }
+        if (image_size > 0) {
+            int percent = (int)((int64_t)esp_https_ota_get_image_len_read(handle) * 100 / image_size);
+            if (percent >= next_report) {
+                char message[48];
+                snprintf(message, sizeof(message), "downloading firmware file %d%%", percent);
+                send_mqtt_status("downloading", message);
+                next_report = percent - percent % OTA_PROGRESS_STEP + OTA_PROGRESS_STEP;
+            }
+        }
+    }
+
+    if (ota_cancel_requested) {
+        ESP_LOGW(OTA_TAG, "OTA cancelled");
+        esp_https_ota_abort(handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (err == ESP_OK && !esp_https_ota_is_complete_data_received(handle)) {
+        ESP_LOGE(OTA_TAG, "Complete data was not received");
+        err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        esp_https_ota_abort(handle);
+        return err;
+    }
+    return esp_https_ota_finish(handle);
+}
+
+static void ota_task(const char *ota_firmware_url)
+{
+    ESP_LOGI(OTA_TAG, "Starting OTA task");
+    send_mqtt_status("Starting","ESP32 ota updated started");
+    ESP_LOGI(OTA_TAG, "Attempting to download update from %s", ota_firmware_url);
     send_mqtt_status("downloading", "downloading firmware file");
-    esp_err_t ret = esp_https_ota(&ota_config);
+
+    ota_cancel_requested = false;
+    esp_err_t ret = ota_download(ota_firmware_url);
     if (ret == ESP_OK) {
         send_mqtt_status("Success", "ESP32 OTA update completed");
         vTaskDelay(5000 / portTICK_PERIOD_MS);
 
         ESP_LOGI(OTA_TAG, "OTA Succeed, Rebooting...");
         esp_restart();
+    } else if (ota_cancel_requested) {
+        send_mqtt_status("Cancelled", "ESP32 OTA update cancelled");
     } else {
         send_mqtt_status("Failed", "ESP32 OTA update failed");
         ESP_LOGE(OTA_TAG, "Firmware upgrade failed");
@@ -91,8 +151,27 @@ static void get_sha256_of_partitions(void)
     print_sha256(sha_256, "SHA-256 for current firmware: ");
 }
 
-void ota_init(char *ota_firmware_url)
+static void esp_update_task(void *pvParameters)
+{
+    update_job_t job;
+
+    update_jobs_set_worker(UPDATE_JOB_ESP32_OTA, xTaskGetCurrentTaskHandle());
+    while (1) {
+        while (update_jobs_take(UPDATE_JOB_ESP32_OTA, &job)) {
+            get_sha256_of_partitions();
+            ota_task(job.url);
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+void ota_init(void)
 {
-    get_sha256_of_partitions();
-    ota_task(ota_firmware_url);
-}
\ No newline at end of file
+    xTaskCreatePinnedToCore(esp_update_task, "esp_update", OTA_TASK_STACK_SIZE, NULL, 4, NULL, 1);
+}
+
+// Stops a running ESP32 OTA at the next chunk; the partially written partition is discarded
+void ota_cancel(void)
+{
+    ota_cancel_requested = true;
+}
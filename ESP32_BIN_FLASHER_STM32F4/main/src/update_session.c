@@ -0,0 +1,115 @@
+#include "update_session.h"
+
+static const char *TAG = "UPDATE_SESSION";
+
+void update_session_begin(update_session_t *session, const update_job_t *job, uint32_t image_size, uint32_t image_crc) {
+    memset(session, 0, sizeof(*session));
+    session->version = UPDATE_SESSION_VERSION;
+    strncpy(session->url, job->url, sizeof(session->url) - 1);
+    session->image_size = image_size;
+    session->image_crc = image_crc;
+    session->base_address = FLASH_BASE_ADDRESS;
+    strncpy(session->target, job->target, sizeof(session->target) - 1);
+    memcpy(session->sha256, job->sha256, sizeof(session->sha256));
+    session->sha256_set = job->sha256_set;
+    memcpy(session->signature, job->signature, sizeof(session->signature));
+    session->signature_set = job->signature_set;
+}
+
+// Rebuilds the job of an interrupted update, as it was first submitted
+void update_session_to_job(const update_session_t *session, update_job_t *job) {
+    memset(job, 0, sizeof(*job));
+    job->type = UPDATE_JOB_STM32_IMAGE;
+    job->priority = UPDATE_JOB_PRIORITY_HIGH;
+    strncpy(job->url, session->url, sizeof(job->url) - 1);
+    strncpy(job->target, session->target, sizeof(job->target) - 1);
+    memcpy(job->sha256, session->sha256, sizeof(job->sha256));
+    job->sha256_set = session->sha256_set;
+    memcpy(job->signature, session->signature, sizeof(job->signature));
+    job->signature_set = session->signature_set;
+}
+
+esp_err_t update_session_load(update_session_t *session) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(UPDATE_SESSION_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t len = sizeof(*session);
+    err = nvs_get_blob(handle, UPDATE_SESSION_KEY, session, &len);
+    if (err == ESP_OK && nvs_get_u32(handle, UPDATE_SESSION_OFFSET_KEY, &session->acked_offset) != ESP_OK) {
+        session->acked_offset = 0;
+    }
+    nvs_close(handle);
+
+    if (err == ESP_OK && (len != sizeof(*session) || session->version != UPDATE_SESSION_VERSION ||
+                          session->acked_offset > session->image_size)) {
+        ESP_LOGW(TAG, "Discarding incompatible update session");
+        update_session_clear();
+        return ESP_ERR_NOT_FOUND;
+    }
+    return err;
+}
+
+esp_err_t update_session_save(const update_session_t *session) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(UPDATE_SESSION_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(handle, UPDATE_SESSION_KEY, session, sizeof(*session));
+    if (err == ESP_OK) {
+        err = nvs_set_u32(handle, UPDATE_SESSION_OFFSET_KEY, session->acked_offset);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save update session: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+// Only the offset changes while writing, so avoid rewriting the whole blob
+esp_err_t update_session_save_progress(const update_session_t *session) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(UPDATE_SESSION_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_set_u32(handle, UPDATE_SESSION_OFFSET_KEY, session->acked_offset);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    ESP_LOGD(TAG, "Session progress: %" PRIu32 "/%" PRIu32, session->acked_offset, session->image_size);
+    return err;
+}
+
+esp_err_t update_session_clear(void) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(UPDATE_SESSION_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_erase_all(handle);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+bool update_session_matches(const update_session_t *session, const char *url, uint32_t image_size, uint32_t image_crc) {
+    return strncmp(session->url, url, sizeof(session->url)) == 0 &&
+           session->image_size == image_size &&
+           session->image_crc == image_crc;
+}
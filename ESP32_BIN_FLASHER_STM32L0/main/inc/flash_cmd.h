@@ -5,13 +5,68 @@
 #include "http.h"
 #include "crc32.h"
 #include "uart_config.h"
+#include "update_session.h"
+
+// Target description from BL_GET_CAPS, or the compile time defaults
+typedef struct {
+    uint8_t protocol_version;           // 0 when the bootloader predates BL_GET_CAPS
+    uint8_t flags;
+    uint8_t flags2;                     // BL_CAP2_*, 0 when not reported
+    uint8_t max_payload;
+    uint8_t write_align;                // Write chunks are kept a multiple of this
+    uint32_t app_base;
+    uint32_t flash_base;
+    uint32_t flash_size;
+    uint8_t uid[12];
+    uint8_t region_count;
+    struct {
+        uint16_t count;
+        uint8_t size_log2;
+    } regions[BL_CAPS_MAX_REGIONS];     // Erase units from flash_base upwards
+} bl_target_caps_t;
+
+// BL_ERASE_STATUS reply while the target erases in the background
+typedef struct {
+    bool busy;
+    uint8_t done;                       // Erase units finished so far
+    uint8_t remaining;
+    uint8_t status;                     // Flash_HAL_* of the erase job
+} bl_erase_status_t;
+
+// Leads an encrypted image file, the ciphertext follows with the same size as the plaintext
+typedef struct {
+    uint32_t magic;                     // BL_CIPHER_IMAGE_MAGIC
+    uint32_t cipher;                    // BL_CIPHER_CHACHA20
+    uint8_t nonce[12];                  // Unique per image, the key only lives in the bootloader
+    uint32_t image_size;
+    uint32_t image_crc;                 // get_crc() over the plaintext, for the boot record
+    uint32_t reserved;
+} bl_cipher_header_t;
+
+// BL_BATCH frame under construction: len | cmd | count | {op | args len | args}...
+typedef struct {
+    uint8_t frame[BL_FRAME_MAX_LEN];
+    size_t len;
+    uint8_t count;
+} bl_batch_t;
 
 esp_err_t send_sync_command(void);
 esp_err_t send_get_cid_command(void);
+esp_err_t send_get_caps_command(bl_target_caps_t *caps);
 esp_err_t send_flash_erase_command(uint8_t sector, uint8_t num_sectors);
-esp_err_t send_mem_write_command(uint32_t base_address, uint8_t *data, uint8_t length);
+esp_err_t send_page_erase_command(uint8_t first_page, uint16_t num_pages);
+esp_err_t send_erase_range_command(uint32_t base_address, uint32_t length);
+esp_err_t send_erase_status_command(bl_erase_status_t *status);
+esp_err_t send_mem_write_command(uint32_t base_address, const uint8_t *data, uint8_t length);
+esp_err_t send_verify_command(uint32_t base_address, uint32_t length, uint32_t *crc);
+esp_err_t send_cipher_start_command(uint8_t cipher, const uint8_t *nonce);
+esp_err_t send_get_stats_command(uint8_t selector);
 esp_err_t send_go_reset();
-esp_err_t flash_downloaded_firmware(void);
+void batch_init(bl_batch_t *batch);
+esp_err_t batch_add(bl_batch_t *batch, uint8_t op, const uint8_t *args, uint8_t args_len);
+esp_err_t send_batch_command(bl_batch_t *batch, uint8_t *failed_index);
+esp_err_t flash_downloaded_firmware(const uint8_t *image, size_t image_size, const uint8_t *signature,
+                                    update_session_t *session);
 
 
 #endif
\ No newline at end of file
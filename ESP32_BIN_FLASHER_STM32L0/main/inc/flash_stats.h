@@ -0,0 +1,41 @@
+#ifndef FLASH_STATS_H
+#define FLASH_STATS_H
+
+#include "ota_update.h"
+
+#define MQTT_STATS_PUBLISH              "onwords/ota/stats"
+#define FLASH_STATS_FIRST_COMMAND       0x50    // Commands are counted from BL_BOOT_CMD upwards
+#define FLASH_STATS_COMMAND_COUNT       (COMMAND_BL_LAST - FLASH_STATS_FIRST_COMMAND + 1)
+#define FLASH_STATS_BUCKETS             10
+
+// Where an STM32 update spends its time, each update moves through these in order
+typedef enum {
+    FLASH_PHASE_SYNC = 0,
+    FLASH_PHASE_IDENTIFY,               // BL_GET_CID, BL_GET_CAPS, BL_CIPHER_START
+    FLASH_PHASE_ERASE,                  // Erase, or confirming the resume point
+    FLASH_PHASE_WRITE,
+    FLASH_PHASE_ERASE_WAIT,             // Writes held back by a background erase
+    FLASH_PHASE_FINISH,                 // Verify, boot flag and reset
+    FLASH_PHASE_COUNT,
+} flash_phase_t;
+
+// Round trips of one command: frame out, ACK and reply back
+typedef struct {
+    uint32_t count;
+    uint32_t failures;
+    uint32_t retries;
+    int64_t wire_us;                    // Time spent writing frames to the UART
+    int64_t total_us;
+    int64_t min_us;
+    int64_t max_us;
+    uint32_t histogram[FLASH_STATS_BUCKETS];
+} flash_command_stats_t;
+
+void flash_stats_reset(void);
+void flash_stats_phase(flash_phase_t phase);
+void flash_stats_frame_sent(uint8_t command_code, int64_t start_us, int64_t end_us);
+void flash_stats_reply(uint8_t command_code, bool ok);
+void flash_stats_retry(uint8_t command_code);
+void flash_stats_publish(esp_err_t result, size_t image_size);
+
+#endif
@@ -23,14 +23,13 @@
 #include "cJSON.h"
 #include "esp_ota_ops.h"
 #include "esp_https_ota.h"
+#include "esp_timer.h"
 #include <sys/socket.h>
 
 
+// Used only when the bootloader does not answer BL_GET_CAPS
 #define FLASH_BASE_ADDRESS              0x08008000
 
-#define FLASH_ERASE_BASE_SECTOR         2
-#define FLASH_ERASE_SECTORS             3
-
 #define Flash_HAL_OK                    0x00
 #define Flash_HAL_ERROR                 0x01
 #define Flash_HAL_BUSY                  0x02
@@ -42,15 +41,86 @@
 #define COMMAND_BL_GO_TO_RESET          0x52
 #define COMMAND_BL_FLASH_ERASE          0x53
 #define COMMAND_BL_MEM_WRITE            0x54
+#define COMMAND_BL_VERIFY               0x55
+#define COMMAND_BL_GET_CAPS             0x56
+#define COMMAND_BL_ERASE_RANGE          0x57
+#define COMMAND_BL_ERASE_STATUS         0x58
+#define COMMAND_BL_BATCH                0x59
+#define COMMAND_BL_SET_BOOT_FLAG        0x5B    // Only valid inside a batch
+#define COMMAND_BL_CIPHER_START         0x5C
+#define COMMAND_BL_GET_STATS            0x5D
+#define COMMAND_BL_LAST                 COMMAND_BL_GET_STATS    // Raise with every new command
 
 // Command Lengths
 #define COMMAND_BL_GET_CID_LEN          6
 #define COMMAND_BL_GO_TO_RESET_LEN      6
 #define COMMAND_BL_FLASH_ERASE_LEN      8
+#define COMMAND_BL_PAGE_ERASE_LEN       9
 #define COMMAND_BL_MEM_WRITE_BASE_LEN   7 
+#define COMMAND_BL_VERIFY_LEN           14
+#define COMMAND_BL_GET_CAPS_LEN         6
+#define COMMAND_BL_ERASE_RANGE_LEN      14
+#define COMMAND_BL_ERASE_STATUS_LEN     6
+#define COMMAND_BL_CIPHER_START_LEN     19
+#define COMMAND_BL_GET_STATS_LEN        7
+
+// BL_GET_CAPS feature flags
+#define BL_CAP_VERIFY                   0x01
+#define BL_CAP_WORD_PROGRAM             0x02
+#define BL_CAP_PAGE_ERASE               0x04
+#define BL_CAP_COMPRESSION              0x08
+#define BL_CAP_WINDOWING                0x10
+#define BL_CAP_ERASE_RANGE              0x20
+#define BL_CAP_HALF_PAGE                0x40
+#define BL_CAP_ASYNC_ERASE              0x80
+#define BL_CAP2_BATCH                   0x01    // Second flags byte, after the region map
+#define BL_CAP2_SIGNATURE               0x02    // BL_SET_BOOT_FLAG takes an Ed25519 signature
+#define BL_CAP2_SIGNED_ONLY             0x04    // Unsigned images are refused
+#define BL_CAP2_ENCRYPTION              0x08    // BL_CIPHER_START, the target decrypts write payloads
+#define BL_CAP2_STATS                   0x10    // BL_GET_STATS cycle counters
+
+// BL_GET_STATS selector and reply
+#define BL_STATS_STAGES                 0x00
+#define BL_STATS_COMMANDS               0x01
+#define BL_STATS_ERASED                 0x02
+#define BL_STATS_CLEAR                  0x80
+#define BL_STATS_ENTRY_LEN              17
+
+// Encrypted image files: a bl_cipher_header_t, then the ciphertext relayed as is
+#define BL_CIPHER_IMAGE_MAGIC           0x31434C42  // "BLC1"
+#define BL_CIPHER_NONE                  0x00
+#define BL_CIPHER_CHACHA20              0x01
+
+#define BL_CAPS_MAX_REGIONS             4
+#define BL_FRAME_MAX_LEN                256     // The length byte counts everything after itself
+#define BL_BATCH_MAX_OPS                32
+#define BL_BATCH_NOT_RUN                0xFF
+#ifdef CONFIG_STM32_BATCH_FINAL
+#define BL_BATCH_FINAL                  1       // Close updates with one BL_BATCH round trip when the target can
+#else
+#define BL_BATCH_FINAL                  0
+#endif
+#ifdef CONFIG_STM32_RESULT_LOG
+#define BL_RESULT_LOG                   1       // One STM32_RESULT line per update
+#else
+#define BL_RESULT_LOG                   0
+#endif
+#define BL_WRITE_CHUNK_DEFAULT          128     // Chunk size for bootloaders without BL_GET_CAPS
+#define BL_REPLY_TIMEOUT_MS             3000
+#define BL_BATCH_TIMEOUT_MS             15000   // Covers hashing the image and the signature check
+#define BL_PAGE_ERASE_TIME_MS           4       // Worst case per 128 byte L0 page, sizes the erase reply wait
+#define BL_SECTOR_ERASE_TIME_MS         4000    // Worst case per F4 sector, bounds the background erase wait
+#define BL_ERASE_POLL_MS                50
 
 #define BL_ACK                          0xA5
 #define BL_NACK                         0x7F
 
+// Sync handshake: BOOT_CMD is probed until the bootloader answers BL_READY
+#define BL_BOOT_CMD                     0x50
+#define BL_READY                        0x5A
+#define BL_SYNC_PROBE_MIN_MS            10
+#define BL_SYNC_PROBE_MAX_MS            200
+#define BL_SYNC_TIMEOUT_MS              5000
+
 
 #endif
\ No newline at end of file
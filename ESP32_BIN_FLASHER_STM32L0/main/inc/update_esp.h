@@ -3,7 +3,16 @@
 
 #include "ota_update.h"
 #include "mqtt.h"
+#include "update_jobs.h"
 
-void ota_init(char *ota_firmware_url);
+#define OTA_TASK_STACK_SIZE             8192
+#define OTA_HTTP_BUFFER_SIZE            4096    // Receive buffer, bounds heap use of the download
+#define OTA_HTTP_BUFFER_SIZE_TX         1024
+#define OTA_HTTP_TIMEOUT_MS             10000
+#define OTA_HTTP_REQUEST_SIZE           16384   // Bytes fetched per ranged request
+#define OTA_PROGRESS_STEP               10      // Percent between progress reports
+
+void ota_init(void);
+void ota_cancel(void);
 
 #endif
\ No newline at end of file
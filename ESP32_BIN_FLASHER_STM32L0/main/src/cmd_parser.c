@@ -0,0 +1,182 @@
+#include "cmd_parser.h"
+
+// Parses MQTT command payloads in place. Nothing is allocated: strings are unescaped
+// straight into the caller's buffers and the payload needs no NUL terminator.
+
+static const char *skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+// p points at the opening quote. Copies the unescaped string into out when given,
+// returns the position after the closing quote or NULL if malformed or too long.
+static const char *parse_string(const char *p, const char *end, char *out, size_t out_size) {
+    size_t n = 0;
+
+    for (p++; p < end; p++) {
+        char c = *p;
+        if (c == '"') {
+            if (out) {
+                out[n] = '\0';
+            }
+            return p + 1;
+        }
+        if ((unsigned char)c < 0x20) {
+            return NULL;
+        }
+        if (c == '\\') {
+            if (++p >= end) {
+                return NULL;
+            }
+            switch (*p) {
+            case '"':  c = '"';  break;
+            case '\\': c = '\\'; break;
+            case '/':  c = '/';  break;
+            case 'b':  c = '\b'; break;
+            case 'f':  c = '\f'; break;
+            case 'n':  c = '\n'; break;
+            case 'r':  c = '\r'; break;
+            case 't':  c = '\t'; break;
+            default:   return NULL;    // \u escapes never appear in our commands
+            }
+        }
+        if (out) {
+            if (n + 1 >= out_size) {
+                return NULL;
+            }
+            out[n++] = c;
+        }
+    }
+    return NULL;
+}
+
+static const char *parse_int(const char *p, const char *end, int *out) {
+    bool negative = false;
+    int64_t v = 0;
+    const char *start;
+
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    for (start = p; p < end && *p >= '0' && *p <= '9'; p++) {
+        v = v * 10 + (*p - '0');
+        if (v > INT32_MAX) {
+            return NULL;
+        }
+    }
+    if (p == start || (p < end && (*p == '.' || *p == 'e' || *p == 'E'))) {
+        return NULL;
+    }
+    *out = (int)(negative ? -v : v);
+    return p;
+}
+
+// Skips any JSON value, including nested objects and arrays, up to the next delimiter
+static const char *skip_value(const char *p, const char *end) {
+    int depth = 0;
+
+    while (p < end) {
+        if (*p == '"') {
+            p = parse_string(p, end, NULL, 0);
+            if (!p) {
+                return NULL;
+            }
+        } else if (*p == '{' || *p == '[') {
+            if (++depth > CMD_PARSER_MAX_DEPTH) {
+                return NULL;
+            }
+            p++;
+        } else if (*p == '}' || *p == ']') {
+            if (depth == 0) {
+                return p;
+            }
+            depth--;
+            p++;
+        } else if (*p == ',' && depth == 0) {
+            return p;
+        } else {
+            p++;
+        }
+    }
+    return NULL;
+}
+
+static cmd_field_t *find_field(cmd_field_t *fields, size_t field_count, const char *key, size_t key_len) {
+    for (size_t i = 0; i < field_count; i++) {
+        if (strlen(fields[i].key) == key_len && memcmp(fields[i].key, key, key_len) == 0) {
+            return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t cmd_parse(const char *data, size_t len, cmd_field_t *fields, size_t field_count) {
+    const char *p = data;
+    const char *end = data + len;
+
+    for (size_t i = 0; i < field_count; i++) {
+        fields[i].found = false;
+    }
+
+    p = skip_ws(p, end);
+    if (p >= end || *p++ != '{') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    p = skip_ws(p, end);
+    if (p < end && *p == '}') {
+        return ESP_OK;
+    }
+
+    while (p < end) {
+        if (*p != '"') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        // Keys are matched on their raw bytes, ours never contain escapes
+        const char *key = p + 1;
+        p = parse_string(p, end, NULL, 0);
+        if (!p) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t key_len = (size_t)(p - 1 - key);
+
+        p = skip_ws(p, end);
+        if (p >= end || *p++ != ':') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p = skip_ws(p, end);
+        if (p >= end) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        cmd_field_t *field = find_field(fields, field_count, key, key_len);
+        if (field && field->type == CMD_FIELD_STRING && *p == '"') {
+            p = parse_string(p, end, field->value, field->value_size);
+            field->found = p != NULL;
+        } else if (field && field->type == CMD_FIELD_INT && (*p == '-' || (*p >= '0' && *p <= '9'))) {
+            p = parse_int(p, end, field->value);
+            field->found = p != NULL;
+        } else {
+            // Unknown member, or a known one of the wrong type which is ignored like cJSON did
+            p = skip_value(p, end);
+        }
+        if (!p) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        p = skip_ws(p, end);
+        if (p >= end) {
+            break;
+        }
+        if (*p == '}') {
+            return ESP_OK;
+        }
+        if (*p++ != ',') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p = skip_ws(p, end);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
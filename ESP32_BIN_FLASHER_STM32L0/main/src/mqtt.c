@@ -1,12 +1,74 @@
 #include "mqtt.h"
+#include "update_jobs.h"
 #include "update_esp.h"
+#include "cmd_parser.h"
 
 static const char *TAG = "MQTT_HANDLER";
 
 esp_mqtt_client_handle_t mqtt_client;
 bool mqtt_connected = false;
-extern bool firmware_update_requested;
-extern char firmware_url[256];
+
+// Optional "sha256" and "signature" fields: exactly len bytes as hex characters
+static bool parse_hex(const char *hex, uint8_t *out, size_t len) {
+    if (strlen(hex) != len * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned int byte;
+        if (sscanf(&hex[i * 2], "%2x", &byte) != 1) {
+            return false;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+// Queues the update described by a {"firmware_sts":1,"firmwareUrl":...} command,
+// firmware_sts 0 on the ESP32 topic cancels a running self-update
+static void handle_update_command(update_job_type_t type, const char *data, int data_len) {
+    update_job_t job = { .type = type };
+    int firmware_sts = 0;
+    int priority = 0;
+    char sha256[65];
+    char signature[129];
+    
+    cmd_field_t fields[] = {
+        { "firmware_sts", CMD_FIELD_INT,    &firmware_sts, sizeof(firmware_sts) },
+        { "firmwareUrl",  CMD_FIELD_STRING, job.url,       sizeof(job.url) },
+        { "sha256",       CMD_FIELD_STRING, sha256,        sizeof(sha256) },
+        { "target",       CMD_FIELD_STRING, job.target,    sizeof(job.target) },
+        { "priority",     CMD_FIELD_INT,    &priority,     sizeof(priority) },
+        { "signature",    CMD_FIELD_STRING, signature,     sizeof(signature) },
+    };
+    
+    if (cmd_parse(data, data_len, fields, sizeof(fields) / sizeof(fields[0])) != ESP_OK || !fields[0].found) {
+        ESP_LOGW(TAG, "Malformed update command");
+        return;
+    }
+    
+    if (firmware_sts == 1 && fields[1].found) {
+        if (priority > 0) {
+            job.priority = UPDATE_JOB_PRIORITY_HIGH;
+        }
+        job.sha256_set = fields[2].found && parse_hex(sha256, job.sha256, sizeof(job.sha256));
+        job.signature_set = fields[5].found && parse_hex(signature, job.signature, sizeof(job.signature));
+        if (fields[5].found && !job.signature_set) {
+            ESP_LOGW(TAG, "Malformed image signature");
+            send_mqtt_status("Failed", "Malformed image signature");
+            return;
+        }
+        
+        ESP_LOGI(TAG, "Firmware update requested: %s", job.url);
+        esp_err_t err = update_jobs_submit(&job);
+        if (err == ESP_ERR_INVALID_STATE) {
+            send_mqtt_status("Queued", "Identical update already pending");
+        } else if (err != ESP_OK) {
+            send_mqtt_status("Failed", "Update queue full");
+        }
+    } else if (firmware_sts == 0 && type == UPDATE_JOB_ESP32_OTA) {
+        ota_cancel();
+    }
+}
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     esp_mqtt_event_handle_t event = event_data;
@@ -39,43 +101,11 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         
         if(strncmp(MQTT_STM32_FIRMWARE, event->topic, event->topic_len) == 0 && strlen(MQTT_STM32_FIRMWARE) == event->topic_len)
         {
-            char *json_string = malloc(event->data_len + 1);
-            if (json_string) {
-                memcpy(json_string, event->data, event->data_len);
-                json_string[event->data_len] = '\0';
-                
-                cJSON *json = cJSON_Parse(json_string);
-                if (json) {
-                    cJSON *firmware_sts = cJSON_GetObjectItem(json, "firmware_sts");
-                    cJSON *firmwareUrl = cJSON_GetObjectItem(json, "firmwareUrl");
-                    
-                    if (cJSON_IsNumber(firmware_sts) && cJSON_IsString(firmwareUrl)) {
-                        if (firmware_sts->valueint == 1) {
-                            ESP_LOGI(TAG, "Firmware update requested: %s", firmwareUrl->valuestring);
-                            strncpy(firmware_url, firmwareUrl->valuestring, sizeof(firmware_url) - 1);
-                            firmware_update_requested = true;
-                        }
-                    }
-                    cJSON_Delete(json);
-                }
-                free(json_string);
-            }
+            handle_update_command(UPDATE_JOB_STM32_IMAGE, event->data, event->data_len);
         }
         else if (strncmp(MQTT_ESP32_FIRMWARE, event->topic, event->topic_len) == 0 && strlen(MQTT_ESP32_FIRMWARE) == event->topic_len)
         {
-            cJSON *json = cJSON_Parse(event->data);
-            if (cJSON_HasObjectItem(json,"firmwareUrl") && cJSON_HasObjectItem(json,"firmware_sts"))
-            {
-                ESP_LOGI(TAG, "Topic match success!");
-                cJSON *ota_url_json = cJSON_GetObjectItem(json, "firmwareUrl");
-                cJSON *ota_sts_json = cJSON_GetObjectItem(json, "firmware_sts");
-                char *ota_url = ota_url_json -> valuestring ;
-                int ota_sts = ota_sts_json -> valueint ;
-                if (ota_sts == 1)
-                {
-                    ota_init(ota_url);
-                }
-            }
+            handle_update_command(UPDATE_JOB_ESP32_OTA, event->data, event->data_len);
         }
         
         break;
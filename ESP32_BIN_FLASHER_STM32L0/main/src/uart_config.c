@@ -38,16 +38,20 @@ void uart_flush_rx_buffer(void) {
 }
 
 esp_err_t send_bootloader_packet(uint8_t *packet, size_t total_len) {
+    int64_t start = esp_timer_get_time();
+    
     uart_write_byte(packet[0]);
     vTaskDelay(pdMS_TO_TICKS(10));
     for (int i = 1; i < total_len; i++) {
         uart_write_byte(packet[i]);
         vTaskDelay(pdMS_TO_TICKS(2));
     } 
+    flash_stats_frame_sent(packet[1], start, esp_timer_get_time());
     return ESP_OK;
 }
 
-esp_err_t read_bootloader_reply(uint8_t command_code, uint8_t *response_data, size_t *response_len) {
+// timeout_ms bounds the wait for the data after the ACK, for commands that reply once the work is done
+static esp_err_t read_reply(uint8_t command_code, uint8_t *response_data, size_t *response_len, int timeout_ms) {
     uint8_t ack[2] = {0};
     
     // Read ACK + length (2 bytes)
@@ -62,7 +66,7 @@ esp_err_t read_bootloader_reply(uint8_t command_code, uint8_t *response_data, si
         ESP_LOGI(TAG, "CRC: SUCCESS Len: %" PRIu32, len_to_follow);
         
         if (len_to_follow > 0 && response_data && response_len) {
-            int data_read = uart_read_bytes_timeout(response_data, len_to_follow, 3000);
+            int data_read = uart_read_bytes_timeout(response_data, len_to_follow, timeout_ms);
             if (data_read == (int)len_to_follow) {
                 *response_len = len_to_follow;
                 return ESP_OK;
@@ -79,4 +83,15 @@ esp_err_t read_bootloader_reply(uint8_t command_code, uint8_t *response_data, si
         ESP_LOGE(TAG, "Unexpected response: 0x%02x", ack[0]);
         return ESP_FAIL;
     }
+}
+
+esp_err_t read_bootloader_reply(uint8_t command_code, uint8_t *response_data, size_t *response_len) {
+    return read_bootloader_reply_timeout(command_code, response_data, response_len, BL_REPLY_TIMEOUT_MS);
+}
+
+// Every reply closes the round trip of the frame sent before it
+esp_err_t read_bootloader_reply_timeout(uint8_t command_code, uint8_t *response_data, size_t *response_len, int timeout_ms) {
+    esp_err_t err = read_reply(command_code, response_data, response_len, timeout_ms);
+    flash_stats_reply(command_code, err == ESP_OK);
+    return err;
 }
\ No newline at end of file
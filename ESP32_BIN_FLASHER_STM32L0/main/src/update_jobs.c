@@ -0,0 +1,92 @@
+#include "update_jobs.h"
+
+static const char *TAG = "UPDATE_JOBS";
+
+// Jobs live in a fixed pool; the queues only carry pool indices, one queue per type and priority
+static update_job_t job_pool[UPDATE_JOB_POOL_SIZE];
+static bool job_pending[UPDATE_JOB_POOL_SIZE];
+static SemaphoreHandle_t job_lock;
+static QueueHandle_t job_queue[UPDATE_JOB_TYPE_COUNT][UPDATE_JOB_PRIORITY_COUNT];
+static TaskHandle_t job_worker[UPDATE_JOB_TYPE_COUNT];
+
+static bool update_job_equal(const update_job_t *a, const update_job_t *b) {
+    return a->type == b->type &&
+           a->sha256_set == b->sha256_set &&
+           (!a->sha256_set || memcmp(a->sha256, b->sha256, sizeof(a->sha256)) == 0) &&
+           a->signature_set == b->signature_set &&
+           (!a->signature_set || memcmp(a->signature, b->signature, sizeof(a->signature)) == 0) &&
+           strncmp(a->target, b->target, sizeof(a->target)) == 0 &&
+           strncmp(a->url, b->url, sizeof(a->url)) == 0;
+}
+
+esp_err_t update_jobs_init(void) {
+    job_lock = xSemaphoreCreateMutex();
+    for (int type = 0; type < UPDATE_JOB_TYPE_COUNT; type++) {
+        for (int priority = 0; priority < UPDATE_JOB_PRIORITY_COUNT; priority++) {
+            job_queue[type][priority] = xQueueCreate(UPDATE_JOB_POOL_SIZE, sizeof(uint8_t));
+            if (job_queue[type][priority] == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    return job_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Each job type is drained by its own task, so an ESP32 OTA never waits behind an STM32 flash
+void update_jobs_set_worker(update_job_type_t type, TaskHandle_t worker) {
+    job_worker[type] = worker;
+}
+
+esp_err_t update_jobs_submit(const update_job_t *job) {
+    esp_err_t err = ESP_ERR_NO_MEM;
+    int free_index = -1;
+
+    if (job->type >= UPDATE_JOB_TYPE_COUNT || job->priority >= UPDATE_JOB_PRIORITY_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(job_lock, portMAX_DELAY);
+    for (int i = 0; i < UPDATE_JOB_POOL_SIZE; i++) {
+        if (!job_pending[i]) {
+            if (free_index < 0) {
+                free_index = i;
+            }
+        } else if (update_job_equal(&job_pool[i], job)) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+    }
+    if (err != ESP_ERR_INVALID_STATE && free_index >= 0) {
+        uint8_t index = (uint8_t)free_index;
+        job_pool[index] = *job;
+        job_pending[index] = true;
+        xQueueSend(job_queue[job->type][job->priority], &index, 0);
+        err = ESP_OK;
+    }
+    xSemaphoreGive(job_lock);
+
+    if (err == ESP_ERR_INVALID_STATE) {
+        ESP_LOGW(TAG, "Identical job already pending: %s", job->url);
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Job queue full, dropping: %s", job->url);
+    } else if (job_worker[job->type]) {
+        xTaskNotifyGive(job_worker[job->type]);
+    }
+    return err;
+}
+
+// Returns the oldest job of the given type with the highest priority, without blocking
+bool update_jobs_take(update_job_type_t type, update_job_t *job) {
+    uint8_t index;
+
+    for (int priority = UPDATE_JOB_PRIORITY_COUNT - 1; priority >= 0; priority--) {
+        if (xQueueReceive(job_queue[type][priority], &index, 0) == pdTRUE) {
+            xSemaphoreTake(job_lock, portMAX_DELAY);
+            *job = job_pool[index];
+            job_pending[index] = false;
+            xSemaphoreGive(job_lock);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+"""Update link benchmark: the ESP32 flasher against each bootloader port, on the host.
+
+Builds of the real flasher and bootloader sources (see Makefile) talk over a
+pty with the line timing of the UART emulated, and each run's STM32_RESULT and
+FLASH_STATS lines are collected into a JSON baseline.
+
+    ./bench.py                          sweep the default matrix, print a table
+    ./bench.py --out baselines/x.json   ... and write it as a baseline
+    ./bench.py --check baselines/x.json rerun a baseline's points, exit 1 on a regression
+
+Axes: board, image, baud, write chunk, window depth, compression and whether
+the update closes with one batch (CONFIG_STM32_BATCH_FINAL). The
+protocol has no windowing or compression yet (BL_CAP_WINDOWING and
+BL_CAP_COMPRESSION are reserved), those points are recorded as unsupported
+so a baseline taken today lines up with one taken once they exist.
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import subprocess
+import sys
+import tty
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(HERE))
+BUILD = os.path.join(HERE, "build")
+
+BOARDS = {
+    "f401": "BOOTLOADER_F401RET6",
+    "f446": "BOOTLOADER_V2_F446RE",
+    "l073": "BOOTLOADER_L073RZT6",
+}
+
+# The flasher project each board is driven by, as the Makefile builds it
+FLASHERS = {
+    "f401": "flasher_host",
+    "f446": "flasher_host",
+    "l073": "flasher_host_l0",
+}
+
+SCHEMA = 2
+AXES = ("board", "image", "baud", "chunk", "window", "compression", "batch_final")
+# Above this the host's own overhead per byte shows, emulated time is slowed down to keep it small
+FULL_SPEED_BAUD = 230400
+RUN_TIMEOUT_S = 900
+
+RESULT_RE = re.compile(r"STM32_RESULT (\{.*\})")
+STATS_RE = re.compile(r"FLASH_STATS: (\{.*\})")
+
+
+def csv(kind):
+    return lambda text: [kind(x) for x in text.split(",") if x]
+
+
+def elf_image(path):
+    """The bytes an ELF puts in flash, from its PT_LOAD file contents by load address"""
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        raise ValueError("%s: not a 32-bit ELF" % path)
+    phoff, = struct.unpack_from("<I", elf, 28)
+    phentsize, phnum = struct.unpack_from("<HH", elf, 42)
+    segments = []
+    for i in range(phnum):
+        p_type, p_offset, _, p_paddr, p_filesz = struct.unpack_from("<IIIII", elf, phoff + i * phentsize)
+        if p_type == 1 and p_filesz > 0:
+            segments.append((p_paddr, elf[p_offset:p_offset + p_filesz]))
+    segments.sort()
+    base = segments[0][0]
+    image = bytearray(b"\xff" * (segments[-1][0] + len(segments[-1][1]) - base))
+    for addr, data in segments:
+        image[addr - base:addr - base + len(data)] = data
+    return bytes(image)
+
+
+def load_corpus(paths, boards):
+    """name -> image. Without --corpus every board flashes the code of its own Debug build."""
+    corpus = {}
+    if not paths:
+        for board in boards:
+            project = BOARDS[board]
+            corpus[board + "-debug"] = elf_image(os.path.join(ROOT, project, "Debug", project + ".elf"))
+        return corpus
+    for path in paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        if path.endswith(".elf"):
+            corpus[name] = elf_image(path)
+        else:
+            with open(path, "rb") as f:
+                corpus[name] = f.read()
+    return corpus
+
+
+def images_for(board, corpus, explicit):
+    if explicit:
+        return sorted(corpus)
+    return [board + "-debug"]
+
+
+def speed_for(baud):
+    return min(1.0, FULL_SPEED_BAUD / baud)
+
+
+def run_point(board, image_path, image_len, baud, chunk, batch_final, seed):
+    """One update over a fresh pty, returns the flasher's result and stats lines"""
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    speed = speed_for(baud)
+    target = subprocess.Popen(
+        [os.path.join(BUILD, "bl_host_" + board), "--link", "fd:%d" % slave, "--baud", str(baud),
+         "--speed", str(speed), "--old-size", str(image_len), "--seed", str(seed)],
+        pass_fds=[slave], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    flasher_bin = FLASHERS[board] + ("" if batch_final == "on" else "_nobatch")
+    flasher = subprocess.Popen(
+        [os.path.join(BUILD, flasher_bin), "--link", "fd:%d" % master, "--image", image_path,
+         "--baud", str(baud), "--chunk", str(chunk), "--speed", str(speed)],
+        pass_fds=[master], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    os.close(master)
+    os.close(slave)
+    try:
+        out, _ = flasher.communicate(timeout=RUN_TIMEOUT_S)
+    except subprocess.TimeoutExpired:
+        flasher.kill()
+        out, _ = flasher.communicate()
+    try:
+        _, target_log = target.communicate(timeout=10)
+    except subprocess.TimeoutExpired:
+        target.kill()
+        _, target_log = target.communicate()
+
+    result = RESULT_RE.search(out)
+    stats = STATS_RE.search(out)
+    point = {"status": "ok" if flasher.returncode == 0 and target.returncode == 0 else "failed"}
+    if result:
+        result = json.loads(result.group(1))
+        point.update(ms=result["ms"], bytes_per_s=result["bytes_per_s"], chunk_used=result["chunk"],
+                     batch=bool(result["batch"]))
+    if stats:
+        stats = json.loads(stats.group(1))
+        point["phases_ms"] = stats["phases_ms"]
+        point["commands"] = {code: {k: c[k] for k in ("n", "fail", "retry", "wire_ms", "avg_us", "max_us")}
+                             for code, c in stats["commands"].items()}
+    if point["status"] != "ok":
+        point["log"] = (out + target_log)[-2000:]
+    return point
+
+
+def key(point):
+    return tuple(point[k] for k in AXES)
+
+
+def sweep(args, corpus, image_files, points=None):
+    if points is None:
+        points = [{"board": b, "image": img, "baud": baud, "chunk": chunk, "window": window, "compression": comp,
+                   "batch_final": final}
+                  for b in args.boards for img in images_for(b, corpus, bool(args.corpus))
+                  for baud in args.bauds for chunk in args.chunks
+                  for window in args.windows for comp in args.compression for final in args.batch_final]
+    results = []
+    for i, axes in enumerate(points):
+        point = dict((k, axes[k]) for k in AXES)
+        if point["window"] > 1 or point["compression"] != "off":
+            point["status"] = "unsupported"
+            point["reason"] = "no windowing or compression in the protocol yet"
+        else:
+            point.update(run_point(point["board"], image_files[point["image"]], len(corpus[point["image"]]),
+                                   point["baud"], point["chunk"], point["batch_final"], args.seed))
+        results.append(point)
+        if point["status"] != "unsupported":
+            print("[%d/%d] %-5s %-12s %7d baud chunk %3d batch %-3s: %-6s %6s ms %6s B/s" % (
+                i + 1, len(points), point["board"], point["image"], point["baud"], point["chunk"], point["batch_final"],
+                point["status"], point.get("ms", "-"), point.get("bytes_per_s", "-")), flush=True)
+    return results
+
+
+def check(baseline, results, tolerance):
+    """Regressions against a baseline: a point that stopped working or got slower than tolerance allows"""
+    before = {key(p): p for p in baseline["results"]}
+    failures = 0
+    for point in results:
+        old = before.get(key(point))
+        if not old or old["status"] != "ok":
+            continue
+        if point["status"] != "ok":
+            print("REGRESSION %s: %s" % (key(point), point["status"]))
+            failures += 1
+        elif point["ms"] > old["ms"] * (1 + tolerance):
+            print("REGRESSION %s: %d ms, baseline %d ms" % (key(point), point["ms"], old["ms"]))
+            failures += 1
+        elif point["ms"] < old["ms"] * (1 - tolerance):
+            print("faster     %s: %d ms, baseline %d ms" % (key(point), point["ms"], old["ms"]))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--boards", type=csv(str), default=list(BOARDS))
+    parser.add_argument("--bauds", type=csv(int), default=[115200, 230400, 460800, 921600])
+    parser.add_argument("--chunks", type=csv(int), default=[64, 128, 0],
+                        help="write chunk limit, 0 for the largest the target takes")
+    parser.add_argument("--windows", type=csv(int), default=[1, 2, 4], help="frames in flight")
+    parser.add_argument("--compression", type=csv(str), default=["off", "on"])
+    parser.add_argument("--batch-final", type=csv(str), default=["on", "off"],
+                        help="close with one BL_BATCH round trip (CONFIG_STM32_BATCH_FINAL)")
+    parser.add_argument("--corpus", nargs="*", default=[], help=".bin or .elf images, default each board's Debug build")
+    parser.add_argument("--seed", type=int, default=1, help="old flash contents of the target")
+    parser.add_argument("--out", help="write the results as a baseline")
+    parser.add_argument("--check", help="rerun the points of this baseline and compare")
+    parser.add_argument("--tolerance", type=float, default=0.10,
+                        help="run to run spread is a few percent, mostly where frames fall against the FreeRTOS tick")
+    args = parser.parse_args()
+
+    subprocess.run(["make", "-s", "-C", HERE], check=True)
+
+    baseline = None
+    if args.check:
+        with open(args.check) as f:
+            baseline = json.load(f)
+        if baseline.get("schema") != SCHEMA:
+            sys.exit("%s: schema %s, this harness writes %d" % (args.check, baseline.get("schema"), SCHEMA))
+        args.boards = sorted({p["board"] for p in baseline["results"]})
+        args.corpus = [os.path.join(HERE, p) for p in baseline.get("corpus_files", [])]
+        args.seed = baseline.get("seed", args.seed)
+
+    corpus = load_corpus(args.corpus, args.boards)
+    os.makedirs(BUILD, exist_ok=True)
+    image_files = {}
+    for name, data in corpus.items():
+        image_files[name] = os.path.join(BUILD, "image-%s.bin" % name)
+        with open(image_files[name], "wb") as f:
+            f.write(data)
+
+    if baseline:
+        for name, info in baseline["corpus"].items():
+            if name in corpus and zlib.crc32(corpus[name]) != info["crc32"]:
+                sys.exit("image %s is not the one the baseline was taken with" % name)
+        results = sweep(args, corpus, image_files, baseline["results"])
+    else:
+        results = sweep(args, corpus, image_files)
+
+    document = {
+        "schema": SCHEMA,
+        "seed": args.seed,
+        "corpus_files": [os.path.relpath(os.path.abspath(p), HERE) for p in args.corpus],
+        "corpus": {name: {"bytes": len(data), "crc32": zlib.crc32(data)} for name, data in sorted(corpus.items())},
+        "results": results,
+    }
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(document, f, indent=1, sort_keys=True)
+            f.write("\n")
+
+    failed = [p for p in results if p["status"] == "failed"]
+    for point in failed:
+        print("FAILED %s\n%s" % (key(point), point.get("log", "")))
+    if baseline:
+        regressions = check(baseline, results, args.tolerance)
+        print("%d regression(s) against %s" % (regressions, args.check))
+        return 1 if regressions else 0
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
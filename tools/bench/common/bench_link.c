@@ -0,0 +1,231 @@
+/*
+ * bench_link.c
+ *
+ * See bench_link.h. Arrival times travel with the bytes, so a receiver that
+ * is busy (a blocking page erase, a sleep in the flasher) still sees each
+ * byte at the time it really came off the line.
+ */
+
+#include "bench_link.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static double bench_speed = 1.0;
+
+void bench_time_init(double speed)
+{
+    bench_speed = speed > 0 ? speed : 1.0;
+}
+
+static int64_t bench_wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t bench_now_ns(void)
+{
+    return (int64_t)((double)bench_wall_ns() * bench_speed);
+}
+
+int64_t bench_now_us(void)
+{
+    return bench_now_ns() / 1000;
+}
+
+static struct timespec bench_wall_at(int64_t when_ns)
+{
+    int64_t wall = (int64_t)((double)when_ns / bench_speed);
+    struct timespec ts = { wall / 1000000000LL, wall % 1000000000LL };
+
+    return ts;
+}
+
+void bench_sleep_until_ns(int64_t when_ns)
+{
+    struct timespec ts = bench_wall_at(when_ns);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void bench_sleep_us(int64_t us)
+{
+    bench_sleep_until_ns(bench_now_ns() + us * 1000);
+}
+
+int bench_link_open(bench_link_t *link, const char *path, uint32_t baud, uint32_t tx_fifo)
+{
+    struct termios tio;
+
+    memset(link, 0, sizeof(*link));
+    // fd:<n> is an end the harness opened and handed down, the pty master has no path
+    if (strncmp(path, "fd:", 3) == 0) {
+        link->fd = atoi(path + 3);
+        fcntl(link->fd, F_SETFL, fcntl(link->fd, F_GETFL) | O_NONBLOCK);
+    } else {
+        link->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    }
+    if (link->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (tcgetattr(link->fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(link->fd, TCSANOW, &tio);
+    }
+    link->baud = baud;
+    link->tx_fifo = tx_fifo ? tx_fifo : 1;
+    link->byte_ns = 10LL * 1000000000LL / baud;
+    return 0;
+}
+
+static void bench_link_send(bench_link_t *link, const uint8_t *records, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(link->fd, records, len);
+
+        if (n > 0) {
+            records += n;
+            len -= (size_t)n;
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("bench link write");
+            exit(2);
+        } else {
+            struct pollfd pfd = { link->fd, POLLOUT, 0 };
+            poll(&pfd, 1, 10);
+        }
+    }
+}
+
+void bench_link_write(bench_link_t *link, const uint8_t *data, size_t len)
+{
+    uint8_t records[64 * BENCH_LINK_RECORD_LEN];
+    size_t queued = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        int64_t now = bench_now_ns();
+        int64_t start = link->tx_line_free_ns > now ? link->tx_line_free_ns : now;
+        int64_t blocked_until;
+
+        link->tx_line_free_ns = start + link->byte_ns;
+        records[queued * BENCH_LINK_RECORD_LEN] = data[i];
+        memcpy(&records[queued * BENCH_LINK_RECORD_LEN + 1], &link->tx_line_free_ns, 8);
+        queued++;
+
+        // a full FIFO holds the sender until the oldest byte has left
+        blocked_until = link->tx_line_free_ns - (int64_t)link->tx_fifo * link->byte_ns;
+        if (queued == sizeof(records) / BENCH_LINK_RECORD_LEN || blocked_until > now) {
+            bench_link_send(link, records, queued * BENCH_LINK_RECORD_LEN);
+            queued = 0;
+        }
+        if (blocked_until > now) {
+            bench_sleep_until_ns(blocked_until);
+        }
+    }
+    bench_link_send(link, records, queued * BENCH_LINK_RECORD_LEN);
+}
+
+void bench_link_drain(bench_link_t *link)
+{
+    bench_sleep_until_ns(link->tx_line_free_ns);
+}
+
+// Moves what the pty holds into the receive ring, as far as the ring has room
+static void bench_link_pump(bench_link_t *link)
+{
+    uint8_t buf[256 * BENCH_LINK_RECORD_LEN];
+
+    for (;;) {
+        uint32_t room = BENCH_LINK_RX_SIZE - 1 - ((link->rx_head - link->rx_tail) & (BENCH_LINK_RX_SIZE - 1));
+        size_t want = (size_t)room * BENCH_LINK_RECORD_LEN - link->rx_part_len;
+        ssize_t n;
+
+        if (room == 0) {
+            return;
+        }
+        if (want > sizeof(buf)) {
+            want = sizeof(buf);
+        }
+        n = read(link->fd, buf, want);
+        if (n <= 0) {
+            return;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            link->rx_part[link->rx_part_len++] = buf[i];
+            if (link->rx_part_len == BENCH_LINK_RECORD_LEN) {
+                link->rx_data[link->rx_head] = link->rx_part[0];
+                memcpy(&link->rx_arrival_ns[link->rx_head], &link->rx_part[1], 8);
+                link->rx_head = (link->rx_head + 1) & (BENCH_LINK_RX_SIZE - 1);
+                link->rx_part_len = 0;
+            }
+        }
+    }
+}
+
+size_t bench_link_available(bench_link_t *link)
+{
+    int64_t now = bench_now_ns();
+    size_t count = 0;
+
+    bench_link_pump(link);
+    for (uint32_t i = link->rx_tail; i != link->rx_head; i = (i + 1) & (BENCH_LINK_RX_SIZE - 1)) {
+        if (link->rx_arrival_ns[i] + link->rx_latency_ns > now) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+size_t bench_link_read(bench_link_t *link, uint8_t *data, size_t len, int64_t deadline_ns)
+{
+    size_t got = 0;
+
+    for (;;) {
+        int64_t now = bench_now_ns();
+        int64_t wake = deadline_ns;
+
+        bench_link_pump(link);
+        while (got < len && link->rx_tail != link->rx_head &&
+               link->rx_arrival_ns[link->rx_tail] + link->rx_latency_ns <= now) {
+            data[got++] = link->rx_data[link->rx_tail];
+            link->rx_tail = (link->rx_tail + 1) & (BENCH_LINK_RX_SIZE - 1);
+        }
+        if (got == len || now >= deadline_ns) {
+            return got;
+        }
+
+        // the next byte already known, or anything new on the pty
+        if (link->rx_tail != link->rx_head && link->rx_arrival_ns[link->rx_tail] + link->rx_latency_ns < wake) {
+            wake = link->rx_arrival_ns[link->rx_tail] + link->rx_latency_ns;
+        }
+        int64_t wait_ns = (int64_t)((double)(wake - now) / bench_speed);
+        if (wait_ns > 100000000LL) {
+            wait_ns = 100000000LL;
+        }
+        struct timespec ts = { wait_ns / 1000000000LL, wait_ns % 1000000000LL };
+        struct pollfd pfd = { link->fd, POLLIN, 0 };
+        ppoll(&pfd, 1, &ts, NULL);
+    }
+}
+
+void bench_link_flush(bench_link_t *link)
+{
+    int64_t now = bench_now_ns();
+
+    bench_link_pump(link);
+    while (link->rx_tail != link->rx_head && link->rx_arrival_ns[link->rx_tail] + link->rx_latency_ns <= now) {
+        link->rx_tail = (link->rx_tail + 1) & (BENCH_LINK_RX_SIZE - 1);
+    }
+}
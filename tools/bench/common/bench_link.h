@@ -0,0 +1,59 @@
+/*
+ * bench_link.h
+ *
+ * Emulated time and the emulated UART between the host builds of the flasher
+ * and the bootloader. Both ends share a pty; every byte goes over it with the
+ * time its stop bit leaves the line, one start, eight data and one stop bit
+ * after the sender put it there, and the reader only sees it from then on.
+ * A sender runs at most its TX FIFO ahead of the line.
+ *
+ * Time is the monotonic clock times --speed, the same on both ends, and every
+ * duration the harness reports is in emulated time.
+ */
+
+#ifndef BENCH_LINK_H
+#define BENCH_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BENCH_LINK_RX_SIZE      4096     // power of two
+#define BENCH_LINK_RECORD_LEN   9        // data byte, then its arrival time in ns
+
+typedef struct {
+    int fd;
+    uint32_t baud;
+    uint32_t tx_fifo;                    // bytes the sender may queue ahead of the line
+    int64_t byte_ns;
+    int64_t tx_line_free_ns;             // when the last byte queued is off the line
+    int64_t rx_latency_ns;               // from the stop bit until the reader is handed the byte
+    uint8_t rx_data[BENCH_LINK_RX_SIZE];
+    int64_t rx_arrival_ns[BENCH_LINK_RX_SIZE];
+    uint32_t rx_head;
+    uint32_t rx_tail;
+    uint8_t rx_part[BENCH_LINK_RECORD_LEN];
+    uint32_t rx_part_len;
+} bench_link_t;
+
+void bench_time_init(double speed);
+int64_t bench_now_ns(void);
+int64_t bench_now_us(void);
+void bench_sleep_until_ns(int64_t when_ns);
+void bench_sleep_us(int64_t us);
+
+int bench_link_open(bench_link_t *link, const char *path, uint32_t baud, uint32_t tx_fifo);
+// Returns once the bytes are in the TX FIFO, like a UART driver without a TX ring
+void bench_link_write(bench_link_t *link, const uint8_t *data, size_t len);
+// Waits for the last byte written to leave the line, the transmission complete flag
+void bench_link_drain(bench_link_t *link);
+
+/* The receive side of a link is not thread safe, a target that polls it from
+ * its tick thread as well takes a lock around these */
+// Bytes that are completely on the receiving side by now
+size_t bench_link_available(bench_link_t *link);
+// Reads up to len bytes, waiting until deadline_ns at most, returns how many were read
+size_t bench_link_read(bench_link_t *link, uint8_t *data, size_t len, int64_t deadline_ns);
+// Drops everything received so far, bytes still on the line arrive later
+void bench_link_flush(bench_link_t *link);
+
+#endif
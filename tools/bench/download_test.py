@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Interrupted STM32 image downloads against a local HTTP server.
+
+Runs build/download_host (http.c and image_store.c on the host) against a
+server in this process that serves one image with an ETag, answers Range and
+If-Range, and drops the connection where a case tells it to. Every case
+checks the requests the server saw and that the cached image has the CRC and
+the bytes of the one served.
+
+    ./download_test.py [--host build/download_host]
+"""
+
+import argparse
+import http.server
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import threading
+
+COMMIT_BYTES = 16 * 1024        # HTTP_PROGRESS_COMMIT_BYTES
+READ_BYTES = 2048               # HTTP_BUFFER_SIZE
+IMAGE_LEN = 0x58000             # the F401 and F446 application area, the largest image there is
+SLOT_CAPACITY = 0x77000         # IMAGE_STORE_SLOT_SIZE - IMAGE_STORE_HEADER_SIZE
+SPEED = 50                      # emulated time, the retry backoff is seconds long
+
+
+class Server:
+    """The image, the cuts still to make and the requests seen so far."""
+
+    def __init__(self):
+        self.set_image(random.Random(1).randbytes(IMAGE_LEN), '"v1"')
+        self.cuts = []          # per request: image offset to drop the connection at, or None
+        self.requests = []      # (range start or None, If-Range, status)
+        self.httpd = http.server.ThreadingHTTPServer(("127.0.0.1", 0), self.handler())
+        threading.Thread(target=self.httpd.serve_forever, daemon=True).start()
+        self.url = "http://127.0.0.1:%d/app.bin" % self.httpd.server_address[1]
+
+    def set_image(self, data, etag):
+        self.image, self.etag = data, etag
+
+    def handler(self):
+        server = self
+
+        class Handler(http.server.BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.1"
+
+            def log_message(self, fmt, *args):
+                pass
+
+            def do_GET(self):
+                rng = self.headers.get("Range")
+                if_range = self.headers.get("If-Range")
+                cut = server.cuts.pop(0) if server.cuts else None
+                start = None
+                if rng and rng.startswith("bytes=") and rng.endswith("-"):
+                    start = int(rng[6:-1])
+                if start is None and self.headers.get("If-None-Match") == server.etag:
+                    server.requests.append((None, if_range, 304))
+                    self.send_response(304)
+                    self.send_header("ETag", server.etag)
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                partial = start is not None and if_range == server.etag and start < len(server.image)
+                status = 206 if partial else 200
+                first = start if partial else 0
+                server.requests.append((start, if_range, status))
+                self.send_response(status)
+                self.send_header("ETag", server.etag)
+                self.send_header("Content-Length", str(len(server.image) - first))
+                if partial:
+                    self.send_header("Content-Range", "bytes %d-%d/%d" % (first, len(server.image) - 1,
+                                                                          len(server.image)))
+                self.end_headers()
+                end = len(server.image) if cut is None else max(cut, first)
+                self.wfile.write(server.image[first:end])
+                self.wfile.flush()
+                if cut is not None:
+                    self.close_connection = True
+
+        return Handler
+
+
+failures = 0
+
+
+def check(ok, name):
+    global failures
+    print("%-4s %s" % ("ok" if ok else "FAIL", name))
+    if not ok:
+        failures += 1
+
+
+def run(args, server, tmp, reset_after=0):
+    """One download_host run, returns (exit code, stdout)."""
+    image_path = os.path.join(tmp, "served.bin")
+    with open(image_path, "wb") as f:
+        f.write(server.image)
+    cmd = [args.host, "--url", server.url, "--store", os.path.join(tmp, "stm32img.bin"),
+           "--nvs", os.path.join(tmp, "nvs.bin"), "--expect", image_path, "--speed", str(SPEED)]
+    if reset_after:
+        cmd += ["--reset-after", str(reset_after)]
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, timeout=120)
+    if args.verbose:
+        sys.stdout.write(proc.stdout)
+    return proc.returncode, proc.stdout
+
+
+def crc_matches(out):
+    return any(line.startswith("host: cached") and line.endswith(": match") for line in out.splitlines())
+
+
+def resume_point(out):
+    for line in out.splitlines():
+        if line.startswith("host: resume point in NVS "):
+            return int(line.split()[-1])
+    return None
+
+
+def case_socket_cut(args, server, tmp):
+    """The connection drops mid-image, the next attempt asks for the rest."""
+    server.cuts = [100000]
+    rc, out = run(args, server, tmp)
+    check(rc == 0 and crc_matches(out), "socket cut: image complete, CRC matches")
+    check([(r[0], r[2]) for r in server.requests] == [(None, 200), (100000, 206)],
+          "socket cut: resumed with Range from byte 100000 (%s)" % server.requests)
+    check(server.requests[-1][1] == server.etag, "socket cut: If-Range carries the ETag")
+
+    del server.requests[:]
+    rc, out = run(args, server, tmp)
+    check(rc == 0 and "not modified" in out and [r[2] for r in server.requests] == [304],
+          "cached image revalidated with HTTP 304")
+
+
+def case_reset(args, server, tmp, changed):
+    """The ESP32 resets mid-image, the next run continues from the offset NVS holds."""
+    name = "reset, image changed" if changed else "reset"
+    rc, out = run(args, server, tmp, reset_after=150000)
+    check(rc == 3, "%s: download cut by the reset" % name)
+    if changed:
+        server.set_image(random.Random(2).randbytes(IMAGE_LEN - 1000), '"v2"')
+    del server.requests[:]
+    rc, out = run(args, server, tmp)
+    saved = resume_point(out)
+    # Saved on the read that crosses each commit boundary, so at most one read past it
+    check(saved is not None and COMMIT_BYTES <= saved <= 150000 and saved % COMMIT_BYTES < READ_BYTES,
+          "%s: NVS holds the resume point of the last commit boundary (%s)" % (name, saved))
+    check(bool(server.requests) and server.requests[0][0] == saved and server.requests[0][1] == '"v1"',
+          "%s: first request asks Range from the NVS offset (%s)" % (name, server.requests))
+    expected = [(saved, 200)] if changed else [(saved, 206)]
+    check([(r[0], r[2]) for r in server.requests] == expected,
+          "%s: %s" % (name, "server sent the new image whole" if changed else "only the rest was fetched"))
+    check(rc == 0 and crc_matches(out), "%s: image complete, CRC matches" % name)
+    check(resume_point(run(args, server, tmp)[1]) is None, "%s: resume point cleared once cached" % name)
+
+
+def case_too_large(args, server, tmp):
+    """An image no cache slot holds is refused up front, not retried."""
+    server.set_image(random.Random(3).randbytes(SLOT_CAPACITY + 1), '"big"')
+    rc, out = run(args, server, tmp)
+    check(rc == 1 and [r[2] for r in server.requests] == [200], "image larger than a slot refused without retries")
+    server.set_image(random.Random(3).randbytes(SLOT_CAPACITY), '"full"')
+    del server.requests[:]
+    rc, out = run(args, server, tmp)
+    check(rc == 0 and crc_matches(out), "image filling a slot cached, CRC matches")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                                   "build", "download_host"))
+    ap.add_argument("--verbose", action="store_true", help="show the download_host output")
+    args = ap.parse_args()
+
+    for case in (case_socket_cut, lambda a, s, t: case_reset(a, s, t, False),
+                 lambda a, s, t: case_reset(a, s, t, True), case_too_large):
+        server = Server()
+        with tempfile.TemporaryDirectory() as tmp:
+            case(args, server, tmp)
+        server.httpd.shutdown()
+    print("%d check(s) failed" % failures)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,141 @@
+/*
+ * download_main.c
+ *
+ * Host build of the ESP32 image download, one download_firmware() run of a
+ * URL into the image cache, for download_test.py. The stm32img partition and
+ * NVS are files that outlive the process, so a second run picks up what a
+ * reset left behind, as the ESP32 does after one.
+ *
+ *   download_host --url URL --store FILE --nvs FILE [--expect FILE] [--reset-after N] [--speed S]
+ *
+ * --reset-after ends the process (exit code 3) once N image bytes have been
+ * programmed. --expect compares the cached image with a file, by CRC and by
+ * content. The exit code is 0 when the download went through and matched.
+ */
+
+#include "http.h"
+#include "crc32.h"
+#include "bench_link.h"
+
+int host_store_attach(const char *path, size_t reset_after);
+int host_nvs_attach(const char *path);
+
+void send_mqtt_status(const char *status, const char *message)
+{
+}
+
+// Where download_firmware() will continue from, as NVS holds it now
+static void print_resume_point(void)
+{
+    nvs_handle_t handle;
+    uint32_t offset;
+
+    if (nvs_open(HTTP_PROGRESS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK &&
+        nvs_get_u32(handle, HTTP_PROGRESS_OFFSET_KEY, &offset) == ESP_OK) {
+        printf("host: resume point in NVS %" PRIu32 "\n", offset);
+        nvs_close(handle);
+    } else {
+        printf("host: no resume point in NVS\n");
+    }
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t *data = NULL;
+    long len;
+
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc(len);
+        if (data && fread(data, 1, len, file) != (size_t)len) {
+            free(data);
+            data = NULL;
+        }
+        *size = len;
+    }
+    fclose(file);
+    return data;
+}
+
+// The cached image against the file the server serves
+static int check_image(int slot, const char *expect_path)
+{
+    const uint8_t *image;
+    size_t image_size;
+    size_t expect_size = 0;
+    uint8_t *expect = read_file(expect_path, &expect_size);
+    int ok;
+
+    if (!expect || image_store_open(slot, &image, &image_size) != ESP_OK) {
+        free(expect);
+        return 0;
+    }
+    uint32_t crc = get_crc(image, image_size);
+    uint32_t expect_crc = get_crc(expect, expect_size);
+    ok = image_size == expect_size && crc == expect_crc && memcmp(image, expect, image_size) == 0;
+    printf("host: cached %zu bytes crc 0x%08" PRIX32 ", served %zu bytes crc 0x%08" PRIX32 ": %s\n",
+           image_size, crc, expect_size, expect_crc, ok ? "match" : "MISMATCH");
+    image_store_close();
+    free(expect);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *url = NULL;
+    const char *store_path = NULL;
+    const char *nvs_path = NULL;
+    const char *expect_path = NULL;
+    size_t reset_after = 0;
+    double speed = 1.0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--url") == 0) {
+            url = argv[i + 1];
+        } else if (strcmp(argv[i], "--store") == 0) {
+            store_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--nvs") == 0) {
+            nvs_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--expect") == 0) {
+            expect_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--reset-after") == 0) {
+            reset_after = strtoul(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "--speed") == 0) {
+            speed = strtod(argv[i + 1], NULL);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!url || !store_path || !nvs_path) {
+        fprintf(stderr, "usage: %s --url URL --store FILE --nvs FILE [--expect FILE] [--reset-after N] [--speed S]\n",
+                argv[0]);
+        return 2;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    bench_time_init(speed);
+    if (host_store_attach(store_path, reset_after) != 0 || host_nvs_attach(nvs_path) != 0 ||
+        image_store_init() != ESP_OK) {
+        return 2;
+    }
+    print_resume_point();
+
+    // As ota_update.c asks: conditionally when the URL is cached already
+    image_store_header_t cached;
+    int cached_slot = image_store_find_by_url(url, &cached);
+    bool not_modified = false;
+    int slot = -1;
+    if (download_firmware(url, cached_slot >= 0 ? &cached : NULL, &not_modified, &slot) != ESP_OK) {
+        return 1;
+    }
+    if (not_modified) {
+        slot = cached_slot;
+        printf("host: not modified, slot %d\n", slot);
+    }
+    return !expect_path || check_image(slot, expect_path) ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+/*
+ * flasher_main.c
+ *
+ * Host build of the ESP32 flasher, one flash_downloaded_firmware() run of an
+ * image file against a host bootloader on the other end of the link.
+ *
+ *   flasher_host --link fd:N|PATH --image FILE [--baud B] [--chunk N] [--speed S] [--mqtt-log 0|1]
+ *
+ * The STM32_RESULT and stats lines go to stdout as on the ESP32 console; the
+ * exit code is 0 when the update went through.
+ */
+
+#include "flash_cmd.h"
+#include "mqtt.h"
+#include "bench_link.h"
+
+void host_uart_attach(const char *path);
+
+esp_mqtt_client_handle_t mqtt_client;
+bool mqtt_connected = false;
+static bool mqtt_log = false;
+
+void send_mqtt_status(const char *status, const char *message)
+{
+    if (mqtt_log) {
+        printf("MQTT %s: %s\n", status, message);
+    }
+}
+
+// No NVS on the host, an interrupted run is started over
+esp_err_t update_session_save(const update_session_t *session)
+{
+    return ESP_OK;
+}
+
+esp_err_t update_session_save_progress(const update_session_t *session)
+{
+    return ESP_OK;
+}
+
+static uint8_t *read_image(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t *image = NULL;
+    long len;
+
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        image = malloc(len);
+        if (image && fread(image, 1, len, file) != (size_t)len) {
+            free(image);
+            image = NULL;
+        }
+        *size = len;
+    }
+    fclose(file);
+    if (!image) {
+        fprintf(stderr, "%s: cannot read the image\n", path);
+    }
+    return image;
+}
+
+int main(int argc, char **argv)
+{
+    const char *link = NULL;
+    const char *image_path = NULL;
+    double speed = 1.0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--link") == 0) {
+            link = argv[i + 1];
+        } else if (strcmp(argv[i], "--image") == 0) {
+            image_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--baud") == 0) {
+            host_uart_baud = (int)strtol(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "--chunk") == 0) {
+            host_write_chunk_max = (int)strtol(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "--speed") == 0) {
+            speed = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "--mqtt-log") == 0) {
+            mqtt_log = strtol(argv[i + 1], NULL, 0) != 0;
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!link || !image_path) {
+        fprintf(stderr, "usage: %s --link fd:N|PATH --image FILE [--baud B] [--chunk N] [--speed S] [--mqtt-log 0|1]\n",
+                argv[0]);
+        return 2;
+    }
+
+    size_t image_size = 0;
+    uint8_t *image = read_image(image_path, &image_size);
+    if (!image) {
+        return 2;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    bench_time_init(speed);
+    host_uart_attach(link);
+    uart_init();
+
+    // A fresh session, as for a job that was not interrupted
+    update_session_t session = { .version = UPDATE_SESSION_VERSION };
+    esp_err_t err = flash_downloaded_firmware(image, image_size, NULL, &session);
+    free(image);
+    return err == ESP_OK ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+/*
+ * http_host.c
+ *
+ * esp_http_client for the host build of http.c: plain HTTP/1.1 over a TCP
+ * socket, one connection per esp_http_client_open(). Response headers reach
+ * the event handler as HTTP_EVENT_ON_HEADER, as on the ESP32, and a server
+ * that closes the connection early makes esp_http_client_read() return 0.
+ */
+
+#include "idf_host.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HTTP_HOST_MAX_HEADERS   8
+#define HTTP_HOST_HEAD_LEN      4096
+
+struct esp_http_client {
+    char host[128];
+    char port[8];
+    char path[256];
+    struct {
+        char key[32];
+        char value[160];
+    } headers[HTTP_HOST_MAX_HEADERS];
+    http_event_handle_cb event_handler;
+    int timeout_ms;
+    int fd;
+    int status;
+    int64_t content_length;
+    int64_t body_left;              // -1 when the response has no Content-Length
+    char head[HTTP_HOST_HEAD_LEN];  // the response up to the blank line, then body bytes read with it
+    size_t head_len;
+    size_t body_pos;
+};
+
+static void fire(esp_http_client_handle_t client, esp_http_client_event_id_t id, char *key, char *value)
+{
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .header_key = key,
+        .header_value = value,
+    };
+
+    if (client->event_handler) {
+        client->event_handler(&evt);
+    }
+}
+
+// Only http://host[:port]/path, what the tests serve
+static int parse_url(esp_http_client_handle_t client, const char *url)
+{
+    const char *host = url + strlen("http://");
+    const char *path;
+    const char *colon;
+    size_t host_len;
+
+    if (strncmp(url, "http://", 7) != 0) {
+        return -1;
+    }
+    path = strchr(host, '/');
+    if (!path) {
+        path = "/";
+    }
+    colon = memchr(host, ':', path - host);
+    host_len = (colon ? colon : path) - host;
+    if (host_len == 0 || host_len >= sizeof(client->host)) {
+        return -1;
+    }
+    memcpy(client->host, host, host_len);
+    client->host[host_len] = '\0';
+    snprintf(client->port, sizeof(client->port), "%.*s", colon ? (int)(path - colon - 1) : 2,
+             colon ? colon + 1 : "80");
+    strlcpy(client->path, path, sizeof(client->path));
+    return 0;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+
+    if (!client) {
+        return NULL;
+    }
+    if (parse_url(client, config->url) != 0) {
+        free(client);
+        return NULL;
+    }
+    client->event_handler = config->event_handler;
+    client->timeout_ms = config->timeout_ms;
+    client->fd = -1;
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    int free_slot = -1;
+
+    for (int i = 0; i < HTTP_HOST_MAX_HEADERS; i++) {
+        if (strcasecmp(client->headers[i].key, key) == 0) {
+            free_slot = i;
+            break;
+        }
+        if (free_slot < 0 && client->headers[i].key[0] == '\0') {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    strlcpy(client->headers[free_slot].key, key, sizeof(client->headers[free_slot].key));
+    strlcpy(client->headers[free_slot].value, value, sizeof(client->headers[free_slot].value));
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+    for (int i = 0; i < HTTP_HOST_MAX_HEADERS; i++) {
+        if (strcasecmp(client->headers[i].key, key) == 0) {
+            client->headers[i].key[0] = '\0';
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addrs;
+    struct timeval timeout = { client->timeout_ms / 1000, client->timeout_ms % 1000 * 1000 };
+    char request[2048];
+    int len;
+
+    if (getaddrinfo(client->host, client->port, &hints, &addrs) != 0) {
+        return ESP_FAIL;
+    }
+    client->fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    if (client->fd < 0 || connect(client->fd, addrs->ai_addr, addrs->ai_addrlen) != 0) {
+        freeaddrinfo(addrs);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    freeaddrinfo(addrs);
+    setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    fire(client, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+
+    len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s:%s\r\nConnection: close\r\n",
+                   client->path, client->host, client->port);
+    for (int i = 0; i < HTTP_HOST_MAX_HEADERS; i++) {
+        if (client->headers[i].key[0]) {
+            len += snprintf(request + len, sizeof(request) - len, "%s: %s\r\n",
+                            client->headers[i].key, client->headers[i].value);
+        }
+    }
+    len += snprintf(request + len, sizeof(request) - len, "\r\n");
+    if (send(client->fd, request, len, MSG_NOSIGNAL) != len) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    fire(client, HTTP_EVENT_HEADER_SENT, NULL, NULL);
+    return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    char *end = NULL;
+    char *line;
+    char *next;
+
+    client->head_len = 0;
+    client->status = 0;
+    client->content_length = -1;
+    while (!end) {
+        ssize_t n = recv(client->fd, client->head + client->head_len, sizeof(client->head) - 1 - client->head_len, 0);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        client->head_len += n;
+        client->head[client->head_len] = '\0';
+        end = strstr(client->head, "\r\n\r\n");
+        if (!end && client->head_len == sizeof(client->head) - 1) {
+            return ESP_FAIL;
+        }
+    }
+    client->body_pos = end + 4 - client->head;
+    *end = '\0';
+
+    if (sscanf(client->head, "HTTP/%*d.%*d %d", &client->status) != 1) {
+        return ESP_FAIL;
+    }
+    for (line = strstr(client->head, "\r\n"); line; line = next) {
+        char *colon;
+
+        line += 2;
+        next = strstr(line, "\r\n");
+        if (next) {
+            *next = '\0';
+        }
+        colon = strchr(line, ':');
+        if (!colon) {
+            continue;
+        }
+        *colon = '\0';
+        char *value = colon + 1;
+        while (*value == ' ') {
+            value++;
+        }
+        if (strcasecmp(line, "Content-Length") == 0) {
+            client->content_length = strtoll(value, NULL, 10);
+        }
+        fire(client, HTTP_EVENT_ON_HEADER, line, value);
+    }
+    client->body_left = client->content_length;
+    return client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    int n;
+
+    if (client->body_left >= 0 && len > client->body_left) {
+        len = (int)client->body_left;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (client->body_pos < client->head_len) {
+        n = client->head_len - client->body_pos < (size_t)len ? (int)(client->head_len - client->body_pos) : len;
+        memcpy(buffer, client->head + client->body_pos, n);
+        client->body_pos += n;
+    } else {
+        do {
+            n = (int)recv(client->fd, buffer, len, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return n;
+        }
+    }
+    if (client->body_left >= 0) {
+        client->body_left -= n;
+    }
+    fire(client, HTTP_EVENT_ON_DATA, NULL, NULL);
+    return n;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+        fire(client, HTTP_EVENT_DISCONNECTED, NULL, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
@@ -0,0 +1,2 @@
+/* Host stand-in, everything the flasher sources use is in idf_host.h */
+#include "idf_host.h"
@@ -0,0 +1,209 @@
+/*
+ * idf_host.h
+ *
+ * The part of ESP-IDF that flash_cmd.c, uart_config.c, flash_stats.c and
+ * crc32.c use, for their host build. The UART is the bench link, time is
+ * emulated time and FreeRTOS ticks at CONFIG_FREERTOS_HZ as on the ESP32.
+ * http.c and image_store.c add the HTTP client, the partition API, NVS and
+ * SHA-256 (http_host.c, store_host.c).
+ */
+
+#ifndef IDF_HOST_H
+#define IDF_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+/* sdkconfig: the sweep axes are set per run from the command line */
+extern int host_uart_baud;
+extern int host_write_chunk_max;
+#define CONFIG_FREERTOS_HZ              100
+#ifndef HOST_TARGET_FAMILY                  // "STM32L0" for the L0 flasher project
+#define HOST_TARGET_FAMILY              "STM32F4"
+#endif
+#define CONFIG_STM32_TARGET_FAMILY      HOST_TARGET_FAMILY
+#define CONFIG_STM32_UART_BAUD          host_uart_baud
+#define CONFIG_STM32_WRITE_CHUNK_MAX    host_write_chunk_max
+#ifndef HOST_NO_BATCH_FINAL                 // a Kconfig bool set to n is left undefined
+#define CONFIG_STM32_BATCH_FINAL        1
+#endif
+#define CONFIG_STM32_RESULT_LOG         1
+
+/* esp_err.h */
+typedef int esp_err_t;
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_NO_MEM                  0x101
+#define ESP_ERR_INVALID_ARG             0x102
+#define ESP_ERR_INVALID_STATE           0x103
+#define ESP_ERR_INVALID_SIZE            0x104
+#define ESP_ERR_NOT_FOUND               0x105
+#define ESP_ERR_NOT_SUPPORTED           0x106
+#define ESP_ERR_TIMEOUT                 0x107
+#define ESP_ERR_INVALID_RESPONSE        0x108
+#define ESP_ERR_INVALID_CRC             0x109
+#define ESP_ERR_NVS_NOT_FOUND           0x1102
+#define ESP_ERR_NVS_TYPE_MISMATCH       0x1103
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE    0x1105
+#define ESP_ERR_NVS_INVALID_LENGTH      0x110c
+#define ESP_ERROR_CHECK(x)              do { esp_err_t err_rc_ = (x); if (err_rc_ != ESP_OK) abort(); } while (0)
+const char *esp_err_to_name(esp_err_t code);
+
+/* newlib's strlcpy, glibc only has it from 2.38 */
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+/* esp_log.h, the console format of the ESP32 */
+int64_t esp_timer_get_time(void);
+int64_t host_log_ms(void);
+#define HOST_LOG(level, tag, fmt, ...)  printf(level " (%" PRId64 ") %s: " fmt "\n", host_log_ms(), tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...)         HOST_LOG("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)         HOST_LOG("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...)         HOST_LOG("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...)         do { } while (0)
+
+/* FreeRTOS */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef void *TaskHandle_t;
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *EventGroupHandle_t;
+#define configTICK_RATE_HZ              CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS              (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY                   0xFFFFFFFFU
+#define pdMS_TO_TICKS(ms)               ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+#define pdTRUE                          1
+#define pdFALSE                         0
+// Wakes on a tick boundary like the scheduler
+void vTaskDelay(TickType_t ticks);
+
+/* driver/uart.h, driver/gpio.h */
+typedef int uart_port_t;
+#define UART_NUM_1                      1
+#define GPIO_NUM_16                     16
+#define GPIO_NUM_17                     17
+#define UART_PIN_NO_CHANGE              -1
+typedef enum { UART_DATA_8_BITS = 3 } uart_word_length_t;
+typedef enum { UART_PARITY_DISABLE = 0 } uart_parity_t;
+typedef enum { UART_STOP_BITS_1 = 1 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE = 0 } uart_hw_flowcontrol_t;
+typedef enum { UART_SCLK_DEFAULT = 0 } uart_sclk_t;
+typedef struct {
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uart_sclk_t source_clk;
+} uart_config_t;
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t *queue, int intr_alloc_flags);
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts);
+int uart_write_bytes(uart_port_t port, const void *src, size_t size);
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks_to_wait);
+esp_err_t uart_flush_input(uart_port_t port);
+
+/* esp_http_client.h */
+typedef struct esp_http_client *esp_http_client_handle_t;
+typedef enum {
+    HTTP_EVENT_ERROR,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADER_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+    HTTP_EVENT_REDIRECT,
+} esp_http_client_event_id_t;
+typedef struct {
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void *data;
+    int data_len;
+    void *user_data;
+    char *header_key;
+    char *header_value;
+} esp_http_client_event_t;
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+typedef struct {
+    const char *url;
+    http_event_handle_cb event_handler;
+    int buffer_size;
+    int timeout_ms;
+    bool keep_alive_enable;
+} esp_http_client_config_t;
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+/* esp_partition.h */
+typedef enum { ESP_PARTITION_TYPE_DATA = 0x01 } esp_partition_type_t;
+typedef enum { ESP_PARTITION_SUBTYPE_ANY = 0xff } esp_partition_subtype_t;
+typedef enum { ESP_PARTITION_MMAP_DATA } esp_partition_mmap_memory_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+} esp_partition_t;
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle);
+void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+
+/* nvs_flash.h */
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_erase_all(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+/* mbedtls/sha256.h, on bl_crypto.c's SHA-256 (store_host.c) */
+typedef struct {
+    uint64_t state[14];                     // a bl_sha256_ctx_t
+} mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen);
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]);
+
+/* mqtt_client.h */
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain);
+
+/* cJSON.h, the builder calls flash_stats.c makes */
+typedef struct cJSON cJSON;
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_CreateIntArray(const int *numbers, int count);
+cJSON *cJSON_AddBoolToObject(cJSON *object, const char *name, int boolean);
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number);
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *name);
+int cJSON_AddItemToObject(cJSON *object, const char *name, cJSON *item);
+char *cJSON_PrintUnformatted(const cJSON *item);
+void cJSON_Delete(cJSON *item);
+
+#endif /* IDF_HOST_H */
@@ -0,0 +1,242 @@
+/*
+ * idf_host.c
+ *
+ * ESP-IDF for the host build of the flasher: UART_NUM_1 is the bench link,
+ * the timer and the scheduler run on emulated time, and a cJSON that builds
+ * and prints just what flash_stats.c publishes.
+ */
+
+#include "idf_host.h"
+#include "bench_link.h"
+
+#include <math.h>
+#include <string.h>
+
+int host_uart_baud = 115200;
+int host_write_chunk_max = 0;
+
+#define HOST_TICK_NS            (1000000000LL / CONFIG_FREERTOS_HZ)
+#define HOST_UART_TX_FIFO       128         // ESP32 UART FIFO, the driver is installed without a TX ring
+#define HOST_UART_RX_TOUT       10          // UART_TOUT_THRESH_DEFAULT, in byte times
+
+static bench_link_t uart_link;
+static const char *uart_link_path;
+static int64_t boot_ns;
+
+// Called by flasher_main before uart_init(), the baud comes from uart_param_config
+void host_uart_attach(const char *path)
+{
+    uart_link_path = path;
+    boot_ns = bench_now_ns();
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t *queue, int intr_alloc_flags)
+{
+    return port == UART_NUM_1 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config)
+{
+    if (bench_link_open(&uart_link, uart_link_path, config->baud_rate, HOST_UART_TX_FIFO) != 0) {
+        return ESP_FAIL;
+    }
+    // The driver only moves bytes into its RX ring on FIFO full or the RX timeout,
+    // replies are far shorter than the FIFO so the timeout is what the task sees
+    uart_link.rx_latency_ns = HOST_UART_RX_TOUT * uart_link.byte_ns;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts)
+{
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t port, const void *src, size_t size)
+{
+    bench_link_write(&uart_link, src, size);
+    return (int)size;
+}
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    int64_t deadline = INT64_MAX;
+
+    if (ticks_to_wait != portMAX_DELAY) {
+        int64_t now = bench_now_ns();
+        deadline = now - now % HOST_TICK_NS + (int64_t)ticks_to_wait * HOST_TICK_NS;
+    }
+    return (int)bench_link_read(&uart_link, buf, length, deadline);
+}
+
+esp_err_t uart_flush_input(uart_port_t port)
+{
+    bench_link_flush(&uart_link);
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (bench_now_ns() - boot_ns) / 1000;
+}
+
+int64_t host_log_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    // Nothing else of the flasher's priority is ready on the bench, a zero delay returns at once
+    if (ticks == 0) {
+        return;
+    }
+    int64_t now = bench_now_ns();
+    bench_sleep_until_ns(now - now % HOST_TICK_NS + (int64_t)ticks * HOST_TICK_NS);
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain)
+{
+    return 0;
+}
+
+/* cJSON */
+
+typedef enum { HOST_JSON_OBJECT, HOST_JSON_ARRAY, HOST_JSON_NUMBER, HOST_JSON_BOOL } host_json_type_t;
+
+struct cJSON {
+    host_json_type_t type;
+    char *name;
+    double number;
+    cJSON *child;
+    cJSON *last;
+    cJSON *next;
+};
+
+static cJSON *json_new(host_json_type_t type)
+{
+    cJSON *item = calloc(1, sizeof(*item));
+    if (item) {
+        item->type = type;
+    }
+    return item;
+}
+
+static void json_append(cJSON *parent, cJSON *item)
+{
+    if (parent->last) {
+        parent->last->next = item;
+    } else {
+        parent->child = item;
+    }
+    parent->last = item;
+}
+
+cJSON *cJSON_CreateObject(void)
+{
+    return json_new(HOST_JSON_OBJECT);
+}
+
+cJSON *cJSON_CreateIntArray(const int *numbers, int count)
+{
+    cJSON *array = json_new(HOST_JSON_ARRAY);
+    for (int i = 0; array && i < count; i++) {
+        cJSON *item = json_new(HOST_JSON_NUMBER);
+        if (!item) {
+            break;
+        }
+        item->number = numbers[i];
+        json_append(array, item);
+    }
+    return array;
+}
+
+int cJSON_AddItemToObject(cJSON *object, const char *name, cJSON *item)
+{
+    if (!object || !item) {
+        return 0;
+    }
+    item->name = strdup(name);
+    json_append(object, item);
+    return 1;
+}
+
+static cJSON *json_add(cJSON *object, const char *name, host_json_type_t type, double number)
+{
+    cJSON *item = json_new(type);
+    if (item) {
+        item->number = number;
+        cJSON_AddItemToObject(object, name, item);
+    }
+    return item;
+}
+
+cJSON *cJSON_AddBoolToObject(cJSON *object, const char *name, int boolean)
+{
+    return json_add(object, name, HOST_JSON_BOOL, boolean != 0);
+}
+
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number)
+{
+    return json_add(object, name, HOST_JSON_NUMBER, number);
+}
+
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *name)
+{
+    return json_add(object, name, HOST_JSON_OBJECT, 0);
+}
+
+static void json_print(const cJSON *item, FILE *out)
+{
+    if (item->name) {
+        fprintf(out, "\"%s\":", item->name);
+    }
+    switch (item->type) {
+    case HOST_JSON_NUMBER:
+        if (item->number == floor(item->number) && fabs(item->number) < 1e15) {
+            fprintf(out, "%lld", (long long)item->number);
+        } else {
+            fprintf(out, "%.17g", item->number);
+        }
+        break;
+    case HOST_JSON_BOOL:
+        fputs(item->number != 0 ? "true" : "false", out);
+        break;
+    default:
+        fputc(item->type == HOST_JSON_OBJECT ? '{' : '[', out);
+        for (const cJSON *child = item->child; child; child = child->next) {
+            json_print(child, out);
+            if (child->next) {
+                fputc(',', out);
+            }
+        }
+        fputc(item->type == HOST_JSON_OBJECT ? '}' : ']', out);
+        break;
+    }
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+
+    if (!out) {
+        return NULL;
+    }
+    json_print(item, out);
+    fclose(out);
+    return text;
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    while (item) {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item->name);
+        free(item);
+        item = next;
+    }
+}
@@ -0,0 +1,347 @@
+/*
+ * store_host.c
+ *
+ * The ESP32 storage http.c and image_store.c sit on, for their host build:
+ * the stm32img partition is a file mapped into memory and programmed like
+ * NOR flash (a write only clears bits, an erase sets a whole sector), NVS is
+ * a second file rewritten on every nvs_commit(), and mbedtls' SHA-256 is the
+ * bootloader's own from bl_crypto.c.
+ *
+ * A reset can be injected once a given number of image bytes has been
+ * programmed, to leave the storage as a power cut mid-download would.
+ */
+
+#include "idf_host.h"
+#include "bl_crypto.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HOST_STORE_SIZE         0xF0000     // stm32img in partitions.csv
+#define HOST_STORE_ERASE_SIZE   4096
+#define HOST_NVS_MAX_ENTRIES    16
+#define HOST_NVS_NAME_LEN       16          // NVS_KEY_NAME_MAX_SIZE
+#define HOST_NVS_MAX_VALUE      1024
+
+_Static_assert(sizeof(mbedtls_sha256_context) >= sizeof(bl_sha256_ctx_t), "mbedtls_sha256_context too small");
+
+static esp_partition_t store = {
+    .address = 0x310000,
+    .size = HOST_STORE_SIZE,
+    .erase_size = HOST_STORE_ERASE_SIZE,
+    .label = "stm32img",
+};
+static uint8_t *store_mem;
+static size_t store_programmed;
+static size_t store_reset_after;
+
+/* esp_partition.h */
+
+int host_store_attach(const char *path, size_t reset_after)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    // A new file is a freshly erased partition
+    if (st.st_size == 0) {
+        uint8_t erased[HOST_STORE_ERASE_SIZE];
+        memset(erased, 0xFF, sizeof(erased));
+        for (size_t off = 0; off < HOST_STORE_SIZE; off += sizeof(erased)) {
+            if (write(fd, erased, sizeof(erased)) != (ssize_t)sizeof(erased)) {
+                perror(path);
+                close(fd);
+                return -1;
+            }
+        }
+    }
+    store_mem = mmap(NULL, HOST_STORE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (store_mem == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    store_reset_after = reset_after;
+    return 0;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    return store_mem && strcmp(label, store.label) == 0 ? &store : NULL;
+}
+
+static bool in_store(size_t offset, size_t len)
+{
+    return offset <= HOST_STORE_SIZE && len <= HOST_STORE_SIZE - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (!in_store(src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, store_mem + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    const uint8_t *data = src;
+
+    if (!in_store(dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        store_mem[dst_offset + i] &= data[i];
+    }
+    // Headers are a few hundred bytes, image data comes in HTTP_BUFFER_SIZE pieces at most
+    store_programmed += size;
+    if (store_reset_after && store_programmed >= store_reset_after) {
+        msync(store_mem, HOST_STORE_SIZE, MS_SYNC);
+        printf("host: reset after %zu bytes programmed\n", store_programmed);
+        fflush(stdout);
+        _exit(3);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (!in_store(offset, size) || offset % HOST_STORE_ERASE_SIZE || size % HOST_STORE_ERASE_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(store_mem + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle)
+{
+    if (!in_store(offset, size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_ptr = store_mem + offset;
+    *out_handle = 0;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
+
+/* nvs_flash.h */
+
+typedef struct {
+    char ns[HOST_NVS_NAME_LEN];
+    char key[HOST_NVS_NAME_LEN];
+    uint32_t len;
+    uint8_t value[HOST_NVS_MAX_VALUE];
+} nvs_entry_t;
+
+static const char *nvs_path;
+static nvs_entry_t nvs_entries[HOST_NVS_MAX_ENTRIES];
+static char nvs_namespaces[HOST_NVS_MAX_ENTRIES][HOST_NVS_NAME_LEN];
+
+int host_nvs_attach(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+
+    nvs_path = path;
+    if (file) {
+        if (fread(nvs_entries, 1, sizeof(nvs_entries), file) != sizeof(nvs_entries)) {
+            memset(nvs_entries, 0, sizeof(nvs_entries));
+        }
+        fclose(file);
+    }
+    return 0;
+}
+
+static nvs_entry_t *nvs_find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < HOST_NVS_MAX_ENTRIES; i++) {
+        if (nvs_entries[i].key[0] && strcmp(nvs_entries[i].ns, nvs_namespaces[handle]) == 0 &&
+            strcmp(nvs_entries[i].key, key) == 0) {
+            return &nvs_entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    int found = 0;
+
+    if (strlen(name) >= HOST_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < HOST_NVS_MAX_ENTRIES; i++) {
+        found |= nvs_entries[i].key[0] && strcmp(nvs_entries[i].ns, name) == 0;
+    }
+    // As on the ESP32, a namespace nothing was written to cannot be opened read only
+    if (!found && open_mode == NVS_READONLY) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (nvs_handle_t h = 0; h < HOST_NVS_MAX_ENTRIES; h++) {
+        if (nvs_namespaces[h][0] == '\0' || strcmp(nvs_namespaces[h], name) == 0) {
+            strlcpy(nvs_namespaces[h], name, HOST_NVS_NAME_LEN);
+            *out_handle = h;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    nvs_entry_t *entry = nvs_find(handle, key);
+
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value && *length < entry->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (out_value) {
+        memcpy(out_value, entry->value, entry->len);
+    }
+    *length = entry->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    nvs_entry_t *entry = nvs_find(handle, key);
+
+    if (strlen(key) >= HOST_NVS_NAME_LEN || length > HOST_NVS_MAX_VALUE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; !entry && i < HOST_NVS_MAX_ENTRIES; i++) {
+        if (nvs_entries[i].key[0] == '\0') {
+            entry = &nvs_entries[i];
+            strlcpy(entry->ns, nvs_namespaces[handle], sizeof(entry->ns));
+            strlcpy(entry->key, key, sizeof(entry->key));
+        }
+    }
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    memcpy(entry->value, value, length);
+    entry->len = (uint32_t)length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    size_t len = sizeof(*out_value);
+    nvs_entry_t *entry = nvs_find(handle, key);
+
+    if (entry && entry->len != len) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    return nvs_get_blob(handle, key, out_value, &len);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    for (int i = 0; i < HOST_NVS_MAX_ENTRIES; i++) {
+        if (strcmp(nvs_entries[i].ns, nvs_namespaces[handle]) == 0) {
+            memset(&nvs_entries[i], 0, sizeof(nvs_entries[i]));
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    FILE *file = fopen(nvs_path, "wb");
+    size_t written;
+
+    if (!file) {
+        return ESP_FAIL;
+    }
+    written = fwrite(nvs_entries, 1, sizeof(nvs_entries), file);
+    return fclose(file) == 0 && written == sizeof(nvs_entries) ? ESP_OK : ESP_FAIL;
+}
+
+/* mbedtls/sha256.h */
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx)
+{
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224)
+{
+    if (is224) {
+        return -1;
+    }
+    bl_sha256_init((bl_sha256_ctx_t *)ctx);
+    return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen)
+{
+    bl_sha256_update((bl_sha256_ctx_t *)ctx, input, (uint32_t)ilen);
+    return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32])
+{
+    bl_sha256_final((bl_sha256_ctx_t *)ctx, output);
+    return 0;
+}
+
+/* The newlib and esp_err.h helpers glibc has no counterpart of */
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char name[24];
+
+    switch (code) {
+    case ESP_OK:                    return "ESP_OK";
+    case ESP_FAIL:                  return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:            return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:       return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:     return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:         return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_INVALID_RESPONSE:  return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:       return "ESP_ERR_INVALID_CRC";
+    default:
+        snprintf(name, sizeof(name), "0x%x", code);
+        return name;
+    }
+}
@@ -0,0 +1,275 @@
+/*
+ * crypto_bench.c
+ *
+ * bl_crypto.c against the published test vectors, then what it costs:
+ * SHA-256 per byte over an image sized buffer, one Ed25519 verify and
+ * ChaCha20 per byte, in one pass and in write frame payloads.
+ *
+ *   crypto_bench [--quick]      --quick checks only, no timing
+ */
+
+#include "micro.h"
+#include "bl_crypto.h"
+
+#include <stdlib.h>
+
+#define IMAGE_LEN       (256 * 1024)     // about an application area
+#define CIPHER_LEN      (64 * 1024)
+#define FRAME_PAYLOAD   245              // the largest BL_MEM_WRITE payload on the F4s
+#define TIME_MS         300
+
+/* FIPS 180-2 examples, the last one is a million 'a' */
+static const struct {
+    const char *msg;
+    uint32_t repeat;
+    const char *digest;
+} sha256_vectors[] = {
+    { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+/* RFC 8032 section 7.1, tests 1 to 3 and SHA(abc) */
+static const struct {
+    const char *name;
+    const char *pubkey;
+    const char *msg;
+    const char *sig;
+} ed25519_vectors[] = {
+    { "TEST 1", "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a", "",
+      "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+      "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b" },
+    { "TEST 2", "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c", "72",
+      "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+      "085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00" },
+    { "TEST 3", "fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025", "af82",
+      "6291d657deec24024827e69c3abe01a30ce548a284743a445e3680d7db5ac3ac"
+      "18ff9b538d16f290ae67f760984dc6594a7c15e9716ed28dc027beceea1ec40a" },
+    { "TEST SHA(abc)", "ec172b93ad5e563bf4932c70e1245034c35467ef2efd4d64ebf819683467e2bf",
+      "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+      "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+      "dc2a4459e7369633a52b1bf277839a00201009a3efbf3ecb69bea2186c26b589"
+      "09351fc9ac90b3ecfdfbc7c66431e0303dca179c138ac17ad9bef1177331a704" },
+};
+
+/* TEST 1 with S + L in place of S: the same point, a malleated signature */
+static const char *ed25519_malleated =
+    "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+    "4c8c7872aa064e049dbb3013fbf29380d25bf5f0595bbe24655141438e7a101b";
+
+/* RFC 8439 sections 2.3.2 and 2.4.2: the key is 00..1f in both, the block counter 1 */
+static const char *chacha20_key = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+static const char *chacha20_block_nonce = "000000090000004a00000000";
+static const char *chacha20_block_stream =
+    "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+    "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e";
+static const char *chacha20_text_nonce = "000000000000004a00000000";
+static const char chacha20_plaintext[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+    "sunscreen would be it.";
+static const char *chacha20_ciphertext =
+    "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+    "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+    "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+    "5af90bbf74a35be6b40b8eedf2785e42874d";
+
+static void check_sha256(void)
+{
+    char name[64];
+
+    for (size_t v = 0; v < sizeof(sha256_vectors) / sizeof(sha256_vectors[0]); v++) {
+        bl_sha256_ctx_t ctx;
+        uint8_t digest[32];
+        uint32_t len = (uint32_t)strlen(sha256_vectors[v].msg);
+
+        bl_sha256_init(&ctx);
+        for (uint32_t i = 0; i < sha256_vectors[v].repeat; i++) {
+            bl_sha256_update(&ctx, (const uint8_t *)sha256_vectors[v].msg, len);
+        }
+        bl_sha256_final(&ctx, digest);
+        snprintf(name, sizeof(name), "sha256 FIPS 180-2 #%zu", v + 1);
+        micro_check_hex(digest, sha256_vectors[v].digest, sizeof(digest), name);
+    }
+
+    // Fed in pieces that straddle the 64 byte blocks, as the image arrives from flash
+    static uint8_t image[1000];
+    uint8_t whole[32], pieces[32];
+    bl_sha256_ctx_t ctx;
+
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)(i * 7 + 3);
+    }
+    bl_sha256_init(&ctx);
+    bl_sha256_update(&ctx, image, sizeof(image));
+    bl_sha256_final(&ctx, whole);
+    bl_sha256_init(&ctx);
+    for (uint32_t off = 0, step = 1; off < sizeof(image); off += step, step = step * 3 % 97 + 1) {
+        bl_sha256_update(&ctx, image + off, off + step > sizeof(image) ? sizeof(image) - off : step);
+    }
+    bl_sha256_final(&ctx, pieces);
+    micro_check(memcmp(whole, pieces, sizeof(whole)) == 0, "sha256 streamed in uneven pieces");
+}
+
+static void check_ed25519(void)
+{
+    uint8_t pubkey[32], msg[64 + 1], sig[64];
+    char name[64];
+
+    for (size_t v = 0; v < sizeof(ed25519_vectors) / sizeof(ed25519_vectors[0]); v++) {
+        size_t len;
+
+        micro_hex(ed25519_vectors[v].pubkey, pubkey, sizeof(pubkey));
+        len = micro_hex(ed25519_vectors[v].msg, msg, sizeof(msg));
+        micro_hex(ed25519_vectors[v].sig, sig, sizeof(sig));
+        snprintf(name, sizeof(name), "ed25519 RFC 8032 %s", ed25519_vectors[v].name);
+        micro_check(bl_ed25519_verify(sig, msg, (uint32_t)len, pubkey) == BL_SIGNATURE_VALID, name);
+
+        sig[v] ^= 0x01;
+        snprintf(name, sizeof(name), "ed25519 RFC 8032 %s, R bit flipped", ed25519_vectors[v].name);
+        micro_check(bl_ed25519_verify(sig, msg, (uint32_t)len, pubkey) == BL_SIGNATURE_INVALID, name);
+        sig[v] ^= 0x01;
+
+        sig[40 + v] ^= 0x80;
+        snprintf(name, sizeof(name), "ed25519 RFC 8032 %s, S bit flipped", ed25519_vectors[v].name);
+        micro_check(bl_ed25519_verify(sig, msg, (uint32_t)len, pubkey) == BL_SIGNATURE_INVALID, name);
+        sig[40 + v] ^= 0x80;
+
+        msg[len] = 0x00;
+        snprintf(name, sizeof(name), "ed25519 RFC 8032 %s, message one byte longer", ed25519_vectors[v].name);
+        micro_check(bl_ed25519_verify(sig, msg, (uint32_t)len + 1, pubkey) == BL_SIGNATURE_INVALID, name);
+    }
+
+    micro_hex(ed25519_vectors[0].pubkey, pubkey, sizeof(pubkey));
+    micro_hex(ed25519_malleated, sig, sizeof(sig));
+    micro_check(bl_ed25519_verify(sig, msg, 0, pubkey) == BL_SIGNATURE_INVALID, "ed25519 S + L refused");
+
+    // The identity as public key: every signature with R = identity and S = 0 would verify
+    memset(pubkey, 0, sizeof(pubkey));
+    pubkey[0] = 0x01;
+    memset(sig, 0, sizeof(sig));
+    sig[0] = 0x01;
+    micro_check(bl_ed25519_verify(sig, msg, 0, pubkey) == BL_SIGNATURE_INVALID, "ed25519 identity key refused");
+}
+
+static void check_chacha20(void)
+{
+    uint8_t key[32], nonce[12];
+    uint8_t block[64] = { 0 };
+    uint8_t text[sizeof(chacha20_plaintext) - 1];
+
+    // The offset is the byte position in the image, block counter 1 starts at byte 64
+    micro_hex(chacha20_key, key, sizeof(key));
+    micro_hex(chacha20_block_nonce, nonce, sizeof(nonce));
+    bl_chacha20_xor(key, nonce, 64, block, sizeof(block));
+    micro_check_hex(block, chacha20_block_stream, sizeof(block), "chacha20 RFC 8439 2.3.2 key stream");
+
+    micro_hex(chacha20_text_nonce, nonce, sizeof(nonce));
+    memcpy(text, chacha20_plaintext, sizeof(text));
+    bl_chacha20_xor(key, nonce, 64, text, sizeof(text));
+    micro_check_hex(text, chacha20_ciphertext, sizeof(text), "chacha20 RFC 8439 2.4.2 encryption");
+    bl_chacha20_xor(key, nonce, 64, text, sizeof(text));
+    micro_check(memcmp(text, chacha20_plaintext, sizeof(text)) == 0, "chacha20 decrypts what it encrypted");
+
+    // Frames split the image anywhere, each piece has to pick the stream up at its own offset
+    static uint8_t whole[1000], pieces[1000];
+    for (size_t i = 0; i < sizeof(whole); i++) {
+        whole[i] = pieces[i] = (uint8_t)(i * 13 + 5);
+    }
+    bl_chacha20_xor(key, nonce, 0, whole, sizeof(whole));
+    for (uint32_t off = 0, step = 1; off < sizeof(pieces); off += step, step = step * 5 % 131 + 1) {
+        uint32_t n = off + step > sizeof(pieces) ? sizeof(pieces) - off : step;
+        bl_chacha20_xor(key, nonce, off, pieces + off, n);
+    }
+    micro_check(memcmp(whole, pieces, sizeof(whole)) == 0, "chacha20 in pieces at any offset is one pass");
+}
+
+static uint8_t *image;
+
+static void sha256_image(void *arg)
+{
+    bl_sha256_ctx_t ctx;
+    uint8_t digest[32];
+
+    (void)arg;
+    bl_sha256_init(&ctx);
+    bl_sha256_update(&ctx, image, IMAGE_LEN);
+    bl_sha256_final(&ctx, digest);
+}
+
+// The bootloader signs a 32 byte image digest, the 64 byte SHA(abc) vector is the nearest;
+// the cost is in the two scalar multiplications, not the message
+static struct {
+    uint8_t pubkey[32];
+    uint8_t msg[64];
+    uint8_t sig[64];
+} verify_case;
+
+static void ed25519_verify_once(void *arg)
+{
+    if (bl_ed25519_verify(verify_case.sig, verify_case.msg, sizeof(verify_case.msg), verify_case.pubkey)
+            != BL_SIGNATURE_VALID) {
+        *(int *)arg = 1;
+    }
+}
+
+static uint8_t cipher_key[32];
+static uint8_t cipher_nonce[12];
+
+static void chacha20_one_pass(void *arg)
+{
+    (void)arg;
+    bl_chacha20_xor(cipher_key, cipher_nonce, 0, image, CIPHER_LEN);
+}
+
+// As bl_core.c decrypts: every write payload on its own, at its offset in the image
+static void chacha20_frames(void *arg)
+{
+    (void)arg;
+    for (uint32_t off = 0; off < CIPHER_LEN; off += FRAME_PAYLOAD) {
+        uint32_t n = CIPHER_LEN - off < FRAME_PAYLOAD ? CIPHER_LEN - off : FRAME_PAYLOAD;
+        bl_chacha20_xor(cipher_key, cipher_nonce, off, image + off, n);
+    }
+}
+
+static void time_crypto(void)
+{
+    micro_time_t t;
+
+    image = malloc(IMAGE_LEN);
+    for (size_t i = 0; i < IMAGE_LEN; i++) {
+        image[i] = (uint8_t)rand();
+    }
+
+    t = micro_time(sha256_image, NULL, TIME_MS);
+    printf("time sha256      %8.2f ns/byte %8.2f tsc/byte  (%d KB in %.2f ms)\n",
+           t.ns / IMAGE_LEN, t.tsc / IMAGE_LEN, IMAGE_LEN / 1024, t.ns / 1e6);
+    int refused = 0;
+    micro_hex(ed25519_vectors[3].pubkey, verify_case.pubkey, sizeof(verify_case.pubkey));
+    micro_hex(ed25519_vectors[3].msg, verify_case.msg, sizeof(verify_case.msg));
+    micro_hex(ed25519_vectors[3].sig, verify_case.sig, sizeof(verify_case.sig));
+    t = micro_time(ed25519_verify_once, &refused, TIME_MS);
+    micro_check(!refused, "ed25519 timed verify accepted");
+    printf("time ed25519     %8.3f ms/verify %8.0f tsc/verify\n", t.ns / 1e6, t.tsc);
+    t = micro_time(chacha20_one_pass, NULL, TIME_MS);
+    printf("time chacha20    %8.2f ns/byte %8.2f tsc/byte  (%d KB in one pass)\n",
+           t.ns / CIPHER_LEN, t.tsc / CIPHER_LEN, CIPHER_LEN / 1024);
+    t = micro_time(chacha20_frames, NULL, TIME_MS);
+    printf("time chacha20    %8.2f ns/byte %8.2f tsc/byte  (%d KB in %d byte payloads)\n",
+           t.ns / CIPHER_LEN, t.tsc / CIPHER_LEN, CIPHER_LEN / 1024, FRAME_PAYLOAD);
+    free(image);
+}
+
+int main(int argc, char **argv)
+{
+    int quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+
+    check_sha256();
+    check_ed25519();
+    check_chacha20();
+    if (!quick) {
+        time_crypto();
+    }
+    return micro_result();
+}
@@ -0,0 +1,89 @@
+/*
+ * micro.c
+ *
+ * Check bookkeeping and the timing loop shared by the micro-benchmarks.
+ */
+
+#include "micro.h"
+
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICRO_TSC()     __rdtsc()
+#else
+#define MICRO_TSC()     0
+#endif
+
+int micro_failures;
+
+void micro_check(int ok, const char *name)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", name);
+    if (!ok) {
+        micro_failures++;
+    }
+}
+
+size_t micro_hex(const char *hex, uint8_t *out, size_t out_size)
+{
+    size_t n = 0;
+    unsigned int byte;
+
+    while (n < out_size && hex[0] && hex[1] && sscanf(hex, "%2x", &byte) == 1) {
+        out[n++] = (uint8_t)byte;
+        hex += 2;
+    }
+    return n;
+}
+
+void micro_check_hex(const uint8_t *got, const char *hex, size_t len, const char *name)
+{
+    uint8_t want[256];
+    int ok = len <= sizeof(want) && micro_hex(hex, want, sizeof(want)) == len && memcmp(got, want, len) == 0;
+
+    micro_check(ok, name);
+    if (!ok) {
+        printf("     got ");
+        for (size_t i = 0; i < len; i++) {
+            printf("%02x", got[i]);
+        }
+        printf("\n     want %s\n", hex);
+    }
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+micro_time_t micro_time(void (*fn)(void *), void *arg, int min_ms)
+{
+    micro_time_t t = { 0, 0 };
+    int64_t calls = 0;
+    int64_t start;
+    int64_t elapsed;
+    uint64_t tsc;
+
+    // One call first, so that caches and page faults are not counted
+    fn(arg);
+    start = now_ns();
+    tsc = MICRO_TSC();
+    do {
+        fn(arg);
+        calls++;
+        elapsed = now_ns() - start;
+    } while (elapsed < (int64_t)min_ms * 1000000);
+    t.ns = (double)elapsed / calls;
+    t.tsc = (double)(MICRO_TSC() - tsc) / calls;
+    return t;
+}
+
+int micro_result(void)
+{
+    printf("%d check(s) failed\n", micro_failures);
+    return micro_failures ? 1 : 0;
+}
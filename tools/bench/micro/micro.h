@@ -0,0 +1,39 @@
+/*
+ * micro.h
+ *
+ * Unit checks and micro-benchmarks of single modules, on the host. Checks
+ * count their failures and a program exits 1 if any failed. Timings are host
+ * numbers, for comparing two versions of the same code on one machine; what
+ * the boards spend is measured on them, with BL_GET_STATS.
+ */
+
+#ifndef MICRO_H
+#define MICRO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+extern int micro_failures;
+
+// Records one check, printed with its name
+void micro_check(int ok, const char *name);
+
+// Checks len bytes against the expected hex string
+void micro_check_hex(const uint8_t *got, const char *hex, size_t len, const char *name);
+
+// Parses a hex string into out, returns its length in bytes
+size_t micro_hex(const char *hex, uint8_t *out, size_t out_size);
+
+typedef struct {
+    double ns;              // per call
+    double tsc;             // time stamp counter ticks per call, 0 where there is none
+} micro_time_t;
+
+// Runs fn(arg) over and over for at least min_ms, returns the cost of one call
+micro_time_t micro_time(void (*fn)(void *), void *arg, int min_ms);
+
+// The exit code: 1 when a check failed
+int micro_result(void);
+
+#endif
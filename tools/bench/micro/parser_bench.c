@@ -0,0 +1,219 @@
+/*
+ * parser_bench.c
+ *
+ * cmd_parser.c on the MQTT update commands: what it accepts and refuses, and
+ * what one command costs to parse. Built with a real cJSON (CJSON_DIR, see
+ * the Makefile) it also times the cJSON_ParseWithLength() path mqtt.c used
+ * before, with its heap allocations counted.
+ *
+ *   parser_bench [--quick]      --quick checks only, no timing
+ */
+
+#include "micro.h"
+#include "cmd_parser.h"
+#include "update_jobs.h"
+
+#define TIME_MS         300
+
+/* What the broker sends, with the optional members and a signature */
+static const char command[] =
+    "{\"firmware_sts\":1,"
+    "\"firmwareUrl\":\"https:\\/\\/updates.example.com\\/stm32\\/f401\\/app-2.4.1.bin\","
+    "\"sha256\":\"9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\","
+    "\"target\":\"STM32F4\",\"priority\":1,"
+    "\"signature\":\"e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+    "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b\","
+    "\"meta\":{\"build\":[1,2,{\"ci\":\"x\"}],\"note\":\"not parsed\"}}";
+
+typedef struct {
+    int firmware_sts;
+    int priority;
+    char url[UPDATE_JOB_URL_LEN];
+    char sha256[65];
+    char target[UPDATE_JOB_TARGET_LEN];
+    char signature[129];
+    cmd_field_t fields[6];
+} parsed_t;
+
+// The table mqtt.c's handle_update_command() parses with
+static esp_err_t parse(parsed_t *out, const char *data, size_t len)
+{
+    cmd_field_t fields[] = {
+        { "firmware_sts", CMD_FIELD_INT,    &out->firmware_sts, sizeof(out->firmware_sts) },
+        { "firmwareUrl",  CMD_FIELD_STRING, out->url,           sizeof(out->url) },
+        { "sha256",       CMD_FIELD_STRING, out->sha256,        sizeof(out->sha256) },
+        { "target",       CMD_FIELD_STRING, out->target,        sizeof(out->target) },
+        { "priority",     CMD_FIELD_INT,    &out->priority,     sizeof(out->priority) },
+        { "signature",    CMD_FIELD_STRING, out->signature,     sizeof(out->signature) },
+    };
+    esp_err_t err;
+
+    memset(out, 0, sizeof(*out));
+    err = cmd_parse(data, len, fields, sizeof(fields) / sizeof(fields[0]));
+    memcpy(out->fields, fields, sizeof(fields));
+    return err;
+}
+
+static esp_err_t parse_text(parsed_t *out, const char *text)
+{
+    return parse(out, text, strlen(text));
+}
+
+static void check_accepts(void)
+{
+    parsed_t p;
+
+    micro_check(parse_text(&p, command) == ESP_OK && p.fields[0].found && p.firmware_sts == 1,
+                "full command parsed");
+    micro_check(strcmp(p.url, "https://updates.example.com/stm32/f401/app-2.4.1.bin") == 0, "url unescaped");
+    micro_check(p.fields[2].found && strlen(p.sha256) == 64, "sha256 read");
+    micro_check(strcmp(p.target, "STM32F4") == 0 && p.priority == 1, "target and priority read");
+    micro_check(p.fields[5].found && strlen(p.signature) == 128, "signature read");
+
+    micro_check(parse_text(&p, " {\n\t\"priority\" : -3 , \"firmware_sts\" :0 }\r\n") == ESP_OK &&
+                p.firmware_sts == 0 && p.priority == -3 && !p.fields[1].found, "whitespace, order, negative");
+    micro_check(parse_text(&p, "{}") == ESP_OK && !p.fields[0].found, "empty object");
+    micro_check(parse_text(&p, "{\"firmware_sts\":\"1\",\"firmwareUrl\":7}") == ESP_OK &&
+                !p.fields[0].found && !p.fields[1].found, "members of the wrong type ignored");
+    micro_check(parse_text(&p, "{\"firmwareUrl\":\"a\\\"b\\\\c\\n\"}") == ESP_OK &&
+                strcmp(p.url, "a\"b\\c\n") == 0, "escapes");
+
+    // MQTT payloads are not NUL terminated, only data_len bytes are the command
+    char framed[sizeof(command) + 8];
+    memcpy(framed, command, sizeof(command) - 1);
+    memcpy(framed + sizeof(command) - 1, ",\"x\":1}", 8);
+    micro_check(parse(&p, framed, sizeof(command) - 1) == ESP_OK && p.firmware_sts == 1,
+                "bytes past data_len not read");
+}
+
+static void check_refuses(void)
+{
+    static const struct {
+        const char *text;
+        const char *name;
+    } bad[] = {
+        { "", "empty payload" },
+        { "[1]", "not an object" },
+        { "{\"firmware_sts\":1", "unterminated object" },
+        { "{\"firmware_sts\":1,}", "trailing comma" },
+        { "{\"firmware_sts\" 1}", "missing colon" },
+        { "{firmware_sts:1}", "unquoted key" },
+        { "{\"firmwareUrl\":\"abc}", "unterminated string" },
+        { "{\"firmwareUrl\":\"a\\u0041\"}", "\\u escape" },
+        { "{\"firmwareUrl\":\"a\x01\"}", "control character in a string" },
+        { "{\"firmware_sts\":2147483648}", "int above INT32_MAX" },
+        { "{\"firmware_sts\":1.5}", "fraction" },
+        { "{\"firmware_sts\":1e3}", "exponent" },
+        { "{\"x\":[[[[[[[[[1]]]]]]]]]}", "nesting deeper than CMD_PARSER_MAX_DEPTH" },
+    };
+    parsed_t p;
+    char name[96];
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(name, sizeof(name), "refused: %s", bad[i].name);
+        micro_check(parse_text(&p, bad[i].text) != ESP_OK, name);
+    }
+
+    // One byte over the destination buffer is refused rather than cut short
+    char text[UPDATE_JOB_URL_LEN + 32];
+    int n = snprintf(text, sizeof(text), "{\"firmwareUrl\":\"");
+    memset(text + n, 'u', UPDATE_JOB_URL_LEN);
+    strcpy(text + n + UPDATE_JOB_URL_LEN, "\"}");
+    micro_check(parse_text(&p, text) != ESP_OK, "refused: url longer than its buffer");
+    strcpy(text + n + UPDATE_JOB_URL_LEN - 1, "\"}");
+    micro_check(parse_text(&p, text) == ESP_OK && strlen(p.url) == UPDATE_JOB_URL_LEN - 1, "url filling its buffer");
+}
+
+static void parse_command(void *arg)
+{
+    parsed_t *p = arg;
+
+    parse(p, command, sizeof(command) - 1);
+}
+
+#ifdef HAVE_CJSON
+// cJSON.h comes in through ota_update.h, from CJSON_DIR ahead of the stand-in in flasher/idf
+
+static size_t cjson_allocs;
+static size_t cjson_bytes;
+
+static void *counting_malloc(size_t size)
+{
+    cjson_allocs++;
+    cjson_bytes += size;
+    return malloc(size);
+}
+
+// handle_update_command() before cmd_parser: a DOM of the payload, members looked up and copied out
+static void parse_command_cjson(void *arg)
+{
+    parsed_t *p = arg;
+    cJSON *json = cJSON_ParseWithLength(command, sizeof(command) - 1);
+    cJSON *item;
+
+    memset(p, 0, sizeof(*p));
+    if (!json) {
+        return;
+    }
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(json, "firmware_sts"))) {
+        p->firmware_sts = item->valueint;
+    }
+    if (cJSON_IsString(item = cJSON_GetObjectItem(json, "firmwareUrl"))) {
+        strncpy(p->url, item->valuestring, sizeof(p->url) - 1);
+    }
+    if (cJSON_IsString(item = cJSON_GetObjectItem(json, "sha256"))) {
+        strncpy(p->sha256, item->valuestring, sizeof(p->sha256) - 1);
+    }
+    if (cJSON_IsString(item = cJSON_GetObjectItem(json, "target"))) {
+        strncpy(p->target, item->valuestring, sizeof(p->target) - 1);
+    }
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(json, "priority"))) {
+        p->priority = item->valueint;
+    }
+    if (cJSON_IsString(item = cJSON_GetObjectItem(json, "signature"))) {
+        strncpy(p->signature, item->valuestring, sizeof(p->signature) - 1);
+    }
+    cJSON_Delete(json);
+}
+#endif
+
+static void time_parsers(void)
+{
+    parsed_t p;
+    micro_time_t t;
+
+    t = micro_time(parse_command, &p, TIME_MS);
+    printf("time cmd_parse   %8.0f ns/command %8.0f tsc/command  0 allocations  (%zu byte command)\n",
+           t.ns, t.tsc, sizeof(command) - 1);
+#ifdef HAVE_CJSON
+    cJSON_Hooks hooks = { counting_malloc, free };
+    parsed_t q;
+
+    cJSON_InitHooks(&hooks);
+    parse_command_cjson(&q);
+    parse_command(&p);
+    micro_check(q.firmware_sts == p.firmware_sts && q.priority == p.priority && strcmp(q.url, p.url) == 0 &&
+                strcmp(q.sha256, p.sha256) == 0 && strcmp(q.target, p.target) == 0 &&
+                strcmp(q.signature, p.signature) == 0, "cJSON reads the same command");
+    cjson_allocs = cjson_bytes = 0;
+    parse_command_cjson(&q);
+    size_t allocs = cjson_allocs, bytes = cjson_bytes;
+    t = micro_time(parse_command_cjson, &q, TIME_MS);
+    printf("time cJSON       %8.0f ns/command %8.0f tsc/command  %zu allocations, %zu bytes\n",
+           t.ns, t.tsc, allocs, bytes);
+#else
+    printf("skip cJSON: no cJSON sources, set CJSON_DIR or IDF_PATH when building\n");
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    int quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+
+    check_accepts();
+    check_refuses();
+    if (!quick) {
+        time_parsers();
+    }
+    return micro_result();
+}
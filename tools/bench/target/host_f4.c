@@ -0,0 +1,91 @@
+/*
+ * host_f4.c
+ *
+ * Host stand-in for the F4 bootloader_ram.c: the background sector erase and
+ * word programming with the datasheet timing, and the interrupt driven
+ * command UART, whose ring never overflows at the frame sizes used.
+ */
+
+#include "host_hal.h"
+#include "bootloader_ram.h"
+
+static int64_t host_erase_done_ns;
+static uint32_t host_erase_sector;
+
+void bootloader_uart_start(void)
+{
+}
+
+uint8_t bootloader_uart_available(void)
+{
+    size_t available;
+
+    host_link_lock();
+    available = bench_link_available(&host_link);
+    host_link_unlock();
+    return available ? 1 : 0;
+}
+
+void bootloader_uart_read(uint8_t *pBuffer, uint32_t len)
+{
+    while (len--) {
+        host_uart_read_byte(pBuffer++, INT64_MAX);
+    }
+}
+
+void bootloader_uart_write(const uint8_t *pBuffer, uint32_t len)
+{
+    bench_link_write(&host_link, pBuffer, len);
+    bench_link_drain(&host_link);
+}
+
+void bootloader_flash_erase_start(uint32_t sector)
+{
+    uint32_t size;
+    uint32_t us;
+
+    bl_flash_unit_address((uint16_t)sector, &size);
+    if (size <= 16U * 1024U) {
+        us = host_flash_timing.erase_16k_us;
+    } else if (size <= 64U * 1024U) {
+        us = host_flash_timing.erase_64k_us;
+    } else {
+        us = host_flash_timing.erase_128k_us;
+    }
+    host_erase_sector = sector;
+    host_erase_done_ns = bench_now_ns() + (int64_t)us * 1000;
+}
+
+uint8_t bootloader_flash_busy(void)
+{
+    return bench_now_ns() < host_erase_done_ns;
+}
+
+uint8_t bootloader_flash_erase_end(void)
+{
+    uint32_t size;
+    uint32_t address = bl_flash_unit_address((uint16_t)host_erase_sector, &size);
+
+    bench_sleep_until_ns(host_erase_done_ns);
+    memset((void *)(uintptr_t)address, 0xFF, size);
+    return HAL_OK;
+}
+
+// Programming only clears bits, like the real cells
+uint8_t bootloader_flash_program(uint32_t mem_address, const uint8_t *pBuffer, uint32_t len)
+{
+    uint32_t ops = 0;
+
+    if (mem_address < FLASH_BASE || mem_address + len > FLASH_BASE + BL_BOARD_FLASH_SIZE) {
+        return HAL_ERROR;
+    }
+    for (uint32_t i = 0; i < len; ops++) {
+        uint32_t step = ((mem_address + i) & 3U) == 0 && len - i >= 4 ? 4 : 1;
+
+        for (uint32_t b = 0; b < step; b++, i++) {
+            *(volatile uint8_t *)(uintptr_t)(mem_address + i) &= pBuffer[i];
+        }
+    }
+    host_flash_busy_us(ops * host_flash_timing.program_word_us);
+    return HAL_OK;
+}
@@ -0,0 +1,363 @@
+/*
+ * host_hal.c
+ *
+ * The emulated board: memory map, tick thread, the HAL calls the ports make
+ * and the flash timing behind them. Flash contents are real, erases and
+ * programs take their datasheet time in emulated time; the CPU time of the
+ * bootloader itself is not modelled, it runs at host speed.
+ */
+
+#include "host_hal.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(STM32L0)
+#define HOST_FLASH_ERASED      0x00
+#else
+#define HOST_FLASH_ERASED      0xFF
+#endif
+
+host_flash_timing_t host_flash_timing = {
+    .erase_16k_us = 250000,
+    .erase_64k_us = 550000,
+    .erase_128k_us = 1000000,
+    .program_word_us = 16,
+    .page_op_us = 3200,
+};
+
+bench_link_t host_link;
+UART_HandleTypeDef *host_command_uart;
+
+__IO uint32_t uwTick;
+uint32_t SystemCoreClock = 16000000U;
+uint32_t host_crc_value = 0xFFFFFFFFU;
+
+static pthread_mutex_t host_link_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t host_start_ns;
+static uint32_t host_debug_baud = 115200;
+// End of the last stretch the CPU spent in a blocking flash or UART call, not polling the command UART
+static int64_t host_stall_end_ns;
+
+uint32_t host_crc_feed(uint32_t word)
+{
+    host_crc_value ^= word;
+    for (int i = 0; i < 32; i++) {
+        host_crc_value = (host_crc_value & 0x80000000U) ? (host_crc_value << 1) ^ 0x04C11DB7U : host_crc_value << 1;
+    }
+    return word;
+}
+
+static void host_map(uintptr_t base, size_t size, uint8_t fill)
+{
+    uintptr_t page = base & ~(uintptr_t)0xFFF;
+    size_t len = (base + size - page + 0xFFF) & ~(size_t)0xFFF;
+    void *p = mmap((void *)page, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (p != (void *)page) {
+        fprintf(stderr, "host: cannot map 0x%08lx (+%zu), build with -no-pie\n", (unsigned long)page, len);
+        exit(2);
+    }
+    memset(p, fill, len);
+}
+
+void host_link_lock(void)
+{
+    pthread_mutex_lock(&host_link_mutex);
+}
+
+void host_link_unlock(void)
+{
+    pthread_mutex_unlock(&host_link_mutex);
+}
+
+/* Keeps the registers that count on their own in step with emulated time,
+ * and turns a system reset request into the end of the run */
+static void *host_tick_thread(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        int64_t now = bench_now_ns() - host_start_ns;
+        uint32_t load = SystemCoreClock / 1000U;
+
+        uwTick = (uint32_t)(now / 1000000);
+        SysTick->LOAD = load - 1U;
+        SysTick->VAL = load - 1U - (uint32_t)((now % 1000000) * load / 1000000);
+#if defined(DWT)
+        DWT->CYCCNT = (uint32_t)((double)now * SystemCoreClock / 1e9);
+#endif
+#if defined(STM32L0)
+        if (host_command_uart) {
+            USART_TypeDef *uart = host_command_uart->Instance;
+
+            host_link_lock();
+            if (bench_link_available(&host_link)) {
+                uart->ISR |= USART_ISR_RXNE;
+            } else {
+                uart->ISR &= ~USART_ISR_RXNE;
+            }
+            if (uart->ICR & USART_ICR_ORECF) {
+                uart->ISR &= ~USART_ISR_ORE;
+                uart->ICR = 0;
+            }
+            host_link_unlock();
+        }
+#endif
+        if ((SCB->AIRCR & SCB_AIRCR_SYSRESETREQ_Msk) != 0) {
+            // The update only went through if main.c starts the application after the reset;
+            // the bootloader thread is parked in NVIC_SystemReset() meanwhile
+            uint8_t starts = bootloader_app_is_valid();
+            fprintf(stderr, "host: system reset at %lld ms, %s\n", (long long)(now / 1000000),
+                    starts ? "the application starts" : "no valid boot record, stays in the bootloader");
+            exit(starts ? 0 : 4);
+        }
+        bench_sleep_until_ns(bench_now_ns() + 20000);
+    }
+    return NULL;
+}
+
+void host_board_init(uint32_t idcode, uint32_t old_size, uint32_t seed)
+{
+    pthread_t tick;
+
+    host_map(FLASH_BASE, BL_BOARD_FLASH_SIZE, HOST_FLASH_ERASED);
+    host_map(SRAM1_BASE, 128U * 1024U, 0x00);
+    host_map(UID_BASE, 0x100, 0x00);
+    host_map(PERIPH_BASE, 0x80000, 0x00);
+    host_map(0x50000000U, 0x10000, 0x00);                // AHB2 / IOPORT
+    host_map(0xE0000000U, 0x100000, 0x00);               // core peripherals and DBGMCU
+#if defined(STM32L0)
+    host_map(DATA_EEPROM_BASE, 0x2000, 0x00);
+#endif
+    *(volatile uint16_t *)FLASHSIZE_BASE = BL_BOARD_FLASH_SIZE / 1024U;
+
+    for (uint32_t i = 0; i < 0x20; i += 4) {
+        *(volatile uint32_t *)(UID_BASE + i) = 0x48535430U + i;   // "0TSH", stands in for the lot and wafer
+    }
+    DBGMCU->IDCODE = idcode;
+
+    // The application an update replaces, so the erase has something to do
+    srand(seed);
+    for (uint32_t i = 0; i < old_size && BL_BOARD_APP_BASE + i < BL_BOARD_APP_END; i++) {
+        *(volatile uint8_t *)(uintptr_t)(BL_BOARD_APP_BASE + i) = (uint8_t)rand();
+    }
+
+    host_start_ns = bench_now_ns();
+    if (pthread_create(&tick, NULL, host_tick_thread, NULL) != 0) {
+        perror("tick thread");
+        exit(2);
+    }
+    while (host_start_ns != 0 && uwTick == 0 && SysTick->LOAD == 0) {
+        sched_yield();
+    }
+}
+
+static void host_stall_until_ns(int64_t when_ns)
+{
+    host_stall_end_ns = when_ns;
+    bench_sleep_until_ns(when_ns);
+}
+
+void host_flash_busy_us(uint32_t us)
+{
+    host_stall_until_ns(bench_now_ns() + (int64_t)us * 1000);
+}
+
+// Debug output goes to stderr, at the time it takes on the debug UART
+static void host_debug_write(const char *s, size_t len)
+{
+    fwrite(s, 1, len, stderr);
+    host_stall_until_ns(bench_now_ns() + (int64_t)len * 10 * 1000000000 / host_debug_baud);
+}
+
+int host_printf(const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len > (int)sizeof(line) - 1) {
+        len = sizeof(line) - 1;
+    }
+    if (len > 0) {
+        host_debug_write(line, (size_t)len);
+    }
+    return len;
+}
+
+uint8_t host_uart_read_byte(uint8_t *byte, int64_t deadline_ns)
+{
+    uint8_t got;
+
+    host_link_lock();
+    got = bench_link_read(&host_link, byte, 1, deadline_ns) == 1;
+#if defined(STM32L0)
+    /* The polling loop keeps up with the line, a byte is only left in RDR
+     * when it came in before a blocking call returned, and everything
+     * completed behind it until then was lost. Host scheduling delays
+     * are not the board's and do not count. */
+    if (got && host_link.rx_arrival_ns[(host_link.rx_tail - 1) & (BENCH_LINK_RX_SIZE - 1)] < host_stall_end_ns) {
+        uint8_t lost;
+
+        while (host_link.rx_tail != host_link.rx_head &&
+               host_link.rx_arrival_ns[host_link.rx_tail] < host_stall_end_ns) {
+            bench_link_read(&host_link, &lost, 1, 0);
+            host_command_uart->Instance->ISR |= USART_ISR_ORE;
+        }
+    }
+#endif
+    host_link_unlock();
+    return got;
+}
+
+/* HAL ---------------------------------------------------------------------- */
+
+HAL_StatusTypeDef HAL_Init(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_DeInit(void) { return HAL_OK; }
+uint32_t HAL_GetTick(void) { return uwTick; }
+
+void HAL_Delay(uint32_t Delay)
+{
+    bench_sleep_us((int64_t)Delay * 1000);
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(const RCC_OscInitTypeDef *RCC_OscInitStruct) { (void)RCC_OscInitStruct; return HAL_OK; }
+HAL_StatusTypeDef HAL_RCC_ClockConfig(const RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency)
+{
+    (void)RCC_ClkInitStruct;
+    (void)FLatency;
+    return HAL_OK;
+}
+HAL_StatusTypeDef HAL_RCC_DeInit(void) { return HAL_OK; }
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    (void)GPIOx;
+    (void)GPIO_Pin;
+    (void)PinState;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    (void)GPIOx;
+    (void)GPIO_Pin;
+    return GPIO_PIN_SET;
+}
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart) { (void)huart; return HAL_OK; }
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    (void)Timeout;
+    if (huart != host_command_uart) {
+        host_debug_write((const char *)pData, Size);
+        return HAL_OK;
+    }
+    bench_link_write(&host_link, pData, Size);
+    host_stall_until_ns(host_link.tx_line_free_ns);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    int64_t deadline = Timeout == HAL_MAX_DELAY ? INT64_MAX : bench_now_ns() + (int64_t)Timeout * 1000000;
+
+    if (huart != host_command_uart) {
+        return HAL_TIMEOUT;
+    }
+    while (Size--) {
+        if (!host_uart_read_byte(pData++, deadline)) {
+            return HAL_TIMEOUT;
+        }
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASH_Lock(void) { return HAL_OK; }
+
+#if defined(STM32L0)
+
+static uint8_t host_l0_in_program_memory(uint32_t address, uint32_t len)
+{
+    return address >= FLASH_BASE && address + len <= FLASH_BASE + BL_BOARD_FLASH_SIZE;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError)
+{
+    uint32_t address = pEraseInit->PageAddress;
+
+    *PageError = 0xFFFFFFFFU;
+    for (uint32_t i = 0; i < pEraseInit->NbPages; i++, address += FLASH_PAGE_SIZE) {
+        if (!host_l0_in_program_memory(address, FLASH_PAGE_SIZE)) {
+            *PageError = address;
+            return HAL_ERROR;
+        }
+        host_flash_busy_us(host_flash_timing.page_op_us);
+        memset((void *)(uintptr_t)address, HOST_FLASH_ERASED, FLASH_PAGE_SIZE);
+    }
+    return HAL_OK;
+}
+
+// A word that is not erased cannot be programmed, the L0 flags NOTZEROERR
+static HAL_StatusTypeDef host_l0_program_words(uint32_t address, const uint32_t *words, uint32_t count)
+{
+    volatile uint32_t *cell = (volatile uint32_t *)(uintptr_t)address;
+
+    if ((address & 3U) != 0 || !host_l0_in_program_memory(address, count * 4))
+        return HAL_ERROR;
+    host_flash_busy_us(host_flash_timing.page_op_us);
+    for (uint32_t i = 0; i < count; i++) {
+        if (cell[i] != 0 && words[i] != 0)
+            return HAL_ERROR;
+        cell[i] = words[i];
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint32_t Data)
+{
+    (void)TypeProgram;
+    return host_l0_program_words(Address, &Data, 1);
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_HalfPageProgram(uint32_t Address, uint32_t *pBuffer)
+{
+    if ((Address & (FLASH_PAGE_SIZE / 2U - 1U)) != 0)
+        return HAL_ERROR;
+    return host_l0_program_words(Address, pBuffer, FLASH_PAGE_SIZE / 8U);
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Unlock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Lock(void) { return HAL_OK; }
+
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Program(uint32_t TypeProgram, uint32_t Address, uint32_t Data)
+{
+    (void)TypeProgram;
+    if (Address < DATA_EEPROM_BASE || Address + 4 > DATA_EEPROM_BASE + 0x1800U || (Address & 3U) != 0)
+        return HAL_ERROR;
+    host_flash_busy_us(host_flash_timing.page_op_us);
+    *(volatile uint32_t *)(uintptr_t)Address = Data;
+    return HAL_OK;
+}
+
+#endif
+
+void host_app_start(uint32_t msp)
+{
+    fprintf(stderr, "host: jump to the application, MSP 0x%08lx\n", (unsigned long)msp);
+    exit(0);
+}
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "host: Error_Handler\n");
+    exit(3);
+}
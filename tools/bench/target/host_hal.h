@@ -0,0 +1,41 @@
+/*
+ * host_hal.h
+ *
+ * The emulated board under the host build of a bootloader port: its memory
+ * map, the flash timing, the command link and the debug UART.
+ */
+
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include "bl_core.h"
+#include "bench_link.h"
+
+/* Typical program and erase times from the datasheets, in emulated µs */
+typedef struct {
+    uint32_t erase_16k_us;
+    uint32_t erase_64k_us;
+    uint32_t erase_128k_us;
+    uint32_t program_word_us;        // F4 x32, one word or one byte
+    uint32_t page_op_us;             // L0: page erase, word, half page or EEPROM word
+} host_flash_timing_t;
+
+extern host_flash_timing_t host_flash_timing;
+extern bench_link_t host_link;
+extern UART_HandleTypeDef *host_command_uart;
+
+/* Maps the board's memory at its STM32 addresses, leaves the flash erased
+ * apart from old_size bytes of an earlier image at the application base,
+ * and starts the tick thread */
+void host_board_init(uint32_t idcode, uint32_t old_size, uint32_t seed);
+
+// Receive side of the command link, shared with the tick thread
+void host_link_lock(void);
+void host_link_unlock(void);
+// L0 USART model: one receive data register, a byte that lands on a full one is lost
+uint8_t host_uart_read_byte(uint8_t *byte, int64_t deadline_ns);
+
+// Sleeps the emulated time a flash operation takes
+void host_flash_busy_us(uint32_t us);
+
+#endif /* HOST_HAL_H */
@@ -0,0 +1,109 @@
+/*
+ * host_target.h
+ *
+ * Forced into every bootloader source the bench builds for the host. The
+ * real device and HAL headers are used as they are; this takes the place of
+ * cmsis_gcc.h, whose intrinsics are ARM instructions, and of the CRC unit,
+ * whose data register computes on write.
+ *
+ * Peripheral registers are plain memory mapped at their STM32 addresses,
+ * the few that change on their own (SysTick, the DWT cycle counter, RXNE of
+ * the command USART) are kept up to date by the tick thread in host_hal.c.
+ */
+
+#ifndef HOST_TARGET_H
+#define HOST_TARGET_H
+
+#include <stdint.h>
+
+/* cmsis_gcc.h ------------------------------------------------------------- */
+#define __CMSIS_GCC_H
+
+#define __ASM                    __asm
+#define __INLINE                 inline
+#define __STATIC_INLINE          static inline
+#define __STATIC_FORCEINLINE     __attribute__((always_inline)) static inline
+#define __NO_RETURN              __attribute__((__noreturn__))
+#define __USED                   __attribute__((used))
+#define __WEAK                   __attribute__((weak))
+#define __PACKED                 __attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT          struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION           union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)             __attribute__((aligned(x)))
+#define __RESTRICT               __restrict
+#define __COMPILER_BARRIER()     __asm volatile("" ::: "memory")
+#define __UNALIGNED_UINT16_READ(addr)         (*(const uint16_t *)(const void *)(addr))
+#define __UNALIGNED_UINT16_WRITE(addr, val)   (void)(*(uint16_t *)(void *)(addr) = (val))
+#define __UNALIGNED_UINT32_READ(addr)         (*(const uint32_t *)(const void *)(addr))
+#define __UNALIGNED_UINT32_WRITE(addr, val)   (void)(*(uint32_t *)(void *)(addr) = (val))
+#define __UNALIGNED_UINT32(x)                 (*(uint32_t *)(x))
+
+#define __NOP()                  __COMPILER_BARRIER()
+#define __WFI()                  __COMPILER_BARRIER()
+#define __WFE()                  __COMPILER_BARRIER()
+#define __SEV()                  __COMPILER_BARRIER()
+#define __BKPT(value)            __builtin_trap()
+
+// Starts the application: the host build reports the jump and exits
+__NO_RETURN void host_app_start(uint32_t msp);
+
+__STATIC_FORCEINLINE void __ISB(void) { __COMPILER_BARRIER(); }
+__STATIC_FORCEINLINE void __DSB(void) { __COMPILER_BARRIER(); }
+__STATIC_FORCEINLINE void __DMB(void) { __COMPILER_BARRIER(); }
+__STATIC_FORCEINLINE uint32_t __REV(uint32_t value) { return __builtin_bswap32(value); }
+__STATIC_FORCEINLINE uint32_t __REV16(uint32_t value) { return ((value & 0x00FF00FFU) << 8) | ((value >> 8) & 0x00FF00FFU); }
+__STATIC_FORCEINLINE int16_t __REVSH(int16_t value) { return (int16_t)__builtin_bswap16((uint16_t)value); }
+__STATIC_FORCEINLINE uint32_t __ROR(uint32_t op1, uint32_t op2) { op2 %= 32U; return op2 ? (op1 >> op2) | (op1 << (32U - op2)) : op1; }
+__STATIC_FORCEINLINE uint8_t __CLZ(uint32_t value) { return value ? (uint8_t)__builtin_clz(value) : 32U; }
+__STATIC_FORCEINLINE uint32_t __RBIT(uint32_t value)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 32; i++, value >>= 1) result = (result << 1) | (value & 1U);
+    return result;
+}
+__STATIC_FORCEINLINE void __enable_irq(void) { }
+__STATIC_FORCEINLINE void __disable_irq(void) { }
+__STATIC_FORCEINLINE void __enable_fault_irq(void) { }
+__STATIC_FORCEINLINE void __disable_fault_irq(void) { }
+__STATIC_FORCEINLINE uint32_t __get_CONTROL(void) { return 0; }
+__STATIC_FORCEINLINE void __set_CONTROL(uint32_t control) { (void)control; }
+__STATIC_FORCEINLINE uint32_t __get_IPSR(void) { return 0; }
+__STATIC_FORCEINLINE uint32_t __get_APSR(void) { return 0; }
+__STATIC_FORCEINLINE uint32_t __get_xPSR(void) { return 0; }
+__STATIC_FORCEINLINE uint32_t __get_PSP(void) { return 0; }
+__STATIC_FORCEINLINE void __set_PSP(uint32_t top) { (void)top; }
+__STATIC_FORCEINLINE uint32_t __get_MSP(void) { return 0; }
+__STATIC_FORCEINLINE void __set_MSP(uint32_t top) { host_app_start(top); }
+__STATIC_FORCEINLINE uint32_t __get_PRIMASK(void) { return 0; }
+__STATIC_FORCEINLINE void __set_PRIMASK(uint32_t mask) { (void)mask; }
+__STATIC_FORCEINLINE uint32_t __get_BASEPRI(void) { return 0; }
+__STATIC_FORCEINLINE void __set_BASEPRI(uint32_t value) { (void)value; }
+__STATIC_FORCEINLINE void __set_BASEPRI_MAX(uint32_t value) { (void)value; }
+__STATIC_FORCEINLINE uint32_t __get_FAULTMASK(void) { return 0; }
+__STATIC_FORCEINLINE void __set_FAULTMASK(uint32_t mask) { (void)mask; }
+__STATIC_FORCEINLINE uint32_t __get_FPSCR(void) { return 0; }
+__STATIC_FORCEINLINE void __set_FPSCR(uint32_t fpscr) { (void)fpscr; }
+__STATIC_FORCEINLINE uint8_t __LDREXB(volatile uint8_t *addr) { return *addr; }
+__STATIC_FORCEINLINE uint16_t __LDREXH(volatile uint16_t *addr) { return *addr; }
+__STATIC_FORCEINLINE uint32_t __LDREXW(volatile uint32_t *addr) { return *addr; }
+__STATIC_FORCEINLINE uint32_t __STREXB(uint8_t value, volatile uint8_t *addr) { *addr = value; return 0; }
+__STATIC_FORCEINLINE uint32_t __STREXH(uint16_t value, volatile uint16_t *addr) { *addr = value; return 0; }
+__STATIC_FORCEINLINE uint32_t __STREXW(uint32_t value, volatile uint32_t *addr) { *addr = value; return 0; }
+__STATIC_FORCEINLINE void __CLREX(void) { }
+
+/* CRC unit ---------------------------------------------------------------- */
+/* The STM32 CRC: polynomial 0x04C11DB7, reset to 0xFFFFFFFF, one 32 bit word
+ * per write. The core feeds it a byte per word. */
+extern uint32_t host_crc_value;
+uint32_t host_crc_feed(uint32_t word);
+#define BL_CRC_RESET()           (host_crc_value = 0xFFFFFFFFU)
+#define BL_CRC_FEED(value)       host_crc_feed(value)
+#define BL_CRC_VALUE()           (host_crc_value)
+
+/* Debug UART ------------------------------------------------------------- */
+/* printf() reaches the debug UART through __io_putchar() on the F4, the host
+ * build writes to stderr and takes the time the UART would */
+int host_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define printf                   host_printf
+
+#endif /* HOST_TARGET_H */
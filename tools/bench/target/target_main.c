@@ -0,0 +1,86 @@
+/*
+ * target_main.c
+ *
+ * Host build of one bootloader port, in update mode on the command UART.
+ *
+ *   bl_host_<board> --link fd:N|PATH --baud B [--speed S] [--old-size N] [--seed N]
+ *
+ * Stands in for main.c: the UART handles and the clock the port runs the
+ * update at. Exits when the bootloader resets or starts the application, with
+ * 0 only if the application it leaves behind would start.
+ */
+
+#include "host_hal.h"
+
+#include <stdlib.h>
+
+#if defined(STM32F401xE)
+UART_HandleTypeDef huart1 = { .Instance = USART1 };
+UART_HandleTypeDef huart2 = { .Instance = USART2 };
+UART_HandleTypeDef huart6 = { .Instance = USART6 };
+#define HOST_COMMAND_UART      (&huart1)
+#define HOST_IDCODE            0x10006433U
+#define HOST_CLOCK_HZ          84000000U          // after bootloader_clock_boost()
+#elif defined(STM32F446xx)
+UART_HandleTypeDef huart2 = { .Instance = USART2 };
+UART_HandleTypeDef huart3 = { .Instance = USART3 };
+UART_HandleTypeDef huart5 = { .Instance = UART5 };
+#define HOST_COMMAND_UART      (&huart3)
+#define HOST_IDCODE            0x10006421U
+#define HOST_CLOCK_HZ          180000000U
+#elif defined(STM32L073xx)
+UART_HandleTypeDef huart1 = { .Instance = USART1 };
+UART_HandleTypeDef huart2 = { .Instance = USART2 };
+#define HOST_COMMAND_UART      (&huart1)
+#define HOST_IDCODE            0x10086447U
+#define HOST_CLOCK_HZ          32000000U
+#else
+#error "No host board for this device"
+#endif
+
+CRC_HandleTypeDef hcrc = { .Instance = CRC };
+
+int main(int argc, char **argv)
+{
+    const char *link = NULL;
+    uint32_t baud = 115200;
+    uint32_t old_size = 0;
+    uint32_t seed = 1;
+    double speed = 1.0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--link") == 0) {
+            link = argv[i + 1];
+        } else if (strcmp(argv[i], "--baud") == 0) {
+            baud = strtoul(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "--speed") == 0) {
+            speed = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "--old-size") == 0) {
+            old_size = strtoul(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoul(argv[i + 1], NULL, 0);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!link) {
+        fprintf(stderr, "usage: %s --link fd:N|PATH --baud B [--speed S] [--old-size N] [--seed N]\n", argv[0]);
+        return 2;
+    }
+
+    bench_time_init(speed);
+    if (bench_link_open(&host_link, link, baud, 1) != 0) {
+        return 2;
+    }
+    host_command_uart = HOST_COMMAND_UART;
+    host_board_init(HOST_IDCODE, old_size, seed);
+    SystemCoreClock = HOST_CLOCK_HZ;
+
+#if !defined(STM32L0)
+    C_UART = HOST_COMMAND_UART;
+#endif
+    // The path bootloader_main() takes when there is no valid application
+    bootloader_uart_read_data();
+    return 0;
+}